@@ -0,0 +1,215 @@
+#include <math.h>
+#include <cstring>
+#include <ADCFilter.hpp>
+
+ADCFilter::ADCFilter(const CBC::ADC::filterConfig& config) :
+    m_config(config)
+{
+    /* Sanitize the configuration */
+    if (m_config.median != 3 && m_config.median != 5)
+        m_config.median = 0;
+    if (m_config.decimation < 1)
+        m_config.decimation = 1;
+    if (m_config.cicOrder < 1)
+        m_config.cicOrder = 1;
+    if (m_config.firTaps < 0)
+        m_config.firTaps = 0;
+    if (!(m_config.firCutoff > 0 && m_config.firCutoff <= 0.5))
+        m_config.firCutoff = 0.5;
+
+    m_integrator.resize(m_config.cicOrder);
+    m_comb.resize(m_config.cicOrder);
+    m_cicGain = 1.0f / pow(m_config.decimation, m_config.cicOrder);
+
+    /* Windowed-sinc (Hamming) low-pass, normalized to unity DC gain */
+    int ntaps = m_config.firTaps;
+    if (ntaps > 0) {
+        m_taps.resize(ntaps);
+        m_history.resize(ntaps);
+
+        double sum = 0;
+        double fc  = m_config.firCutoff;
+        for (int i=0; i<ntaps; i++) {
+            double x    = i - (ntaps-1)/2.0;
+            double sinc = (x==0) ? 2*fc : sin(2*M_PI*fc*x)/(M_PI*x);
+            double win  = (ntaps==1) ? 1 : 0.54 - 0.46*cos(2*M_PI*i/(ntaps-1));
+            m_taps[i]   = sinc*win;
+            sum        += m_taps[i];
+        }
+        for (int i=0; i<ntaps; i++)
+            m_taps[i] /= sum;
+    }
+
+    reset();
+}
+
+void ADCFilter::reset()
+{
+    memset(m_median, 0, sizeof(m_median));
+    m_nmedian  = 0;
+    m_phase     = 0;
+    m_transient = m_config.cicOrder - 1;
+    m_ihistory  = 0;
+    m_primed   = false;
+
+    for (unsigned i=0; i<m_integrator.size(); i++)
+        m_integrator[i] = m_comb[i] = 0;
+    for (unsigned i=0; i<m_history.size(); i++)
+        m_history[i] = 0;
+}
+
+int ADCFilter::decimation()
+{
+    return (m_config.decimation);
+}
+
+int ADCFilter::settling()
+{
+    /* The first output of the CIC is already a complete R-sample sum; the
+     * remaining cicOrder-1 comb delays need one output each to flush. The
+     * median only emits once its window is full, and the FIR history is
+     * primed with the first settled CIC output, so neither adds a transient. */
+    return (m_config.cicOrder - 1);
+}
+
+double ADCFilter::effectiveSamples(int noutputs)
+{
+    unsigned ratio = m_config.decimation;
+
+    /* Impulse response of the CIC at the input rate: cicOrder boxcars of
+     * ratio samples, each of unity gain */
+    std::vector<double> cic (1, 1.0);
+    for (int stage=0; stage<m_config.cicOrder; stage++) {
+        std::vector<double> box (cic.size() + ratio - 1, 0.0);
+        double running = 0;
+        for (unsigned k=0; k<box.size(); k++) {
+            if (k < cic.size())
+                running += cic[k];
+            if (k >= ratio && k-ratio < cic.size())
+                running -= cic[k-ratio];
+            box[k] = running / ratio;
+        }
+        cic.swap(box);
+    }
+
+    /* and of the whole filter, the FIR taps being ratio input samples apart */
+    std::vector<double> response (cic);
+    if (m_config.firTaps) {
+        response.assign(cic.size() + (m_taps.size()-1)*ratio, 0.0);
+        for (unsigned i=0; i<m_taps.size(); i++)
+            for (unsigned k=0; k<cic.size(); k++)
+                response[i*ratio + k] += m_taps[i] * cic[k];
+    }
+
+    double sumsq = 0;
+    for (unsigned k=0; k<response.size(); k++)
+        sumsq += response[k]*response[k];
+
+    /* The outputs have variance sigma^2 * sumsq. Each polyphase component of
+     * the response sums to 1/ratio, so their mean has the variance of the
+     * mean of noutputs*ratio independent input samples, sigma^2 / (noutputs*ratio). */
+    double neffective = noutputs * ratio * sumsq;
+    return (neffective > 1 ? neffective : 1);
+}
+
+bool ADCFilter::median(uint32_t sample, uint32_t& out)
+{
+    int length = m_config.median;
+
+    /* Shift the window */
+    for (int i=length-1; i>0; i--)
+        m_median[i] = m_median[i-1];
+    m_median[0] = sample;
+
+    if (m_nmedian < length) {
+        m_nmedian++;
+        if (m_nmedian < length)
+            return (false);
+    }
+
+    /* Insertion sort of at most 5 elements */
+    uint32_t sorted[5];
+    for (int i=0; i<length; i++) {
+        uint32_t v = m_median[i];
+        int j = i;
+        for (; j>0 && sorted[j-1] > v; j--)
+            sorted[j] = sorted[j-1];
+        sorted[j] = v;
+    }
+
+    out = sorted[length/2];
+    return (true);
+}
+
+float ADCFilter::fir(float sample)
+{
+    int ntaps = m_config.firTaps;
+
+    /* Prime the history with the first input, rather than zeros, so the
+     * output does not have to ramp up */
+    if (!m_primed) {
+        for (int i=0; i<ntaps; i++)
+            m_history[i] = sample;
+        m_primed = true;
+    }
+
+    m_history[m_ihistory] = sample;
+
+    /* taps are symmetric, so the direction of the convolution does not matter */
+    float acc = 0;
+    int   k   = m_ihistory;
+    for (int i=0; i<ntaps; i++) {
+        acc += m_taps[i] * m_history[k];
+        if (--k < 0)
+            k = ntaps-1;
+    }
+
+    if (++m_ihistory == ntaps)
+        m_ihistory = 0;
+
+    return (acc);
+}
+
+bool ADCFilter::push(uint32_t sample, float& out)
+{
+    if (m_config.median && !median(sample, sample))
+        return (false);
+
+    /* Integrators run at the input rate */
+    uint64_t value = sample;
+    int      order = m_config.cicOrder;
+    for (int i=0; i<order; i++)
+        value = (m_integrator[i] += value);
+
+    if (++m_phase < m_config.decimation)
+        return (false);
+    m_phase = 0;
+
+    /* Combs run at the decimated rate */
+    for (int i=0; i<order; i++) {
+        uint64_t previous = m_comb[i];
+        m_comb[i] = value;
+        value    -= previous;
+    }
+
+    float result = static_cast<float>(static_cast<double>(value) * m_cicGain);
+
+    /* The FIR starts from the first settled CIC output; those before it are
+     * passed through, to be discarded (c.f. settling) */
+    if (m_transient > 0)
+        m_transient--;
+    else if (m_config.firTaps)
+        result = fir(result);
+
+    out = result;
+    return (true);
+}
+
+int ADCFilter::filter(const uint32_t* samples, int nsamples, float* out)
+{
+    int nout = 0;
+    for (int i=0; i<nsamples; i++)
+        if (push(samples[i], out[nout]))
+            nout++;
+    return (nout);
+}
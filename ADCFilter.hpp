@@ -0,0 +1,82 @@
+/*
+ * Streaming oversampling/decimation filter for raw TLC3548 samples
+ */
+
+#ifndef ADCFILTER_HPP
+#define ADCFILTER_HPP
+
+#include <stdint.h>
+#include <vector>
+#include <cbc.hpp>
+
+/*!
+ * Filters a stream of raw ADC samples (in counts) through up to three stages:
+ *
+ *      <UL>
+ *      <LI> an optional 3- or 5-point running median, which removes isolated spikes
+ *      <LI> a CIC decimator of order N and ratio R (N=1 is a boxcar average over R samples)
+ *      <LI> an optional windowed-sinc FIR low-pass running at the decimated rate
+ *      </UL>
+ *
+ * Each stage keeps only a few words of state, so samples can be pushed one at a
+ * time as they arrive. Outputs are in counts, with fractional resolution.
+ */
+class ADCFilter
+{
+    public:
+        ADCFilter(const CBC::ADC::filterConfig& config);
+
+        /*! @brief Clear the filter state */
+        void reset();
+
+        /*! @brief Push one raw sample
+         *  @param sample Raw ADC sample, in counts
+         *  @param out Filtered output, written when one is ready
+         *  @return true when out was written */
+        bool push(uint32_t sample, float& out);
+
+        /*! @brief Filter a block of samples
+         *  @param samples Raw ADC samples, in counts
+         *  @param nsamples Number of samples
+         *  @param out Filtered outputs; must hold at least nsamples / decimation entries
+         *  @return Number of outputs written */
+        int filter(const uint32_t* samples, int nsamples, float* out);
+
+        /*! @brief Number of outputs produced before the filter has settled.
+         *  These depend on the (zero) initial state and should be discarded. */
+        int settling();
+
+        /*! @brief Number of independent raw samples whose mean is as noisy as the mean
+         *  of noutputs outputs; consecutive outputs are correlated when cicOrder > 1 or
+         *  with the FIR. Divide the output stddev by its square root for the error of
+         *  the mean. Assumes white input noise. */
+        double effectiveSamples(int noutputs);
+
+        /*! @brief Decimation ratio between input samples and outputs */
+        int decimation();
+
+    private:
+        CBC::ADC::filterConfig m_config;
+
+        // median pre-filter
+        uint32_t m_median[5];
+        int      m_nmedian;
+
+        // CIC decimator; modular integer arithmetic makes the integrator wrap-around harmless
+        std::vector<uint64_t> m_integrator;
+        std::vector<uint64_t> m_comb;
+        int                   m_phase;
+        float                 m_cicGain;
+        int                   m_transient;  // CIC outputs left before it has settled
+
+        // FIR low-pass
+        std::vector<float> m_taps;
+        std::vector<float> m_history;
+        int                m_ihistory;
+        bool               m_primed;
+
+        bool  median (uint32_t sample, uint32_t& out);
+        float fir    (float sample);
+};
+
+#endif // ADCFILTER_HPP
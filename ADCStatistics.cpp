@@ -0,0 +1,94 @@
+#include <ADCStatistics.hpp>
+#include <TLC3548_ADC.hpp>
+#include <math.h>
+
+namespace ADCStatistics {
+
+    uint32_t isqrt(uint64_t x)
+    {
+        if (x == 0)
+            return 0;
+
+        /* Start from the highest even bit at or below the top bit of x */
+        uint64_t root = 0;
+        uint64_t bit  = 1ULL << ((63 - __builtin_clzll(x)) & ~1);
+
+        while (bit) {
+            if (x >= root + bit) {
+                x    -= root + bit;
+                root  = (root >> 1) + bit;
+            }
+            else {
+                root >>= 1;
+            }
+            bit >>= 2;
+        }
+        return static_cast<uint32_t>(root);
+    }
+
+    void floatStat(const MirrorControlBoard::ADCStat& stat, uint32_t nsamples, float gain, float offset, CBC::ADC::adcData& data)
+    {
+        const double volts = 5.0 / TLC3548::fullScaleUSB() * gain;
+
+        double mean = 0, stddev = 0;
+        if (nsamples > 0) {
+            mean = double(stat.sum) / nsamples;
+            double var = double(stat.sumsq) / nsamples - mean*mean;
+            stddev = sqrt(var > 0 ? var : 0);
+        }
+
+        data.voltage      = mean     * volts + offset;
+        data.stddev       = stddev   * volts;
+        data.voltageMin   = stat.min * volts + offset;
+        data.voltageMax   = stat.max * volts + offset;
+        data.voltageError = (nsamples > 0) ? stddev / sqrt(double(nsamples)) * volts : 0;
+    }
+
+    CBC::ADC::adcDataFixed fixedStat(const MirrorControlBoard::ADCStat& stat, uint32_t nsamples)
+    {
+        CBC::ADC::adcDataFixed fixed;
+
+        fixed.nsamples = nsamples;
+        fixed.status   = CBC::ADC::STATUS_OK;
+        fixed.min      = stat.min;
+        fixed.max      = stat.max;
+
+        if (nsamples == 0) {
+            fixed.mean = fixed.stddev = fixed.error = 0;
+            return fixed;
+        }
+
+        /* mean, Q16: sum is below 2^14 * 2^32, so sum << 16 fits in 64 bits */
+        uint64_t mean = (static_cast<uint64_t>(stat.sum) << 16) / nsamples;
+
+        /* <x^2>, Q32, split into quotient and remainder to stay in 64 bits */
+        uint64_t q    = stat.sumsq / nsamples;
+        uint64_t r    = stat.sumsq % nsamples;
+        uint64_t meansq = (q << 32) + (r << 32) / nsamples;
+
+        /* variance = <x^2> - <x>^2, Q32 */
+        uint64_t mean2 = mean * mean;
+        uint64_t var   = (meansq > mean2) ? meansq - mean2 : 0;
+
+        fixed.mean   = static_cast<uint32_t>(mean);
+        fixed.stddev = isqrt(var);
+
+        /* stddev / sqrt(N), with sqrt(N) in Q8 */
+        fixed.error  = static_cast<uint32_t>((static_cast<uint64_t>(fixed.stddev) << 8) /
+                                             isqrt(static_cast<uint64_t>(nsamples) << 16));
+
+        return fixed;
+    }
+
+    void toVolts(const CBC::ADC::adcDataFixed& fixed, float gain, float offset, CBC::ADC::adcData& data)
+    {
+        const float volts   = 5.0f / TLC3548::fullScaleUSB() * gain;
+        const float voltsQ16 = volts / 65536;
+
+        data.voltage      = fixed.mean   * voltsQ16 + offset;
+        data.stddev       = fixed.stddev * voltsQ16;
+        data.voltageMin   = fixed.min    * volts    + offset;
+        data.voltageMax   = fixed.max    * volts    + offset;
+        data.voltageError = fixed.error  * voltsQ16;
+    }
+}
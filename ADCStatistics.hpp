@@ -0,0 +1,36 @@
+/*
+ * Statistics of accumulated ADC samples
+ */
+
+#ifndef ADCSTATISTICS_HPP
+#define ADCSTATISTICS_HPP
+
+#include <stdint.h>
+#include <cbc.hpp>
+#include <MirrorControlBoard.hpp>
+
+/*
+ * floatStat computes the statistics from the integer sums in double precision,
+ * the default. fixedStat computes them in Q16/Q32 fixed point, converted to
+ * volts only once by toVolts, for FPUs on which double precision arithmetic is
+ * slow; bench/bench_stats compares the two on the target.
+ */
+namespace ADCStatistics
+{
+    // Mean, standard deviation, error of the mean, min and max of nsamples samples,
+    // in volts on the nominal 0-5 V scale with corrected = gain*volts + offset applied.
+    // Fields of data which are not statistics are left untouched.
+    void floatStat(const MirrorControlBoard::ADCStat& stat, uint32_t nsamples, float gain, float offset, CBC::ADC::adcData& data);
+
+    // Integer square root, rounded down
+    uint32_t isqrt(uint64_t x);
+
+    // Mean, standard deviation and error of the mean of nsamples samples, in counts
+    CBC::ADC::adcDataFixed fixedStat(const MirrorControlBoard::ADCStat& stat, uint32_t nsamples);
+
+    // Converts to volts on the nominal 0-5 V scale, then applies corrected = gain*volts + offset.
+    // Fields of data which have no fixed-point counterpart are left untouched.
+    void toVolts(const CBC::ADC::adcDataFixed& fixed, float gain, float offset, CBC::ADC::adcData& data);
+};
+
+#endif // ADCSTATISTICS_HPP
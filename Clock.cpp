@@ -0,0 +1,64 @@
+#include <time.h>
+#include <errno.h>
+#include <Clock.hpp>
+
+Clock::~Clock()
+{
+}
+
+//------------------------------------------------------------------------------
+// RealClock
+//------------------------------------------------------------------------------
+
+uint64_t RealClock::now()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec)*1000000000ULL + now.tv_nsec;
+}
+
+void RealClock::sleepUntil(uint64_t deadline)
+{
+    struct timespec until;
+    until.tv_sec  = deadline / 1000000000ULL;
+    until.tv_nsec = deadline % 1000000000ULL;
+
+    /* Absolute, so a signal interrupting the sleep does not stretch it */
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+}
+
+void RealClock::spinUntil(uint64_t deadline)
+{
+    while (now() < deadline);
+}
+
+//------------------------------------------------------------------------------
+// VirtualClock
+//------------------------------------------------------------------------------
+
+VirtualClock::VirtualClock(uint64_t start) :
+    m_now (start)
+{
+}
+
+uint64_t VirtualClock::now()
+{
+    return m_now.load();
+}
+
+void VirtualClock::sleepUntil(uint64_t deadline)
+{
+    /* Never backwards, also when several threads wait at once */
+    uint64_t current = m_now.load();
+    while (current < deadline && !m_now.compare_exchange_weak(current, deadline));
+}
+
+void VirtualClock::spinUntil(uint64_t deadline)
+{
+    sleepUntil(deadline);
+}
+
+void VirtualClock::advance(uint64_t nanos)
+{
+    m_now += nanos;
+}
@@ -0,0 +1,59 @@
+/*
+ * Clock.hpp - Time source for the delays and deadlines of the library: the
+ * monotonic system clock (RealClock), or a virtual clock which jumps straight
+ * to every deadline (VirtualClock), for running against simulated hardware
+ * without waiting.
+ */
+
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include <stdint.h>
+#include <atomic>
+
+class Clock
+{
+    public:
+        virtual ~Clock();
+
+        // Current time in nanoseconds; only differences are meaningful
+        virtual uint64_t now() = 0;
+
+        // Returns once now() has reached deadline. sleepUntil may give up the
+        // CPU meanwhile, spinUntil keeps it for the sake of precise timing.
+        virtual void sleepUntil(uint64_t deadline) = 0;
+        virtual void spinUntil(uint64_t deadline) = 0;
+
+        void sleepFor(uint64_t nanos) { sleepUntil(now() + nanos); }
+        void spinFor(uint64_t nanos)  { spinUntil(now() + nanos); }
+};
+
+// CLOCK_MONOTONIC
+class RealClock : public Clock
+{
+    public:
+        uint64_t now();
+        void     sleepUntil(uint64_t deadline);
+        void     spinUntil(uint64_t deadline);
+};
+
+// Time passes only by waiting: a wait moves the clock to its deadline, if it
+// is not past it already, and returns at once. The order of deadlines is kept,
+// so paced loops see the same timestamps as on a real clock with no overhead.
+class VirtualClock : public Clock
+{
+    public:
+        VirtualClock(uint64_t start = 0);
+
+        uint64_t now();
+        void     sleepUntil(uint64_t deadline);
+        void     spinUntil(uint64_t deadline);
+
+        // Moves the clock forward by nanos, e.g. to model time spent elsewhere
+        void advance(uint64_t nanos);
+
+    private:
+        std::atomic<uint64_t> m_now;
+};
+
+#endif // CLOCK_HPP
@@ -0,0 +1,135 @@
+#include <cassert>
+#include <cstring>
+#include <math.h>
+#include <EncoderCalibration.hpp>
+
+EncoderCalibration::EncoderCalibration(float temperatureRef) :
+    m_temperatureRef(temperatureRef)
+{
+    clear();
+}
+
+void EncoderCalibration::clear()
+{
+    memset(m_acc, 0, sizeof(m_acc));
+}
+
+uint64_t EncoderCalibration::getPoints(int iencoder)
+{
+    assert(iencoder>0);
+    assert(iencoder<7);
+
+    return (m_acc[iencoder-1].n);
+}
+
+void EncoderCalibration::addPoint(int iencoder, float voltage, float temperature, float reference)
+{
+    assert(iencoder>0);
+    assert(iencoder<7);
+
+    Accumulator &acc = m_acc[iencoder-1];
+
+    /* V_meas - V_act = a + b*V_act + c*(T-T0) + d*V_act*(T-T0) is linear in (a,b,c,d) */
+    double temperature_diff = temperature - m_temperatureRef;
+    double x[NPAR] = {1.0, reference, temperature_diff, reference*temperature_diff};
+    double y       = voltage - reference;
+
+    /* Rotate the new row into the triangular factor, one column at a time */
+    for (int i=0; i<NPAR; i++) {
+        if (x[i] == 0)
+            continue;
+
+        double rii = acc.r[i][i];
+        double h   = sqrt(rii*rii + x[i]*x[i]);
+        double c   = rii  / h;
+        double s   = x[i] / h;
+
+        acc.r[i][i] = h;
+        for (int j=i+1; j<NPAR; j++) {
+            double rij  = acc.r[i][j];
+            acc.r[i][j] = c*rij  + s*x[j];
+            x[j]        = c*x[j] - s*rij;
+        }
+
+        double zi = acc.z[i];
+        acc.z[i]  = c*zi + s*y;
+        y         = c*y  - s*zi;
+    }
+
+    /* Whatever is left of y cannot be explained by the model */
+    acc.rss += y*y;
+    acc.n++;
+}
+
+bool EncoderCalibration::solve(int iencoder, Coefficients& coefficients)
+{
+    assert(iencoder>0);
+    assert(iencoder<7);
+
+    Accumulator &acc = m_acc[iencoder-1];
+
+    if (acc.n == 0)
+        return (false);
+
+    /* Columns whose diagonal is negligible compared to the largest one are
+     * not constrained by the data; drop them from the solution */
+    double rmax = 0;
+    for (int i=0; i<NPAR; i++)
+        rmax = fmax(rmax, fabs(acc.r[i][i]));
+    double tolerance = rmax * 1e-9;
+
+    /* Back substitution */
+    double p[NPAR];
+    for (int i=NPAR-1; i>=0; i--) {
+        if (fabs(acc.r[i][i]) <= tolerance) {
+            p[i] = 0;
+            continue;
+        }
+        double sum = acc.z[i];
+        for (int j=i+1; j<NPAR; j++)
+            sum -= acc.r[i][j] * p[j];
+        p[i] = sum / acc.r[i][i];
+    }
+
+    coefficients.voltageOffset     = p[0];
+    coefficients.voltageSlope      = p[1];
+    coefficients.temperatureOffset = p[2];
+    coefficients.temperatureSlope  = p[3];
+
+    return (true);
+}
+
+double EncoderCalibration::getResidual(int iencoder)
+{
+    assert(iencoder>0);
+    assert(iencoder<7);
+
+    Accumulator &acc = m_acc[iencoder-1];
+
+    if (acc.n == 0)
+        return (0);
+
+    return (sqrt(acc.rss / acc.n));
+}
+
+int EncoderCalibration::writeConfig(CBC::Config& config)
+{
+    int nwritten = 0;
+
+    config.encoderTemperatureRef = m_temperatureRef;
+
+    for (int i=0; i<6; i++) {
+        Coefficients coefficients;
+        if (!solve(i+1, coefficients))
+            continue;
+
+        config.encoderVoltageOffset     [i] = coefficients.voltageOffset;
+        config.encoderVoltageSlope      [i] = coefficients.voltageSlope;
+        config.encoderTemperatureOffset [i] = coefficients.temperatureOffset;
+        config.encoderTemperatureSlope  [i] = coefficients.temperatureSlope;
+
+        nwritten++;
+    }
+
+    return (nwritten);
+}
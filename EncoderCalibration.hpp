@@ -0,0 +1,80 @@
+/*
+ * Offline least-squares fit of the encoder voltage/temperature correction
+ * applied by CBC::ADC::readEncoder.
+ */
+
+#ifndef ENCODERCALIBRATION_HPP
+#define ENCODERCALIBRATION_HPP
+
+#include <stdint.h>
+#include <cbc.hpp>
+
+/*!
+ * Fits the encoder correction model used by CBC::ADC::readEncoder,
+ *
+ *      V_meas = a + (1+b)*V_act + c*(T-T0) + d*V_act*(T-T0)
+ *
+ * to logged (raw voltage, temperature, reference) tuples, separately for each
+ * of the six encoders. Points are folded into an upper triangular factor with
+ * Givens rotations as they arrive (a square-root information filter), so the
+ * memory use is constant, each point costs a few dozen flops, and the
+ * solution does not suffer the loss of precision of the normal equations.
+ */
+class EncoderCalibration
+{
+    public:
+        /*! Fitted correction for one encoder, named after the CBC::Config fields */
+        struct Coefficients {
+            /*! a: constant offset */
+            float voltageOffset;
+            /*! b: slope correction */
+            float voltageSlope;
+            /*! c: temperature dependent offset */
+            float temperatureOffset;
+            /*! d: temperature dependent slope */
+            float temperatureSlope;
+        };
+
+        /*! @param temperatureRef Reference temperature sensor voltage T0 (c.f. CBC::Config::encoderTemperatureRef) */
+        EncoderCalibration(float temperatureRef = CBC::Config().encoderTemperatureRef);
+
+        /*! @brief Add one logged point
+         *  @param iencoder Encoder 1-6
+         *  @param voltage Raw (uncorrected) encoder voltage
+         *  @param temperature Onboard temperature sensor voltage at the time of the reading
+         *  @param reference Voltage an ideal encoder reads at the reference position */
+        void addPoint (int iencoder, float voltage, float temperature, float reference);
+
+        /*! @brief Discard all points */
+        void clear ();
+
+        /*! @brief Number of points accumulated for encoder 1-6 */
+        uint64_t getPoints (int iencoder);
+
+        /*! @brief Solve for the coefficients of encoder 1-6.
+         *
+         * Terms which the data does not constrain (e.g. no temperature variation
+         * in the log) are set to zero. Returns false if the encoder has no points. */
+        bool solve (int iencoder, Coefficients& coefficients);
+
+        /*! @brief RMS residual of the fit of encoder 1-6, in volts */
+        double getResidual (int iencoder);
+
+        /*! @brief Solve all encoders with data and write the coefficients into config.
+         *  Encoders without data keep their current values. Returns the number of encoders written. */
+        int writeConfig (CBC::Config& config);
+
+    private:
+        static const int NPAR = 4;
+
+        struct Accumulator {
+            double   r[NPAR][NPAR];  // upper triangular factor
+            double   z[NPAR];        // rotated right hand side
+            double   rss;            // residual sum of squares
+            uint64_t n;
+        } m_acc[6];
+
+        float m_temperatureRef;
+};
+
+#endif // ENCODERCALIBRATION_HPP
@@ -1,7 +1,7 @@
 /*
  * Interface to access GPIO Moduels of Overo EarthSTORM COM, Texas Instruments
- * AM3703 CPU Directly accesses CPU Physical Memory at /dev/mem by mapping into
- * virtual address space.
+ * AM3703 CPU. The registers are accessed through a RegisterBackend, i.e.
+ * directly in CPU Physical Memory at /dev/mem, or on a simulated board.
  */
 
 #ifndef GPIOINTERFACE_H
@@ -10,12 +10,20 @@
 #include <sys/types.h>
 #include <stdint.h>
 #include <sys/mman.h>
+#include <mutex>
 #include <Layout.hpp>
+#include <RegisterBackend.hpp>
 
+/*
+ * Levels are written through SETDATAOUT/CLEARDATAOUT, a single store which
+ * touches only the pin in question, so pins of a bank can be written from
+ * several threads at once. Directions are read-modify-written in OE, which is
+ * serialized per bank.
+ */
 class GPIOInterface
 {
 public:
-    GPIOInterface();
+    GPIOInterface(RegisterBackend& registers);
     ~GPIOInterface();
 
     // Read GPIO by ipin (0-191)
@@ -34,10 +42,11 @@ public:
     void ConfigureAll();
 
 private:
-    // Functions to return pointers to mapped GPIO registers
-    volatile uint32_t* ptrGPIOReadLevel(int ipin);
-    volatile uint32_t* ptrGPIODirection(int ipin);
-    volatile uint32_t* ptrGPIOSetLevel(int ipin);
+    // Functions to return the GPIO registers of the bank of a pin
+    Register& ptrGPIOReadLevel(int ipin);
+    Register& ptrGPIODirection(int ipin);
+    Register& ptrGPIOSetLevel(int ipin);
+    Register& ptrGPIOClrLevel(int ipin);
 
     void SetLevel(int ipin);
     void ClrLevel(int ipin);
@@ -57,42 +66,22 @@ private:
     const off_t OFF_GPIO_OE            = 0x034;  //enable the pins output capabilities. Its only function is to carry the pads configuration.
     const off_t OFF_GPIO_DATAIN        = 0x038;  //register the data that is read from the GPIO pins
     const off_t OFF_GPIO_DATAOUT       = 0x03C;  //setting the value of the GPIO output pins
+    const off_t OFF_GPIO_CLEARDATAOUT  = 0x090;  //clearing to 0 the pins set in the value written
+    const off_t OFF_GPIO_SETDATAOUT    = 0x094;  //setting to 1 the pins set in the value written
 
     // --------------------------------------------------------------------------
-    // Functions to Return Addresses for GPIO pins
+    // Mapped registers, per bank of 32 pins
     // --------------------------------------------------------------------------
 
-    // Adds register offset to correct base address to produce physical address
-    off_t offset2adrGPIO(int ipin, off_t offset);
-
-    // Returns Virtual (memory mapped) address for a given GPIO pin
-    volatile uint32_t* phys2VirtGPIO32(off_t phys, int ipin);
-
-    // Takes Physical Address and Returns pointer to memory mapped virtual address
-    volatile uint32_t* phys2Virt32(off_t phys, volatile void* map_base_virt, off_t map_base_phys);
-
-    // Returns physical address of GPIO Read Register for a given GPIO pin
-    off_t physGPIOReadLevel(int ipin);
-
-    // Returns physical address of Output Enable Register for a given GPIO pin
-    off_t physGPIODirection(int ipin);
-
-    // Returns physical address of Output Write Register for a given GPIO pin
-    off_t physGPIOSetLevel(int ipin);
-
-    // Create a virtual addressing space for a given physical address
-    void makeMap(volatile void* &virtual_addr, off_t physical_addr, size_t length=4096);
+    static const int m_nbank = 6;
 
-    // Memory mapped file descriptor
-    int             m_mmap_fd;
+    Register m_oe           [m_nbank];
+    Register m_datain       [m_nbank];
+    Register m_setdataout   [m_nbank];
+    Register m_cleardataout [m_nbank];
 
-    // Base addresses of memory mapped address space
-    volatile void*  m_gpio1_base;
-    volatile void*  m_gpio2_base;
-    volatile void*  m_gpio3_base;
-    volatile void*  m_gpio4_base;
-    volatile void*  m_gpio5_base;
-    volatile void*  m_gpio6_base;
+    // Serializes read-modify-writes of a bank's OE
+    std::mutex m_lock [m_nbank];
 
     uint32_t MaskPin (int ipin);
 };
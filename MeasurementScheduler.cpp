@@ -0,0 +1,180 @@
+#include <MeasurementScheduler.hpp>
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+
+MeasurementScheduler::MeasurementScheduler() :
+    m_enabled (false),
+    m_maxAge  (0),
+    m_evicted (0)
+{
+}
+
+bool MeasurementScheduler::Key::operator< (const Key& other) const
+{
+    if (adc != other.adc)
+        return adc < other.adc;
+    if (channel != other.channel)
+        return channel < other.channel;
+    if (nsamples != other.nsamples)
+        return nsamples < other.nsamples;
+    return readDelay < other.readDelay;
+}
+
+//------------------------------------------------------------------------------
+// Public Members
+//------------------------------------------------------------------------------
+
+MeasurementScheduler::Role MeasurementScheduler::begin(const Key& key, uint64_t now, CBC::ADC::adcData& data)
+{
+    if (!m_enabled.load(std::memory_order_relaxed))
+        return ALONE;
+
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    Entries::iterator entry = m_entries.find(key);
+    if (entry == m_entries.end())
+        entry = m_entries.insert(std::make_pair(key, Entry())).first;
+
+    /* join the acquisition under way; should it be abandoned, start over */
+    while (entry->second.busy) {
+        uint64_t generation = entry->second.generation;
+        entry->second.waiters++;
+        while (entry->second.busy && entry->second.generation == generation)
+            m_done.wait(lock);
+        entry->second.waiters--;
+
+        if (entry->second.generation != generation) {
+            data = entry->second.data;
+            prune(entry);
+            return SERVED;
+        }
+    }
+
+    /* or reuse a recent good result */
+    if (reusable(entry->second, now)) {
+        data = entry->second.data;
+        return SERVED;
+    }
+
+    entry->second.busy = true;
+    return LEAD;
+}
+
+void MeasurementScheduler::complete(const Key& key, uint64_t now, const CBC::ADC::adcData& data)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    Entries::iterator entry = m_entries.find(key);
+    if (entry == m_entries.end())
+        return;
+
+    entry->second.busy      = false;
+    entry->second.completed = now;
+    entry->second.data      = data;
+    entry->second.generation++;
+
+    if (entry->second.waiters)
+        m_done.notify_all();
+    else
+        prune(entry);
+
+    evict(now);
+}
+
+void MeasurementScheduler::abandon(const Key& key)
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    Entries::iterator entry = m_entries.find(key);
+    if (entry == m_entries.end())
+        return;
+
+    /* the generation stays, which tells the waiters there is no result */
+    entry->second.busy = false;
+
+    if (entry->second.waiters)
+        m_done.notify_all();
+    else if (entry->second.generation == 0)
+        m_entries.erase(entry);
+}
+
+void MeasurementScheduler::forget()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    Entries::iterator entry = m_entries.begin();
+    while (entry != m_entries.end()) {
+        Entries::iterator next = entry;
+        ++next;
+        if (!entry->second.busy && entry->second.waiters == 0)
+            m_entries.erase(entry);
+        entry = next;
+    }
+}
+
+void MeasurementScheduler::setEnabled(bool enabled)
+{
+    m_enabled.store(enabled, std::memory_order_relaxed);
+    if (!enabled)
+        forget();
+}
+
+bool MeasurementScheduler::isEnabled()
+{
+    return m_enabled.load(std::memory_order_relaxed);
+}
+
+void MeasurementScheduler::setMaxAge(int maxAge)
+{
+    if (maxAge < 0)
+        return;
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_maxAge = maxAge;
+}
+
+int MeasurementScheduler::getMaxAge()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return (m_maxAge);
+}
+
+//------------------------------------------------------------------------------
+// Private Members
+//------------------------------------------------------------------------------
+
+bool MeasurementScheduler::reusable(const Entry& entry, uint64_t now)
+{
+    return (m_maxAge > 0 && entry.generation > 0 && entry.data.status == CBC::ADC::STATUS_OK &&
+            now - entry.completed <= uint64_t(m_maxAge) * 1000);
+}
+
+void MeasurementScheduler::prune(Entries::iterator entry)
+{
+    /* a result kept for reuse stays, one nobody can reuse goes */
+    if (entry->second.busy || entry->second.waiters)
+        return;
+    if (m_maxAge > 0 && m_enabled.load(std::memory_order_relaxed) && entry->second.data.status == CBC::ADC::STATUS_OK)
+        return;
+    m_entries.erase(entry);
+}
+
+void MeasurementScheduler::evict(uint64_t now)
+{
+    /* at most once per maximum age, so that the sweep costs little per
+     * measurement however many keys there are */
+    uint64_t maxAge = uint64_t(m_maxAge) * 1000;
+    if (now - m_evicted < maxAge)
+        return;
+    m_evicted = now;
+
+    Entries::iterator entry = m_entries.begin();
+    while (entry != m_entries.end()) {
+        Entries::iterator next = entry;
+        ++next;
+        if (!entry->second.busy && entry->second.waiters == 0 && !reusable(entry->second, now))
+            m_entries.erase(entry);
+        entry = next;
+    }
+}
@@ -0,0 +1,122 @@
+/*
+ * MeasurementScheduler.hpp - Coalesces concurrent requests for the same ADC
+ * measurement, so that clients sharing a board share its acquisitions.
+ *
+ * A measurement is identified by (adc, channel, nsamples, readDelay). The
+ * first request for it leads: it makes the acquisition and hands the result
+ * to complete(). A request arriving while the acquisition is under way waits
+ * for it and takes the same result instead of queueing a second burst on the
+ * SPI bus. With a maximum age set, a request also takes the last good result
+ * if it completed no longer ago than that; results older than the maximum age
+ * are dropped, and forget() drops them all, e.g. when the ADC calibration
+ * changes.
+ *
+ * The scheduler makes no acquisitions itself; CBC::ADC::measure calls
+ * begin() and, when told to lead, acquires under a Lead, which wakes the
+ * waiting requests to acquire for themselves should the acquisition be
+ * abandoned without a result.
+ */
+
+#ifndef MEASUREMENTSCHEDULER_HPP
+#define MEASUREMENTSCHEDULER_HPP
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <cbc.hpp>
+
+class MeasurementScheduler
+{
+    public:
+        enum Role {
+            SERVED,     // data holds a shared result
+            LEAD,       // acquire, then complete() for the requests waiting
+            ALONE       // coalescing is off: acquire, and nothing more
+        };
+
+        // What a measurement is taken with; requests share only results of
+        // the same
+        struct Key {
+            int adc;
+            int channel;
+            int nsamples;
+            int readDelay;
+
+            bool operator< (const Key& other) const;
+        };
+
+        MeasurementScheduler();
+
+        // now is the board's monotonic time in nanoseconds, the time base of
+        // the maximum age
+        Role begin    (const Key& key, uint64_t now, CBC::ADC::adcData& data);
+        void complete (const Key& key, uint64_t now, const CBC::ADC::adcData& data);
+
+        // Gives up the acquisition of a LEAD without a result; the requests
+        // waiting for it start over
+        void abandon  (const Key& key);
+
+        // Drops the results kept for reuse
+        void forget ();
+
+        // Off by default. Switching off forgets the results kept for reuse.
+        void setEnabled (bool enabled);
+        bool isEnabled  ();
+
+        // Longest a result is reused for after its acquisition [microseconds,
+        // 0 = only shared with requests made while it was under way]
+        void setMaxAge (int maxAge);
+        int  getMaxAge ();
+
+        // Holds the acquisition of a request for its lifetime, abandoning it
+        // unless completed
+        class Lead
+        {
+            public:
+                Lead(MeasurementScheduler& scheduler, Role role, const Key& key) :
+                    m_scheduler(scheduler), m_key(key), m_pending(role == LEAD) {}
+                ~Lead() { if (m_pending) m_scheduler.abandon(m_key); }
+
+                void complete(uint64_t now, const CBC::ADC::adcData& data)
+                {
+                    if (m_pending)
+                        m_scheduler.complete(m_key, now, data);
+                    m_pending = false;
+                }
+
+            private:
+                MeasurementScheduler& m_scheduler;
+                Key                   m_key;
+                bool                  m_pending;
+        };
+
+    private:
+        struct Entry {
+            bool              busy;         // an acquisition is under way
+            uint64_t          generation;   // acquisitions completed
+            int               waiters;      // requests waiting for the next one
+            uint64_t          completed;    // when the last one completed
+            CBC::ADC::adcData data;         // and its result
+        };
+
+        typedef std::map<Key,Entry> Entries;
+
+        // With the lock held: drops an entry no longer needed, and entries
+        // whose results have outlived the maximum age
+        void prune (Entries::iterator entry);
+        void evict (uint64_t now);
+
+        bool reusable (const Entry& entry, uint64_t now);
+
+        std::atomic<bool>         m_enabled;
+        int                       m_maxAge;     // microseconds
+
+        std::mutex                m_lock;
+        std::condition_variable   m_done;
+        Entries                   m_entries;
+        uint64_t                  m_evicted;    // when evict() last ran
+};
+
+#endif // MEASUREMENTSCHEDULER_HPP
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+#include <mutex>
+#include <vector>
+#include <Metrics.hpp>
+
+//------------------------------------------------------------------------------
+// Per-thread blocks
+//------------------------------------------------------------------------------
+
+static const size_t CACHE_LINE = 64;
+
+// Written by its own thread only, read by snapshot(); the atomics are accessed
+// relaxed, which compiles to plain loads and stores
+struct Metrics::Block
+{
+    std::atomic<uint64_t> counter [NCOUNTER];
+
+    struct {
+        std::atomic<uint64_t> count;
+        std::atomic<uint64_t> sum;
+        std::atomic<uint64_t> bucket [NBUCKET];
+    } histogram [NHISTOGRAM];
+};
+
+std::atomic<bool> Metrics::s_enabled (true);
+
+static thread_local Metrics::Block* threadMetrics = NULL;
+
+// Blocks of all threads, kept after the threads exit so that their counts
+// remain in the totals; and the totals at the last reset
+static std::mutex& registryLock()
+{
+    static std::mutex lock;
+    return lock;
+}
+
+static std::vector<Metrics::Block*>& registry()
+{
+    static std::vector<Metrics::Block*> blocks;
+    return blocks;
+}
+
+static Metrics::Snapshot& baseline()
+{
+    static Metrics::Snapshot totals;
+    return totals;
+}
+
+static inline void add(std::atomic<uint64_t>& value, uint64_t n)
+{
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+Metrics::Block* Metrics::threadBlock()
+{
+    Block* block = threadMetrics;
+    if (block)
+        return block;
+
+    /* whole cache lines, so that no other data shares them */
+    size_t size = (sizeof(Block) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+    void*  memory;
+    if (posix_memalign(&memory, CACHE_LINE, size)) {
+        perror("Metrics: posix_memalign");
+        exit(1);
+    }
+    block = new (memory) Block();
+
+    std::lock_guard<std::mutex> lock(registryLock());
+    registry().push_back(block);
+    threadMetrics = block;
+    return block;
+}
+
+//------------------------------------------------------------------------------
+// Recording
+//------------------------------------------------------------------------------
+
+uint64_t Metrics::now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return uint64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+void Metrics::count(Counter counter, uint64_t n)
+{
+    if (!isEnabled())
+        return;
+    add(threadBlock()->counter[counter], n);
+}
+
+void Metrics::record(Histogram histogram, uint64_t nanos)
+{
+    if (!isEnabled())
+        return;
+
+    /* floor(log2(nanos)) */
+    int ibucket = 63 - __builtin_clzll(nanos | 1);
+    if (ibucket >= NBUCKET)
+        ibucket = NBUCKET - 1;
+
+    Block* block = threadBlock();
+    add(block->histogram[histogram].count, 1);
+    add(block->histogram[histogram].sum,   nanos);
+    add(block->histogram[histogram].bucket[ibucket], 1);
+}
+
+void Metrics::setEnabled(bool enabled)
+{
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+// Readout
+//------------------------------------------------------------------------------
+
+// Totals over all blocks, with the registry locked
+static void sumBlocks(Metrics::Snapshot& totals)
+{
+    memset(&totals, 0, sizeof(totals));
+
+    std::vector<Metrics::Block*>& blocks = registry();
+    for (unsigned iblock=0; iblock<blocks.size(); iblock++) {
+        Metrics::Block* block = blocks[iblock];
+
+        for (int i=0; i<Metrics::NCOUNTER; i++)
+            totals.counter[i] += block->counter[i].load(std::memory_order_relaxed);
+
+        for (int i=0; i<Metrics::NHISTOGRAM; i++) {
+            totals.histogram[i].count += block->histogram[i].count.load(std::memory_order_relaxed);
+            totals.histogram[i].sum   += block->histogram[i].sum.load(std::memory_order_relaxed);
+            for (int j=0; j<Metrics::NBUCKET; j++)
+                totals.histogram[i].bucket[j] += block->histogram[i].bucket[j].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+void Metrics::snapshot(Snapshot& snapshot)
+{
+    std::lock_guard<std::mutex> lock(registryLock());
+    sumBlocks(snapshot);
+
+    const Snapshot& base = baseline();
+    for (int i=0; i<NCOUNTER; i++)
+        snapshot.counter[i] -= base.counter[i];
+
+    for (int i=0; i<NHISTOGRAM; i++) {
+        snapshot.histogram[i].count -= base.histogram[i].count;
+        snapshot.histogram[i].sum   -= base.histogram[i].sum;
+        for (int j=0; j<NBUCKET; j++)
+            snapshot.histogram[i].bucket[j] -= base.histogram[i].bucket[j];
+    }
+}
+
+void Metrics::reset()
+{
+    /* the blocks belong to their threads; remember where they stand instead */
+    std::lock_guard<std::mutex> lock(registryLock());
+    sumBlocks(baseline());
+}
+
+uint64_t Metrics::percentile(const HistogramData& histogram, double fraction)
+{
+    if (histogram.count == 0)
+        return 0;
+
+    uint64_t target = uint64_t(fraction * histogram.count + 0.5);
+    if (target < 1)
+        target = 1;
+    if (target > histogram.count)
+        target = histogram.count;
+
+    uint64_t sum = 0;
+    for (int i=0; i<NBUCKET; i++) {
+        sum += histogram.bucket[i];
+        if (sum >= target)
+            return uint64_t(1) << (i+1);
+    }
+    return uint64_t(1) << NBUCKET;
+}
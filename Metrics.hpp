@@ -0,0 +1,100 @@
+/*
+ * Metrics.hpp - Process-wide event counters and latency histograms of the
+ * library, cheap enough to leave enabled on the boards.
+ *
+ * Each thread counts into a block of its own, aligned to a cache line, which
+ * only it writes: an event is a few plain loads and stores, with no atomic
+ * read-modify-write and no sharing of cache lines between threads, plus two
+ * clock reads for a timed event. snapshot() sums the blocks of all threads
+ * that ever counted, including those which have since exited.
+ */
+
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <stdint.h>
+#include <atomic>
+
+class Metrics
+{
+    public:
+        enum Counter {
+            STEPS,              // step pulses issued by CBC::Driver::step
+            ADC_MEASUREMENTS,   // CBC::ADC measurements
+            ADC_SAMPLES,        // samples taken by them
+            ADC_COALESCED,      // CBC::ADC measurements answered by another's acquisition
+            SPI_WORDS,          // words through SpiTransport::transfer
+            SLEEPS,             // MirrorControlBoard::sleepMicros calls
+            POWER_SEQUENCES,    // CBC::powerUp and CBC::powerDown calls
+            YIELDS,             // long operations paused for more urgent ones (c.f. OperationScheduler)
+            SAFETY_OVERRIDES,   // safety operations which stopped waiting at the wait limit
+            NCOUNTER
+        };
+
+        enum Histogram {
+            LATENCY_STEP,       // CBC::Driver::step, whole move
+            LATENCY_MEASURE,    // CBC::ADC measurement, including waiting for the bus
+            LATENCY_SPI_WORD,   // SpiTransport::WriteRead, one call in 64
+            LATENCY_SLEEP,      // MirrorControlBoard::sleepMicros, time actually slept
+            LATENCY_POWER,      // CBC::powerUp and CBC::powerDown
+            LATENCY_SAFETY_WAIT,// wait of safety operations for their turn
+            LATENCY_SAFETY,     // CBC::Driver::disable, disableAll and sleep, from call to done
+            NHISTOGRAM
+        };
+
+        // Bucket i counts latencies of [2^i, 2^(i+1)) ns, bucket 0 includes
+        // 0 ns and the last bucket everything from 2^(NBUCKET-1) ns (~9 min) up
+        static const int NBUCKET = 40;
+
+        struct HistogramData {
+            uint64_t count;
+            uint64_t sum;               // ns
+            uint64_t bucket [NBUCKET];
+        };
+
+        struct Snapshot {
+            uint64_t      counter   [NCOUNTER];
+            HistogramData histogram [NHISTOGRAM];
+        };
+
+        // Monotonic nanoseconds, the time base of the histograms
+        static uint64_t now();
+
+        static void count  (Counter counter, uint64_t n = 1);
+        static void record (Histogram histogram, uint64_t nanos);
+
+        // Sum over all threads, less the totals at the last reset()
+        static void snapshot (Snapshot& snapshot);
+        static void reset    ();
+
+        // Enabled by default; when disabled count() and record() return at once
+        static void setEnabled (bool enabled);
+        static bool isEnabled  () { return s_enabled.load(std::memory_order_relaxed); }
+
+        // Upper edge in ns of the bucket holding the given fraction (0-1) of
+        // the events, i.e. a bound within a factor of two; 0 if there are none
+        static uint64_t percentile (const HistogramData& histogram, double fraction);
+
+        // Records the time from construction to destruction, unless disabled
+        // at construction
+        class Timer
+        {
+            public:
+                Timer(Histogram histogram) : m_histogram(histogram), m_start(isEnabled() ? now() : 0) {}
+                ~Timer() { if (m_start) record(m_histogram, now() - m_start); }
+
+            private:
+                Histogram m_histogram;
+                uint64_t  m_start;
+        };
+
+        // A thread's counters and histograms (c.f. Metrics.cpp)
+        struct Block;
+
+    private:
+        static Block* threadBlock();
+
+        static std::atomic<bool> s_enabled;
+};
+
+#endif // METRICS_HPP
@@ -13,119 +13,190 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <iostream>
-#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
 
 // local includes
-#include <SpiInterface.hpp>
+#include <SpiTransport.hpp>
+#include <Clock.hpp>
+#include <Metrics.hpp>
+#include <RegisterBackend.hpp>
+#include <SimulatedPeripherals.hpp>
 #include <TLC3548_ADC.hpp>
 #include <GPIOInterface.hpp>
-#include <mcspiInterface.hpp>
 #include <Layout.hpp>
 
-GPIOInterface gpio;
-mcspiInterface spi;
+/* Stateless, so shared by all boards */
+static RealClock realClock;
 
-namespace MirrorControlBoard
-{
-    void enableIO ()
+/* Error of the calling thread's last ADC acquisition (c.f. getSPIError) */
+static thread_local int lastError = SpiTransport::ERR_NONE;
+
+    MirrorControlBoard::MirrorControlBoard(int backend) :
+        m_clock      (&realClock),
+        m_hwBackend  (backend),
+        m_registers  (NULL),
+        m_gpio       (NULL),
+        m_spi        (NULL),
+        m_spiBackend (SpiTransport::BACKEND_MCSPI),
+        m_spiDevice  ("/dev/spidev1.0"),
+        m_warmStart  (false)
+    {
+    }
+
+    MirrorControlBoard::~MirrorControlBoard()
+    {
+        delete m_spi;
+        delete m_gpio.load();
+        delete m_registers;
+    }
+
+    RegisterBackend& MirrorControlBoard::registerBackend()
+    {
+        /* with m_setupLock held */
+        if (!m_registers) {
+            if (m_hwBackend == HW_SIMULATED) {
+                SimulatedBoard* board = new SimulatedBoard();
+                board->setClock(m_clock);
+                m_registers = board;
+            }
+            else
+                m_registers = new DevMemBackend();
+        }
+        return *m_registers;
+    }
+
+    GPIOInterface& MirrorControlBoard::gpio()
+    {
+        /* Every GPIO access comes through here, so only creation is locked */
+        GPIOInterface* gpio = m_gpio.load(std::memory_order_acquire);
+        if (!gpio) {
+            std::lock_guard<std::mutex> setup(m_setupLock);
+            gpio = m_gpio.load(std::memory_order_relaxed);
+            if (!gpio) {
+                gpio = new GPIOInterface(registerBackend());
+                m_gpio.store(gpio, std::memory_order_release);
+            }
+        }
+        return *gpio;
+    }
+
+    SpiTransport& MirrorControlBoard::spi()
+    {
+        /* with m_spiLock held */
+        if (!m_spi) {
+            std::lock_guard<std::mutex> setup(m_setupLock);
+            m_spi = SpiTransport::create(m_spiBackend, m_spiDevice.c_str(), registerBackend(), m_warmStart);
+        }
+        return *m_spi;
+    }
+
+    void MirrorControlBoard::enableIO ()
     {
-        gpio.WriteLevel(Layout::igpioEN_IO, 1);
+        gpio().WriteLevel(Layout::igpioEN_IO, 1);
     }
 
-    void disableIO ()
+    void MirrorControlBoard::disableIO ()
     {
-        gpio.WriteLevel(Layout::igpioEN_IO, 0);
+        gpio().WriteLevel(Layout::igpioEN_IO, 0);
     }
 
-    void adcSleep (int iadc)
+    bool MirrorControlBoard::isIOEnabled ()
     {
+        return gpio().ReadLevel(Layout::igpioEN_IO)?true:false;
+    }
+
+    void MirrorControlBoard::adcSleep (int iadc)
+    {
+        std::lock_guard<std::recursive_mutex> bus(m_spiLock);
         // Set on-board ADC into sleep mode
         selectADC(iadc);
         //spi.Configure();
-        spi.WriteRead(TLC3548::codeSWPowerDown());
+        spi().WriteRead(TLC3548::codeSWPowerDown());
 
         selectADC(iadc);
         //spi.Configure();
-        spi.WriteRead(TLC3548::codeSWPowerDown());
+        spi().WriteRead(TLC3548::codeSWPowerDown());
     }
 
-    void powerDownUSB(unsigned iusb)
+    void MirrorControlBoard::powerDownUSB(unsigned iusb)
     {
-        gpio.WriteLevel(Layout::igpioUSBOff(iusb),1);
+        gpio().WriteLevel(Layout::igpioUSBOff(iusb),1);
     }
 
-    void powerUpUSB(unsigned iusb)
+    void MirrorControlBoard::powerUpUSB(unsigned iusb)
     {
-        gpio.WriteLevel(Layout::igpioUSBOff(iusb),0);
+        gpio().WriteLevel(Layout::igpioUSBOff(iusb),0);
     }
 
-    bool isUSBPoweredUp(unsigned iusb)
+    bool MirrorControlBoard::isUSBPoweredUp(unsigned iusb)
     {
-        return gpio.ReadLevel(Layout::igpioUSBOff(iusb))?false:true;
+        return gpio().ReadLevel(Layout::igpioUSBOff(iusb))?false:true;
     }
 
-    void powerDownDriveControllers()
+    void MirrorControlBoard::powerDownDriveControllers()
     {
-        gpio.WriteLevel(Layout::igpioSleep,0);
+        gpio().WriteLevel(Layout::igpioSleep,0);
     }
 
-    void powerUpDriveControllers()
+    void MirrorControlBoard::powerUpDriveControllers()
     {
-        gpio.WriteLevel(Layout::igpioSleep,1);
+        gpio().WriteLevel(Layout::igpioSleep,1);
     }
 
-    bool isDriveControllersPoweredUp()
+    bool MirrorControlBoard::isDriveControllersPoweredUp()
     {
-        return gpio.ReadLevel(Layout::igpioSleep)?true:false;
+        return gpio().ReadLevel(Layout::igpioSleep)?true:false;
     }
 
-    void powerDownEncoders()
+    void MirrorControlBoard::powerDownEncoders()
     {
-        gpio.WriteLevel(Layout::igpioEncoderEnable,0);
+        gpio().WriteLevel(Layout::igpioEncoderEnable,0);
     }
 
-    void powerUpEncoders()
+    void MirrorControlBoard::powerUpEncoders()
     {
-        gpio.WriteLevel(Layout::igpioEncoderEnable,1);
+        gpio().WriteLevel(Layout::igpioEncoderEnable,1);
     }
 
-    bool isEncodersPoweredUp()
+    bool MirrorControlBoard::isEncodersPoweredUp()
     {
-        return gpio.ReadLevel(Layout::igpioEncoderEnable)?true:false;
+        return gpio().ReadLevel(Layout::igpioEncoderEnable)?true:false;
     }
 
-    void powerUpSensors()
+    void MirrorControlBoard::powerUpSensors()
     {
-        gpio.WriteLevel(Layout::igpioPowerADC,1);
+        gpio().WriteLevel(Layout::igpioPowerADC,1);
     }
 
-    void powerDownSensors()
+    void MirrorControlBoard::powerDownSensors()
     {
-        gpio.WriteLevel(Layout::igpioPowerADC,0);
+        gpio().WriteLevel(Layout::igpioPowerADC,0);
     }
 
-    bool isSensorsPoweredUp()
+    bool MirrorControlBoard::isSensorsPoweredUp()
     {
-        return gpio.ReadLevel(Layout::igpioPowerADC)?true:false;
+        return gpio().ReadLevel(Layout::igpioPowerADC)?true:false;
     }
 
-    void enableDriveSR(bool enable)
+    void MirrorControlBoard::enableDriveSR(bool enable)
     {
-        gpio.WriteLevel(Layout::igpioSR, enable?0:1);
+        gpio().WriteLevel(Layout::igpioSR, enable?0:1);
     }
 
 
-    void disableDriveSR()
+    void MirrorControlBoard::disableDriveSR()
     {
         enableDriveSR(false);
     }
 
-    bool isDriveSREnabled()
+    bool MirrorControlBoard::isDriveSREnabled()
     {
-        return gpio.ReadLevel(Layout::igpioSR)?false:true;
+        return gpio().ReadLevel(Layout::igpioSR)?false:true;
     }
 
-    void setUStep(UStep ustep)
+    void MirrorControlBoard::setUStep(UStep ustep)
     {
         unsigned mslog2 = 0;
         switch(ustep) {
@@ -142,19 +213,19 @@ namespace MirrorControlBoard
                 mslog2 = 0x3;
                 break;
         }
-        gpio.WriteLevel(Layout::igpioMS1, mslog2 & 0x1);
-        gpio.WriteLevel(Layout::igpioMS2, mslog2 & 0x2);
+        gpio().WriteLevel(Layout::igpioMS1, mslog2 & 0x1);
+        gpio().WriteLevel(Layout::igpioMS2, mslog2 & 0x2);
     }
 
-    UStep getUStep()
+    MirrorControlBoard::UStep MirrorControlBoard::getUStep()
     {
-        if(gpio.ReadLevel(Layout::igpioMS2))
-            return gpio.ReadLevel(Layout::igpioMS1)?USTEP_8:USTEP_4;
+        if(gpio().ReadLevel(Layout::igpioMS2))
+            return gpio().ReadLevel(Layout::igpioMS1)?USTEP_8:USTEP_4;
         else
-            return gpio.ReadLevel(Layout::igpioMS1)?USTEP_2:USTEP_1;
+            return gpio().ReadLevel(Layout::igpioMS1)?USTEP_2:USTEP_1;
     }
 
-    void  stepOneDrive(unsigned idrive, Dir dir, unsigned frequency)
+    void MirrorControlBoard::stepOneDrive(unsigned idrive, Dir dir, unsigned frequency)
     {
         /* Give this thread higher priority to improve timing stability */
         pthread_t this_thread = pthread_self();
@@ -163,81 +234,85 @@ namespace MirrorControlBoard
         pthread_setschedparam(this_thread, SCHED_FIFO, &params);
 
         /* Write Direction to the DIR pin */
-        gpio.WriteLevel(Layout::igpioDir(idrive),(dir==DIR_RETRACT)?1:0);
+        gpio().WriteLevel(Layout::igpioDir(idrive),(dir==DIR_RETRACT)?1:0);
 
         /* Writes one step to STEP pin */
         unsigned igpio = Layout::igpioStep(idrive);
-        gpio.WriteLevel(igpio,(dir==DIR_NONE)?0:1);
+        gpio().WriteLevel(igpio,(dir==DIR_NONE)?0:1);
 
         /* a delay */
         waitHalfPeriod(frequency);
 
         /* Toggle pin back to low */
-        gpio.WriteLevel(igpio,0);
+        gpio().WriteLevel(igpio,0);
 
         /* a delay */
         waitHalfPeriod(frequency);
         sched_yield();
     }
 
-    void setPhaseZeroOnAllDrives()
+    void MirrorControlBoard::setPhaseZeroOnAllDrives()
     {
-        gpio.WriteLevel(Layout::igpioReset,0);
+        gpio().WriteLevel(Layout::igpioReset,0);
         waitHalfPeriod(400);
-        gpio.WriteLevel(Layout::igpioReset,1);
+        gpio().WriteLevel(Layout::igpioReset,1);
     }
 
-    void enableDrive(unsigned idrive, bool enable)
+    void MirrorControlBoard::enableDrive(unsigned idrive, bool enable)
     {
-        gpio.WriteLevel(Layout::igpioEnable(idrive), enable?0:1);
+        gpio().WriteLevel(Layout::igpioEnable(idrive), enable?0:1);
     }
 
-    void disableDrive(unsigned idrive)
+    void MirrorControlBoard::disableDrive(unsigned idrive)
     {
         enableDrive(idrive, false);
     }
 
-    bool isDriveEnabled(unsigned idrive)
+    bool MirrorControlBoard::isDriveEnabled(unsigned idrive)
     {
-        return gpio.ReadLevel(Layout::igpioEnable(idrive))?false:true;
+        return gpio().ReadLevel(Layout::igpioEnable(idrive))?false:true;
     }
 
-    void enableDriveHiCurrent(bool enable)
+    void MirrorControlBoard::enableDriveHiCurrent(bool enable)
     {
-        gpio.WriteLevel(Layout::igpioPwrIncBar, enable?0:1);
+        gpio().WriteLevel(Layout::igpioPwrIncBar, enable?0:1);
     }
 
-    void disableDriveHiCurrent()
+    void MirrorControlBoard::disableDriveHiCurrent()
     {
         enableDriveHiCurrent(false);
     }
 
 
-    bool isDriveHiCurrentEnabled()
+    bool MirrorControlBoard::isDriveHiCurrentEnabled()
     {
-        return gpio.ReadLevel(Layout::igpioPwrIncBar)?false:true;
+        return gpio().ReadLevel(Layout::igpioPwrIncBar)?false:true;
     }
 
     //------------------------------------------------------------------------------
     // ADCs
     //------------------------------------------------------------------------------
 
-    void initializeADC(unsigned iadc)
+    void MirrorControlBoard::initializeADC(unsigned iadc)
     {
+        std::lock_guard<std::recursive_mutex> bus(m_spiLock);
         selectADC(iadc);                                        // Assert Chip Select for ADC in question
-        spi.WriteRead(TLC3548::codeInitialize());
-        spi.WriteRead(TLC3548::codeConfig());
+        spi().WriteRead(TLC3548::codeInitialize());
+        spi().WriteRead(TLC3548::codeConfig());
     }
 
-    void selectADC(unsigned iadc)
+    void MirrorControlBoard::selectADC(unsigned iadc)
     {
-        gpio.WriteLevel(Layout::igpioADCSel1, iadc==0?1:0);
-        gpio.WriteLevel(Layout::igpioADCSel2, iadc==1?1:0);
+        std::lock_guard<std::recursive_mutex> bus(m_spiLock);
+        gpio().WriteLevel(Layout::igpioADCSel1, iadc==0?1:0);
+        gpio().WriteLevel(Layout::igpioADCSel2, iadc==1?1:0);
     }
 
-    uint32_t measureADC(unsigned iadc, unsigned ichan)
+    uint32_t MirrorControlBoard::measureADC(unsigned iadc, unsigned ichan)
     {
+        std::lock_guard<std::recursive_mutex> bus(m_spiLock);
 
+        spi().clearError();
         initializeADC(iadc);
 
         // Assert Chip Select
@@ -245,58 +320,42 @@ namespace MirrorControlBoard
 
         // ADC Channel Select
         uint32_t code = TLC3548::codeSelect(ichan);
-        spi.WriteRead(code);
+        spi().WriteRead(code);
 
-        // Read ADC
-        uint32_t datum = spi.WriteRead(TLC3548::codeReadFIFO());
+        // Read ADC, once the conversion is done
+        waitUntil(monotonicNanos() + TLC3548::framePeriodNanos());
+        uint32_t datum = spi().WriteRead(TLC3548::codeReadFIFO());
 
+        lastError = spi().getError();
         return TLC3548::decodeUSB(datum);
     }
 
-    void measureADCStat(unsigned iadc, unsigned ichan, unsigned nmeas, uint32_t& sum, uint64_t& sumsq, uint32_t& min, uint32_t& max, unsigned ndelay)
+    /* x*num/den, which does not overflow as long as the result fits */
+    static uint64_t scaled(uint64_t x, uint64_t num, uint64_t den)
     {
-        //spi.Configure();
-        initializeADC(iadc);
-        selectADC(iadc);
-        uint32_t code   = TLC3548::codeSelect(ichan);
-        unsigned nburn  = 1;
-        unsigned nloop  = nburn + nmeas;
-        sum             = 0;
-        sumsq           = 0;
-        max             = 0;
-        min             = ~max;
+        return (x/den)*num + (x%den)*num/den;
+    }
 
-        uint32_t measurement [nmeas];
+    /* Accumulates sum, sum of squares, min and max of nmeas decoded samples */
+    void MirrorControlBoard::accumulateADCStat(const uint32_t* measurement, unsigned nmeas, ADCStat& stat)
+    {
+        uint32_t datum;
 
-        /* Increase Thread Priority */
-        pthread_t this_thread = pthread_self();
-        struct sched_param params;
-        params.sched_priority = sched_get_priority_max(SCHED_FIFO);
-        pthread_setschedparam(this_thread, SCHED_FIFO, &params);
+        stat.sum   = 0;
+        stat.sumsq = 0;
+        stat.max   = 0;
+        stat.min   = ~stat.max;
 
-        uint32_t datum;
+        for (unsigned iloop=0; iloop < nmeas; iloop++) {
+            datum = measurement[iloop];
+            if(datum>stat.max) stat.max=datum;
+            if(datum<stat.min) stat.min=datum;
 
-        /* Loop over number of measurements */
-        for(unsigned iloop=0; iloop < nloop; iloop++) {
-            // Read data
-            datum = spi.WriteRead(code);
-            /* Decode data and accumulate statistics*/
-            if (iloop >= nburn) {
-                datum = TLC3548::decodeUSB(datum);
-                measurement[iloop-nburn] = datum;
-                if(datum>max) max=datum;
-                if(datum<min) min=datum;
-
-                sum  +=datum;
-                sumsq+=static_cast<uint64_t>(datum) * static_cast<uint64_t>(datum);
-            }
-            for (volatile unsigned i=0; i<ndelay; i++);
+            stat.sum  +=datum;
+            stat.sumsq+=static_cast<uint64_t>(datum) * static_cast<uint64_t>(datum);
         }
 
-        /* Read last FIFO, Clear Buffer */
-        datum = spi.WriteRead(TLC3548::codeReadFIFO());
-
-        float voltage_range = TLC3548::voltData((max-min));
+        float voltage_range = TLC3548::voltData((stat.max-stat.min));
 
         bool at_home;
         if (voltage_range>1.) at_home = true;
@@ -323,10 +382,10 @@ namespace MirrorControlBoard
 
             int nmeas_used=0;
 
-            max   = 0;
-            min   = ~max;
-            sum   = 0;
-            sumsq = 0;
+            stat.max   = 0;
+            stat.min   = ~stat.max;
+            stat.sum   = 0;
+            stat.sumsq = 0;
 
             /* Loop over the data again and accumulate statistics only in the case that the data meets criteria,
              * viz that if there are more low than high measurements, we only accept the low
@@ -334,91 +393,284 @@ namespace MirrorControlBoard
             for (unsigned iloop=0; iloop<nmeas; iloop++) {
                 datum = measurement[iloop];
                 if ((datum>encoder_midpoint && meas_high) || (datum<encoder_midpoint && !meas_high)) {
-                    sum  +=datum;
-                    sumsq+=static_cast<uint64_t>(datum) * static_cast<uint64_t>(datum);
+                    stat.sum  +=datum;
+                    stat.sumsq+=static_cast<uint64_t>(datum) * static_cast<uint64_t>(datum);
 
                     nmeas_used++;
 
-                    if(datum>max) max=datum;
-                    if(datum<min) min=datum;
+                    if(datum>stat.max) stat.max=datum;
+                    if(datum<stat.min) stat.min=datum;
                 }
             }
 
             /* Compensate for the Fact that We Didn't Really Take nmeas Samples */
-            sum   = sum   * nmeas/nmeas_used;
-            sumsq = sumsq * nmeas/nmeas_used;
+            if (nmeas_used) {
+                stat.sum   = scaled(stat.sum,   nmeas, nmeas_used);
+                stat.sumsq = scaled(stat.sumsq, nmeas, nmeas_used);
+            }
+        }
+    }
+
+    uint64_t MirrorControlBoard::measureADCStat(unsigned iadc, unsigned ichan, unsigned nmeas, uint64_t& sum, uint64_t& sumsq, uint32_t& min, uint32_t& max, unsigned period_ns)
+    {
+        ADCStat stat;
+        uint64_t elapsed = measureADCStatMulti(iadc, ichan, 1, nmeas, &stat, period_ns);
+
+        sum   = stat.sum;
+        sumsq = stat.sumsq;
+        min   = stat.min;
+        max   = stat.max;
+
+        return elapsed;
+    }
+
+    /* Acquires nmeas samples from each of nchan consecutive channels starting
+     * at ichan into measurement (nchan*nmeas entries, stored per channel).
+     * Returns the time spent acquiring, in nanoseconds. */
+    uint64_t MirrorControlBoard::acquireADC(unsigned iadc, unsigned ichan, unsigned nchan, unsigned nmeas, uint32_t* measurement, unsigned period_ns)
+    {
+        std::lock_guard<std::recursive_mutex> bus(m_spiLock);
+        /* Errors are reported per acquisition */
+        spi().clearError();
+
+        //spi.Configure();
+        initializeADC(iadc);
+        selectADC(iadc);
+
+        /* Channels are selected round robin; the TLC3548 returns each
+         * conversion one frame later, so the word read back with the select
+         * for sample k carries sample k-1 */
+        std::vector<uint32_t> code (nchan);
+        for (unsigned ich=0; ich<nchan; ich++)
+            code[ich] = TLC3548::codeSelect(ichan+ich);
+
+        unsigned nburn  = 1;
+        unsigned ntotal = nchan * nmeas;
+        unsigned nloop  = nburn + ntotal;
+
+        /* Increase Thread Priority */
+        pthread_t this_thread = pthread_self();
+        struct sched_param params;
+        params.sched_priority = sched_get_priority_max(SCHED_FIFO);
+        pthread_setschedparam(this_thread, SCHED_FIFO, &params);
+
+        /* The whole acquisition is planned up front, so that it can be handed
+         * to the transport as one batch: the burn word, one select per sample
+         * and a final FIFO read to collect the last conversion */
+        std::vector<uint16_t> tx (nloop+1);
+        std::vector<uint16_t> rx (nloop+1);
+        for (unsigned iloop=0; iloop < nloop; iloop++)
+            tx[iloop] = code[iloop % nchan];
+        tx[nloop] = TLC3548::codeReadFIFO();
+
+        /* The TLC3548 needs a conversion time between frames. Frames clocked
+         * back to back in one batch are only that far apart at slow SPI
+         * clocks; otherwise they are paced no faster than it. */
+        uint32_t conversion = TLC3548::framePeriodNanos();
+        uint64_t frame      = 16 * 1000000000ULL / std::max(spi().getClockRate(), 1u);
+        if (period_ns < conversion && frame < conversion)
+            period_ns = conversion;
+
+        uint64_t start;
+
+        if (period_ns == 0) {
+            start = monotonicNanos();
+            spi().transfer(tx.data(), rx.data(), nloop+1);
         }
+        else {
+            /* Samples are paced against the monotonic clock rather than a
+             * for-loop count, so the rate does not depend on CPU or compiler.
+             * The burn word is paced too: its conversion is read out by the
+             * first sample's frame. */
+            uint64_t deadline = monotonicNanos();
+            spi().transfer(tx.data(), rx.data(), nburn);
+
+            /* A frame started by the time its transfer returns, so a conversion
+             * is surely done by then plus the conversion time; this keeps late
+             * frames from pulling their successors in too close */
+            uint64_t ready = monotonicNanos() + conversion;
+
+            start = deadline + period_ns;
+            for (unsigned iloop=nburn; iloop <= nloop && !spi().getError(); iloop++) {
+                deadline += period_ns;
+                waitUntil(std::max(deadline, ready));
+                spi().transfer(&tx[iloop], &rx[iloop], 1);
+                ready = monotonicNanos() + conversion;
+            }
+        }
+
+        uint64_t elapsed = monotonicNanos() - start;
+
+        /* Decode data; a failed acquisition is zeroed rather than half decoded */
+        lastError   = spi().getError();
+        bool failed = lastError;
+        for (unsigned isample=0; isample < ntotal; isample++)
+            measurement[(isample % nchan)*nmeas + isample/nchan] = failed ? 0 : TLC3548::decodeUSB(rx[nburn+isample]);
 
         sched_yield();
+        return elapsed;
+    }
+
+    uint64_t MirrorControlBoard::measureADCStatMulti(unsigned iadc, unsigned ichan, unsigned nchan, unsigned nmeas, ADCStat* stats, unsigned period_ns)
+    {
+        /* Decoded samples, stored per channel; on the heap, since nmeas is
+         * the caller's to choose */
+        std::vector<uint32_t> measurement (nchan * nmeas);
+
+        uint64_t elapsed = acquireADC(iadc, ichan, nchan, nmeas, measurement.data(), period_ns);
+
+        /* Accumulate statistics */
+        for (unsigned ich=0; ich<nchan; ich++)
+            accumulateADCStat(&measurement[ich*nmeas], nmeas, stats[ich]);
+
+        return elapsed;
+    }
+
+    uint64_t MirrorControlBoard::readADCSamples(unsigned iadc, unsigned ichan, unsigned nmeas, uint32_t* samples, unsigned period_ns)
+    {
+        return acquireADC(iadc, ichan, 1, nmeas, samples, period_ns);
+    }
+
+    uint64_t MirrorControlBoard::readADCSamplesMulti(unsigned iadc, unsigned ichan, unsigned nchan, unsigned nmeas, uint32_t* samples, unsigned period_ns)
+    {
+        return acquireADC(iadc, ichan, nchan, nmeas, samples, period_ns);
+    }
+
+    void MirrorControlBoard::setHardwareBackend(int backend)
+    {
+        std::lock_guard<std::recursive_mutex> bus(m_spiLock);
+        std::lock_guard<std::mutex> setup(m_setupLock);
+
+        if (backend == m_hwBackend)
+            return;
+
+        /* Everything mapped through the old registers goes with them */
+        delete m_spi;
+        m_spi = NULL;
+        delete m_gpio.exchange(NULL);
+        delete m_registers;
+        m_registers = NULL;
+
+        m_hwBackend = backend;
+    }
+
+    SimulatedBoard* MirrorControlBoard::simulatedBoard()
+    {
+        std::lock_guard<std::mutex> setup(m_setupLock);
+
+        if (m_hwBackend != HW_SIMULATED)
+            return NULL;
+        return static_cast<SimulatedBoard*>(&registerBackend());
+    }
+
+    void MirrorControlBoard::setSPIBackend(int backend, const char* device)
+    {
+        std::lock_guard<std::recursive_mutex> bus(m_spiLock);
+
+        if (m_spi && backend == m_spiBackend && m_spiDevice == device)
+            return;
+
+        delete m_spi;
+        m_spi = NULL;
+
+        m_spiBackend = static_cast<SpiTransport::Backend>(backend);
+        m_spiDevice  = device;
+    }
+
+    void MirrorControlBoard::setWarmStart(bool warm)
+    {
+        std::lock_guard<std::recursive_mutex> bus(m_spiLock);
+        m_warmStart = warm;
+    }
+
+    unsigned MirrorControlBoard::setSPIClock(unsigned hz, int granularity, int cstime)
+    {
+        std::lock_guard<std::recursive_mutex> bus(m_spiLock);
+        spi().setChipSelectTime(cstime);
+        return spi().setClockRate(hz, granularity);
+    }
+
+    unsigned MirrorControlBoard::getSPIClock()
+    {
+        std::lock_guard<std::recursive_mutex> bus(m_spiLock);
+        return spi().getClockRate();
+    }
+
+    void MirrorControlBoard::setSPITimeout(unsigned timeout_us, unsigned retries)
+    {
+        std::lock_guard<std::recursive_mutex> bus(m_spiLock);
+        spi().setTimeout(timeout_us, retries);
+    }
+
+    int MirrorControlBoard::getSPIError()
+    {
+        return lastError;
+    }
+
+    SpiTransport::Stats MirrorControlBoard::getSPIStats()
+    {
+        std::lock_guard<std::recursive_mutex> bus(m_spiLock);
+        return spi().getStats();
+    }
+
+    void MirrorControlBoard::resetSPIStats()
+    {
+        std::lock_guard<std::recursive_mutex> bus(m_spiLock);
+        spi().resetStats();
     }
 
     //------------------------------------------------------------------------------
     // General Purpose Utilities
     //------------------------------------------------------------------------------
 
-    void waitHalfPeriod(unsigned frequency)
+    void MirrorControlBoard::setClock(Clock* clock)
+    {
+        std::lock_guard<std::mutex> setup(m_setupLock);
+        m_clock = clock ? clock : &realClock;
+
+        /* the simulated bus keeps the board's time */
+        if (m_registers && m_hwBackend == HW_SIMULATED)
+            static_cast<SimulatedBoard*>(m_registers)->setClock(m_clock);
+    }
+
+    Clock& MirrorControlBoard::getClock()
     {
+        return *m_clock;
+    }
 
+    void MirrorControlBoard::waitHalfPeriod(unsigned frequency)
+    {
         static const int NANOS = 1000000000LL;
-        /*
-         * Method 1: Sleep Method
-         */
-        //long halfperiod = NANOS/ ( 2*frequency);
-        //struct timespec delay;
-        //delay.tv_sec = 0;
-        //delay.tv_nsec = halfperiod/2;
-        //clock_nanosleep(CLOCK_MONOTONIC, 0, &delay, NULL);
-
-
-
-        /*
-         * Method 2: Waiting for a clock to pass
-         */
-
-        //long long halfperiod = NANOS /(1000*2*frequency);
-        //long long start, elapsed, microseconds;
-        //struct timespec begin, current;
-
-        ///* set up start time data */
-        //if (clock_gettime(CLOCK_MONOTONIC, &begin)) {
-        //    return;
-        //}
-
-        ///* Start time in nanoseconds */
-        //start = begin.tv_sec*NANOS + begin.tv_nsec;
-
-        //while (true) {
-        //    /* Elapsed time in nanoseconds */
-        //    if (clock_gettime(CLOCK_MONOTONIC, &current)) {
-        //        return;
-        //    }
-
-        //    elapsed = current.tv_sec*NANOS + current.tv_nsec - start;
-        //    microseconds = elapsed / 1000; // + (elapsed % 1000 >= 500); // round up halves
-
-        //    if (microseconds >= halfperiod)
-        //        break;
-        //}
-
-        /*
-         * Method 3: std::chrono (note! requires C++11)
-         */
-        using std::chrono::nanoseconds;
-        using std::chrono::duration_cast;
         long int halfperiod = (NANOS / ( 2*frequency));
-        auto start = duration_cast<nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
-        while (true) {
-            /* Give this thread higher priority to improve timing stability */
-            pthread_t this_thread = pthread_self();
-            struct sched_param params;
-            params.sched_priority = sched_get_priority_max(SCHED_FIFO);
-            pthread_setschedparam(this_thread, SCHED_FIFO, &params);
-
-            auto now = duration_cast<nanoseconds>(std::chrono::high_resolution_clock::now().time_since_epoch()).count();
-            auto diff = now-start;
-            if (diff > halfperiod)
-                break;
-        }
+
+        uint64_t deadline = m_clock->now() + halfperiod;
+
+        /* Give this thread higher priority to improve timing stability */
+        pthread_t this_thread = pthread_self();
+        struct sched_param params;
+        params.sched_priority = sched_get_priority_max(SCHED_FIFO);
+        pthread_setschedparam(this_thread, SCHED_FIFO, &params);
+
+        /* Busy wait; a sleep overshoots by more than a step half period */
+        m_clock->spinUntil(deadline);
+
         sched_yield();
     }
-}
+
+    void MirrorControlBoard::sleepMicros(unsigned us)
+    {
+        Metrics::Timer timer(Metrics::LATENCY_SLEEP);
+        Metrics::count(Metrics::SLEEPS);
+
+        m_clock->sleepFor(uint64_t(us) * 1000);
+    }
+
+    uint64_t MirrorControlBoard::monotonicNanos()
+    {
+        return m_clock->now();
+    }
+
+    void MirrorControlBoard::waitUntil(uint64_t deadline)
+    {
+        m_clock->spinUntil(deadline);
+    }
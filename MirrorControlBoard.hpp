@@ -7,16 +7,56 @@
 #define MIRRORCONTROLBOARD_HPP
 
 #include <vector>
+#include <string>
+#include <atomic>
+#include <mutex>
 #include <stdint.h>
+#include <SpiTransport.hpp>
 
-namespace MirrorControlBoard
+class SimulatedBoard;
+class Clock;
+class RegisterBackend;
+class GPIOInterface;
+
+/*
+ * One board: owns its registers, GPIO interface and SPI transport, which are
+ * only created (mapping /dev/mem and resetting MCSPI1, on the hardware) on the
+ * first access that needs them. Boards on the HW_SIMULATED backend share no
+ * state, so several can be driven from separate threads.
+ *
+ * A board can itself be used from several threads. ADC transactions hold the
+ * SPI bus (chip select and transfers) for their duration; GPIO writes touch
+ * only their own pin (c.f. GPIOInterface), so stepping and power switching
+ * overlap with ADC reads; state queries read the pin levels without locking.
+ * The set* functions selecting backends and clocks are for configuration,
+ * before the board is shared.
+ */
+class MirrorControlBoard
 {
+    public:
         enum UStep { USTEP_1, USTEP_2, USTEP_4, USTEP_8 };
         enum Dir { DIR_EXTEND, DIR_RETRACT, DIR_NONE };
         enum GPIODir { DIR_OUTPUT, DIR_INPUT};
+        enum HardwareBackend { HW_DEVMEM = 0, HW_SIMULATED = 1 };
+
+        MirrorControlBoard(int backend = HW_DEVMEM);
+        ~MirrorControlBoard();
+
+        MirrorControlBoard(const MirrorControlBoard&) = delete;
+        MirrorControlBoard& operator= (const MirrorControlBoard&) = delete;
+
+        // Selects whether the GPIO and MCSPI registers are those of the board,
+        // mapped from /dev/mem, or those of a simulated board. Takes effect
+        // from the next GPIO or SPI access on.
+        void setHardwareBackend(int backend);
+
+        // The simulated board, with its ADC and stepper driver models; NULL
+        // unless the HW_SIMULATED backend is selected
+        SimulatedBoard* simulatedBoard();
 
         void enableIO();
         void disableIO();
+        bool isIOEnabled();
 
         //------------------------------------------------------------------------------
         // Power Control Function Prototypes
@@ -86,21 +126,115 @@ namespace MirrorControlBoard
         // Measures ADC and returns result as value
         uint32_t measureADC(unsigned iadc, unsigned ichan);
 
+        // Statistics accumulated over a number of ADC samples
+        struct ADCStat {
+            uint64_t sum;
+            uint64_t sumsq;
+            uint32_t min;
+            uint32_t max;
+        };
+
         // Makes some specified number measurements on ADC and keeps track of sum, sum of squares, min and max for statistics..
-        void measureADCStat(unsigned iadc, unsigned ichan, unsigned nmeas, uint32_t& sum, uint64_t& sumsq, uint32_t& min, uint32_t& max, unsigned ndelay=100);
+        // Successive samples are started at least period_ns nanoseconds apart (0 = as fast as the bus and
+        // the TLC3548 allow, i.e. never faster than TLC3548::framePeriodNanos()).
+        // Returns the time spent acquiring the nmeas samples, in nanoseconds.
+        uint64_t measureADCStat(unsigned iadc, unsigned ichan, unsigned nmeas, uint64_t& sum, uint64_t& sumsq, uint32_t& min, uint32_t& max, unsigned period_ns=0);
+
+        // Same as measureADCStat, but for nchan consecutive channels starting at ichan, with samples interleaved
+        // across the channels in a single acquisition. stats must hold nchan entries. Each of the nchan*nmeas
+        // samples is started at least period_ns apart. Returns the time spent acquiring all samples, in nanoseconds.
+        uint64_t measureADCStatMulti(unsigned iadc, unsigned ichan, unsigned nchan, unsigned nmeas, ADCStat* stats, unsigned period_ns=0);
+
+        // Reads nmeas raw (decoded, unfiltered) samples from an ADC channel into samples.
+        // Returns the time spent acquiring, in nanoseconds.
+        uint64_t readADCSamples(unsigned iadc, unsigned ichan, unsigned nmeas, uint32_t* samples, unsigned period_ns=0);
+
+        // Same as readADCSamples, but for nchan consecutive channels starting at ichan, interleaved as in
+        // measureADCStatMulti. samples must hold nchan*nmeas entries and is filled per channel.
+        uint64_t readADCSamplesMulti(unsigned iadc, unsigned ichan, unsigned nchan, unsigned nmeas, uint32_t* samples, unsigned period_ns=0);
+
+        // The statistics measureADCStat keeps of nmeas samples of one channel, rejecting the minority side
+        // of an encoder at home. Samples taken in several acquisitions must be accumulated in one call.
+        static void accumulateADCStat(const uint32_t* samples, unsigned nmeas, ADCStat& stat);
+
+        // Selects the SPI backend (SpiTransport::Backend) used from the next ADC access on;
+        // device names the spidev node for the spidev backend.
+        void setSPIBackend(int backend, const char* device);
+
+        // With warm set, the MCSPI backend created next takes over a controller some earlier
+        // process left set up instead of resetting it (off by default).
+        void setWarmStart(bool warm);
+
+        // Sets the SPI clock to the fastest rate not above hz (granularity 0 = power of two dividers
+        // of 48 MHz, 1 = any integer divider) and the chip select time in clock cycles (0-3).
+        // Returns the resulting clock rate in Hz.
+        unsigned setSPIClock(unsigned hz, int granularity=0, int cstime=3);
+        unsigned getSPIClock();
+
+        // Bounds every wait on the SPI bus to timeout_us microseconds (0 = unbounded) and every
+        // word to a number of retries after a stall.
+        void setSPITimeout(unsigned timeout_us, unsigned retries);
+
+        // Error of the calling thread's most recent ADC acquisition (SpiTransport::Error); an
+        // acquisition which fails stops early and zeroes its samples.
+        int getSPIError();
+
+        // SPI transfer counters
+        SpiTransport::Stats getSPIStats();
+        void resetSPIStats();
 
         // --------------------------------------------------------------------------
         // Utility functions
         // --------------------------------------------------------------------------
 
+        // Makes every delay and timestamp of this board use clock (NULL = the system's
+        // monotonic clock), e.g. a VirtualClock to run simulations without waiting.
+        // The clock is not owned and must outlive its use.
+        void setClock(Clock* clock);
+        Clock& getClock();
+
         // Sleeps for a half-cycle of the frequency given in the argument...
         void waitHalfPeriod(unsigned frequency);
 
+        // Sleeps for us microseconds
+        void sleepMicros(unsigned us);
+
+        // Returns the monotonic clock in nanoseconds
+        uint64_t monotonicNanos();
+
+        // Busy-waits until the monotonic clock reaches deadline (in nanoseconds)
+        void waitUntil(uint64_t deadline);
+
         void setCalibrationConstant(int constant);
         int  getCalibrationConstant();
 
 
         static const unsigned m_nusb=7;
+
+    private:
+        RegisterBackend& registerBackend();
+        GPIOInterface&   gpio();
+        SpiTransport&    spi();
+
+        uint64_t acquireADC(unsigned iadc, unsigned ichan, unsigned nchan, unsigned nmeas, uint32_t* measurement, unsigned period_ns);
+
+        // Time source of all delays and deadlines (c.f. setClock)
+        Clock*                m_clock;
+
+        // Registers of the GPIO and MCSPI modules, either the hardware or a
+        // simulated board (c.f. setHardwareBackend); created on first use
+        int                   m_hwBackend;
+        RegisterBackend*      m_registers;
+        std::atomic<GPIOInterface*> m_gpio;
+        std::mutex            m_setupLock;      // creation of the above and of m_spi
+
+        // The SPI backend is created on first use, so that it can be chosen
+        // at runtime (c.f. setSPIBackend)
+        SpiTransport*         m_spi;
+        std::recursive_mutex  m_spiLock;        // the bus, for a whole ADC transaction
+        SpiTransport::Backend m_spiBackend;
+        std::string           m_spiDevice;
+        bool                  m_warmStart;
 };
 
 #endif // defined MIRRORCONTROLBOARD_HPP
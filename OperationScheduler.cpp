@@ -0,0 +1,171 @@
+#include <chrono>
+#include <OperationScheduler.hpp>
+#include <Metrics.hpp>
+
+//------------------------------------------------------------------------------
+// Constructor
+//------------------------------------------------------------------------------
+
+OperationScheduler::OperationScheduler() :
+    m_nwaiting        (0),
+    m_safetyWaitLimit (10000)
+{
+    for (int i=0; i<NCLASS; i++) {
+        m_running [i] = 0;
+        m_waiting [i] = 0;
+        m_yielded [i] = 0;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Public Members
+//------------------------------------------------------------------------------
+
+void OperationScheduler::enter(Class operation)
+{
+    uint64_t start    = 0;
+    bool     override = false;
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+
+        std::vector<Holder>::iterator it = holder();
+        if (it != m_holders.end()) {
+            it->depth++;
+            return;
+        }
+
+        if (operation == SAFETY)
+            start = Metrics::now();
+
+        if (blocked(operation, false)) {
+            m_waiting[operation]++;
+            m_nwaiting.fetch_add(1, std::memory_order_relaxed);
+
+            if (operation == SAFETY && m_safetyWaitLimit > 0) {
+                std::chrono::steady_clock::time_point deadline =
+                    std::chrono::steady_clock::now() + std::chrono::microseconds(m_safetyWaitLimit);
+                while (blocked(operation, false))
+                    if (m_changed.wait_until(lock, deadline) == std::cv_status::timeout) {
+                        /* give up waiting: safety commands only set GPIO levels */
+                        override = blocked(operation, false);
+                        break;
+                    }
+            }
+            else {
+                while (blocked(operation, false))
+                    m_changed.wait(lock);
+            }
+
+            m_waiting[operation]--;
+            m_nwaiting.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        Holder entered;
+        entered.thread    = std::this_thread::get_id();
+        entered.operation = operation;
+        entered.depth     = 1;
+        m_holders.push_back(entered);
+        m_running[operation]++;
+    }
+
+    if (operation == SAFETY) {
+        Metrics::record(Metrics::LATENCY_SAFETY_WAIT, Metrics::now() - start);
+        if (override)
+            Metrics::count(Metrics::SAFETY_OVERRIDES);
+    }
+}
+
+void OperationScheduler::leave()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+
+    std::vector<Holder>::iterator it = holder();
+    if (it == m_holders.end())
+        return;
+    if (--it->depth > 0)
+        return;
+
+    m_running[it->operation]--;
+    m_holders.erase(it);
+    m_changed.notify_all();
+}
+
+void OperationScheduler::setSafetyWaitLimit(int limit)
+{
+    if (limit < 0)
+        return;
+    std::lock_guard<std::mutex> lock(m_lock);
+    m_safetyWaitLimit = limit;
+}
+
+int OperationScheduler::getSafetyWaitLimit()
+{
+    std::lock_guard<std::mutex> lock(m_lock);
+    return (m_safetyWaitLimit);
+}
+
+//------------------------------------------------------------------------------
+// Private Members
+//------------------------------------------------------------------------------
+
+bool OperationScheduler::conflicts(Class a, Class b)
+{
+    return (a == b || a == SAFETY || b == SAFETY || a == HOUSEKEEPING || b == HOUSEKEEPING);
+}
+
+bool OperationScheduler::blocked(Class operation, bool resuming)
+{
+    for (int i=0; i<NCLASS; i++) {
+        Class other = Class(i);
+        if (!conflicts(operation, other))
+            continue;
+
+        /* running, more urgent and waiting, or paused for something more urgent and due to resume first */
+        if (m_running[other])
+            return true;
+        if (other < operation && m_waiting[other])
+            return true;
+        if (!resuming && other <= operation && m_yielded[other])
+            return true;
+    }
+    return false;
+}
+
+std::vector<OperationScheduler::Holder>::iterator OperationScheduler::holder()
+{
+    std::thread::id self = std::this_thread::get_id();
+    for (std::vector<Holder>::iterator it = m_holders.begin(); it != m_holders.end(); ++it)
+        if (it->thread == self)
+            return it;
+    return m_holders.end();
+}
+
+void OperationScheduler::giveWay()
+{
+    std::unique_lock<std::mutex> lock(m_lock);
+
+    /* only whole operations pause, not ones nested in another */
+    std::vector<Holder>::iterator it = holder();
+    if (it == m_holders.end() || it->depth != 1)
+        return;
+    Class operation = it->operation;
+
+    bool urgent = false;
+    for (int i=0; i<operation; i++)
+        if (m_waiting[i] && conflicts(operation, Class(i)))
+            urgent = true;
+    if (!urgent)
+        return;
+
+    Metrics::count(Metrics::YIELDS);
+
+    m_running[operation]--;
+    m_yielded[operation]++;
+    m_changed.notify_all();
+
+    while (blocked(operation, true))
+        m_changed.wait(lock);
+
+    m_yielded[operation]--;
+    m_running[operation]++;
+}
@@ -0,0 +1,102 @@
+/*
+ * OperationScheduler.hpp - Priority classes for the operations of a CBC
+ * shared by several threads.
+ *
+ * Every operation enters the scheduler with its class before touching the
+ * board and leaves it when done. Operations of classes which conflict run
+ * one at a time, the more urgent first:
+ *
+ *   SAFETY        disabling drives, putting the drivers to sleep, powerDown;
+ *                 conflicts with everything
+ *   MOTION        stepping and driver settings; conflicts with itself
+ *   MEASUREMENT   ADC acquisitions; conflicts with itself
+ *   HOUSEKEEPING  power, USB, calibration and configuration; conflicts with
+ *                 everything
+ *
+ * so motion and measurements still overlap, as the board allows. Long
+ * operations call yield() at chunk boundaries, i.e. between microsteps and
+ * between bursts of ADC samples, where they pause for any more urgent
+ * operation waiting. A safety operation thus waits for at most one chunk of
+ * each operation running; should it still be waiting after the safety wait
+ * limit, it goes ahead regardless. The wait of every safety operation is
+ * recorded in Metrics::LATENCY_SAFETY_WAIT.
+ *
+ * An operation entered by a thread which already holds a turn, e.g. the
+ * drive enables of CBC::configure, runs under the turn held.
+ */
+
+#ifndef OPERATIONSCHEDULER_HPP
+#define OPERATIONSCHEDULER_HPP
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class OperationScheduler
+{
+    public:
+        // In order of priority
+        enum Class {
+            SAFETY,
+            MOTION,
+            MEASUREMENT,
+            HOUSEKEEPING,
+            NCLASS
+        };
+
+        OperationScheduler();
+
+        // Waits for the turn of an operation of the given class
+        void enter (Class operation);
+        void leave ();
+
+        // At a chunk boundary of a long operation: pauses while more urgent
+        // operations which conflict with it are waiting or running
+        void yield() { if (m_nwaiting.load(std::memory_order_relaxed)) giveWay(); }
+
+        // Longest a safety operation waits for its turn [microseconds, 0 = no limit]
+        void setSafetyWaitLimit (int limit);
+        int  getSafetyWaitLimit ();
+
+        // Holds a turn for its lifetime
+        class Turn
+        {
+            public:
+                Turn(OperationScheduler& scheduler, Class operation) : m_scheduler(scheduler) { m_scheduler.enter(operation); }
+                ~Turn() { m_scheduler.leave(); }
+
+            private:
+                OperationScheduler& m_scheduler;
+        };
+
+    private:
+        struct Holder {
+            std::thread::id thread;
+            Class           operation;
+            int             depth;      // nested enters
+        };
+
+        static bool conflicts (Class a, Class b);
+
+        // With the lock held: whether an operation of the class must wait,
+        // either to enter or, resuming, to continue after giving way
+        bool blocked (Class operation, bool resuming);
+
+        std::vector<Holder>::iterator holder ();
+
+        void giveWay ();
+
+        std::mutex               m_lock;
+        std::condition_variable  m_changed;
+        std::vector<Holder>      m_holders;
+        int                      m_running  [NCLASS];
+        int                      m_waiting  [NCLASS];
+        int                      m_yielded  [NCLASS];   // paused in yield()
+        std::atomic<int>         m_nwaiting;            // sum of m_waiting
+        int                      m_safetyWaitLimit;     // microseconds
+};
+
+#endif // OPERATIONSCHEDULER_HPP
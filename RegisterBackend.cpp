@@ -0,0 +1,78 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <RegisterBackend.hpp>
+
+#define MAP_PAGE 4096UL
+#define MAP_MASK (MAP_PAGE - 1)
+
+RegisterBackend::~RegisterBackend()
+{
+}
+
+volatile uint32_t* RegisterBackend::direct(int region, off_t offset)
+{
+    return NULL;
+}
+
+//------------------------------------------------------------------------------
+// /dev/mem
+//------------------------------------------------------------------------------
+
+DevMemBackend::DevMemBackend() :
+    m_mmap_fd(-1)
+{
+    // open /dev/mem and check for failure
+    m_mmap_fd = open("/dev/mem", O_RDWR | O_SYNC);
+    if(m_mmap_fd<0)
+    {
+        perror("open(\"/dev/mem\")");
+        exit(EXIT_FAILURE);
+    }
+}
+
+DevMemBackend::~DevMemBackend()
+{
+    for (unsigned i=0; i<m_regions.size(); i++)
+        munmap(m_regions[i].page, m_regions[i].length);
+    close(m_mmap_fd);
+}
+
+int DevMemBackend::map(off_t base, size_t length)
+{
+    /* mmap needs a page aligned offset; the base need not be */
+    off_t  page_offset = base & MAP_MASK;
+    size_t map_length  = (page_offset + length + MAP_MASK) & ~MAP_MASK;
+
+    void* page = mmap(0, map_length, PROT_READ | PROT_WRITE, MAP_SHARED, m_mmap_fd, base & ~MAP_MASK);
+    if (page == MAP_FAILED)
+    {
+        perror("mmap(\"/dev/mem\")");
+        exit(EXIT_FAILURE);
+    }
+
+    Mapping mapping;
+    mapping.page   = page;
+    mapping.length = map_length;
+    mapping.base   = static_cast<volatile uint8_t*>(page) + page_offset;
+
+    m_regions.push_back(mapping);
+    return m_regions.size() - 1;
+}
+
+volatile uint32_t* DevMemBackend::direct(int region, off_t offset)
+{
+    return reinterpret_cast<volatile uint32_t*>(m_regions[region].base + offset);
+}
+
+uint32_t DevMemBackend::read(int region, off_t offset)
+{
+    return *direct(region, offset);
+}
+
+void DevMemBackend::write(int region, off_t offset, uint32_t value)
+{
+    *direct(region, offset) = value;
+}
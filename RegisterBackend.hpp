@@ -0,0 +1,105 @@
+/*
+ * RegisterBackend.hpp - Access to the memory mapped OMAP3 peripheral registers
+ * used by GPIOInterface and mcspiInterface, either on the hardware through
+ * /dev/mem (DevMemBackend) or on a simulated board (SimulatedRegisters).
+ */
+
+#ifndef REGISTERBACKEND_HPP
+#define REGISTERBACKEND_HPP
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+class RegisterBackend
+{
+    public:
+        virtual ~RegisterBackend();
+
+        // Makes the length bytes of registers at physical address base
+        // accessible, returning a region handle for read/write
+        virtual int map(off_t base, size_t length = 4096) = 0;
+
+        // 32-bit register access at offset bytes into a mapped region
+        virtual uint32_t read(int region, off_t offset) = 0;
+        virtual void     write(int region, off_t offset, uint32_t value) = 0;
+
+        // Returns a pointer through which the register can be accessed
+        // directly, bypassing read/write, or NULL if it has side effects
+        // which have to go through the backend
+        virtual volatile uint32_t* direct(int region, off_t offset);
+};
+
+// Maps the registers from /dev/mem; every access goes straight to the hardware
+class DevMemBackend : public RegisterBackend
+{
+    public:
+        DevMemBackend();
+        ~DevMemBackend();
+
+        int      map(off_t base, size_t length = 4096);
+        uint32_t read(int region, off_t offset);
+        void     write(int region, off_t offset, uint32_t value);
+
+        volatile uint32_t* direct(int region, off_t offset);
+
+    private:
+        struct Mapping {
+            void*             page;     // as returned by mmap, for munmap
+            size_t            length;
+            volatile uint8_t* base;     // the physical base address requested
+        };
+
+        int                  m_mmap_fd;
+        std::vector<Mapping> m_regions;
+};
+
+/*
+ * A single register, bound to a backend. Reads and writes go through a direct
+ * pointer when the backend provides one, so on the hardware they cost the
+ * same as dereferencing the mapped address.
+ */
+class Register
+{
+    public:
+        Register() : m_direct(NULL), m_backend(NULL), m_region(0), m_offset(0) {}
+
+        void bind(RegisterBackend& backend, int region, off_t offset)
+        {
+            m_backend = &backend;
+            m_region  = region;
+            m_offset  = offset;
+            m_direct  = backend.direct(region, offset);
+        }
+
+        uint32_t read() const
+        {
+            return m_direct ? *m_direct : m_backend->read(m_region, m_offset);
+        }
+
+        void write(uint32_t value)
+        {
+            if (m_direct)
+                *m_direct = value;
+            else
+                m_backend->write(m_region, m_offset, value);
+        }
+
+        operator uint32_t() const                { return read(); }
+        Register& operator=  (uint32_t value)    { write(value);          return *this; }
+        Register& operator|= (uint32_t value)    { write(read() | value); return *this; }
+        Register& operator&= (uint32_t value)    { write(read() & value); return *this; }
+
+        // Assigning one register to another would rebind rather than copy
+        // the value; use bind() for the former and read() for the latter
+        Register& operator=  (const Register&) = delete;
+
+    private:
+        volatile uint32_t* m_direct;
+        RegisterBackend*   m_backend;
+        int                m_region;
+        off_t              m_offset;
+};
+
+#endif // REGISTERBACKEND_HPP
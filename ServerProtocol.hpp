@@ -0,0 +1,163 @@
+/*
+ * ServerProtocol.hpp - Wire format of cbc_server (tools/cbc_server.cpp), the
+ * daemon which owns a board and serves the CBC API over a Unix socket or
+ * localhost TCP.
+ *
+ * Every message is a frame: a uint32 length of the bytes which follow, then a
+ * header and the arguments or results, packed, in the byte order of the board
+ * (little-endian on all supported machines).
+ *
+ *   request   uint32 length | uint32 id | uint16 op | uint16 reserved | arguments
+ *   response  uint32 length | uint32 id | uint16 op | int16 status   | results
+ *
+ * Requests may be pipelined: a client can send any number before reading the
+ * responses, which come back in order with the id of their request. OP_BATCH
+ * carries several commands, executed in order as one request with one
+ * response. OP_STREAM_ENCODERS answers with a series of responses, all but
+ * the last with STATUS_MORE, sent on schedule in between the responses to
+ * later requests; a client has one stream at a time.
+ */
+
+#ifndef SERVERPROTOCOL_HPP
+#define SERVERPROTOCOL_HPP
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+namespace ServerProtocol
+{
+    // Requests and responses larger than this are refused
+    static const uint32_t MAX_FRAME = 65536;
+
+    static const uint32_t REQUEST_HEADER  = 8;    // id, op, reserved
+    static const uint32_t RESPONSE_HEADER = 8;    // id, op, status
+
+    /*
+     * Operations, with their arguments (int32 unless noted) and results.
+     * Drives, encoders and USBs count from 1, as in the CBC API; 0 stands for
+     * all of them where noted. A negative nsamples uses the default.
+     */
+    enum Op {
+        OP_PING             = 0,    // -                                  -> -
+        OP_POWER_UP         = 1,    // -                                  -> -
+        OP_POWER_DOWN       = 2,    // -                                  -> -
+        OP_STEP             = 3,    // drive, nsteps, frequency (0 = default) -> -
+        OP_DRIVE_ENABLE     = 4,    // drive (0 = all), enable            -> -
+        OP_DRIVER_AWAKE     = 5,    // awake                              -> -
+        OP_DRIVER_RESET     = 6,    // -                                  -> -
+        OP_HIGH_CURRENT     = 7,    // enable                             -> -
+        OP_SR               = 8,    // enable                             -> -
+        OP_MICROSTEPS       = 9,    // microsteps                         -> -
+        OP_USB_ENABLE       = 10,   // usb (0 = all), enable              -> -
+        OP_ENCODER_POWER    = 11,   // enable                             -> -
+        OP_SENSOR_POWER     = 12,   // enable                             -> -
+        OP_READ_ENCODER     = 13,   // encoder, nsamples                  -> adcData
+        OP_READ_ALL         = 14,   // nsamples                           -> 6 x adcData
+        OP_READ_TEMPERATURE = 15,   // nsamples                           -> adcData, in C
+        OP_MEASURE          = 16,   // adc, channel, nsamples             -> adcData
+        OP_GET_STATE        = 17,   // -                                  -> state
+        OP_STREAM_ENCODERS  = 18,   // nsamples, nframes, interval (us)   -> nframes x (6 x adcData)
+        OP_BATCH            = 19,   // uint16 count, count x command      -> count x result
+        NOP
+    };
+
+    /*
+     * OP_BATCH command: uint16 length of what follows | uint16 op | arguments
+     *          result:  uint16 length of what follows | int16 status | results
+     * Batches do not nest, and cannot hold OP_STREAM_ENCODERS.
+     *
+     * adcData: float voltage, stddev, voltageMin, voltageMax, voltageError,
+     *          sampleRate | int32 status (CBC::ADC::Status)
+     *
+     * state:   int32 usb mask (bit i = USB i, 0 = ethernet), drive mask (bit i =
+     *          drive i+1), driversAwake, highCurrent, SR, encoders, sensors,
+     *          microsteps, steppingFrequency
+     */
+    static const uint32_t ADCDATA_SIZE = 28;
+    static const uint32_t STATE_SIZE   = 36;
+
+    enum Status {
+        STATUS_OK          =  0,
+        STATUS_MORE        =  1,    // streaming: further responses follow
+        STATUS_BAD_REQUEST = -1,    // malformed arguments
+        STATUS_UNKNOWN_OP  = -2,
+        STATUS_TOO_LARGE   = -3     // the response would exceed MAX_FRAME
+    };
+
+    // Appends fields to a frame
+    class Writer
+    {
+        public:
+            Writer(std::vector<uint8_t>& buffer) : m_buffer(buffer) {}
+
+            template<typename T> void put(T value)
+            {
+                size_t at = m_buffer.size();
+                m_buffer.resize(at + sizeof(T));
+                memcpy(&m_buffer[at], &value, sizeof(T));
+            }
+
+            // Reserves a T to be filled in later with patch(), e.g. a length
+            template<typename T> size_t reserve()
+            {
+                size_t at = m_buffer.size();
+                m_buffer.resize(at + sizeof(T));
+                return at;
+            }
+
+            template<typename T> void patch(size_t at, T value)
+            {
+                memcpy(&m_buffer[at], &value, sizeof(T));
+            }
+
+            size_t size() { return m_buffer.size(); }
+
+        private:
+            std::vector<uint8_t>& m_buffer;
+    };
+
+    // Takes fields off a frame; a read past the end returns zero and clears ok()
+    class Reader
+    {
+        public:
+            Reader(const uint8_t* data, size_t size) : m_data(data), m_size(size), m_ok(true) {}
+
+            template<typename T> T get()
+            {
+                T value = T();
+                if (m_size < sizeof(T)) {
+                    m_ok   = false;
+                    m_size = 0;
+                    return value;
+                }
+                memcpy(&value, m_data, sizeof(T));
+                m_data += sizeof(T);
+                m_size -= sizeof(T);
+                return value;
+            }
+
+            // Splits off the next n bytes as a reader of their own
+            Reader sub(size_t n)
+            {
+                if (m_size < n) {
+                    m_ok = false;
+                    n    = m_size;
+                }
+                Reader sub(m_data, n);
+                m_data += n;
+                m_size -= n;
+                return sub;
+            }
+
+            bool   ok()        { return m_ok; }
+            size_t remaining() { return m_size; }
+
+        private:
+            const uint8_t* m_data;
+            size_t         m_size;
+            bool           m_ok;
+    };
+}
+
+#endif // SERVERPROTOCOL_HPP
@@ -0,0 +1,266 @@
+#include <math.h>
+#include <SimulatedPeripherals.hpp>
+#include <Layout.hpp>
+#include <TLC3548_ADC.hpp>
+
+/* Positions are counted in the finest microstep */
+#define USTEPS_PER_STEP 8
+
+//------------------------------------------------------------------------------
+// A3977 stepper drivers
+//------------------------------------------------------------------------------
+
+SimulatedA3977::SimulatedA3977() :
+    m_voltsPerRevolution (3.5),
+    m_stepsPerRevolution (200)
+{
+    for (unsigned idrive=0; idrive<NDRIVE; idrive++) {
+        m_position     [idrive] = 0;
+        m_steps        [idrive] = 0;
+        m_ignoredSteps [idrive] = 0;
+    }
+}
+
+void SimulatedA3977::gpioChanged(SimulatedRegisters& board, int bank, uint32_t previous, uint32_t current)
+{
+    uint32_t rising = current & ~previous;
+    if (!rising)
+        return;
+
+    for (unsigned idrive=0; idrive<NDRIVE; idrive++) {
+        unsigned igpio = Layout::igpioStep(idrive);
+        if (int(igpio/32) != bank || !(rising & (1u << (igpio % 32))))
+            continue;
+
+        /* SLEEP and RESET are active low, as is ENABLE */
+        bool moves = board.getPin(Layout::igpioSleep)
+                  && board.getPin(Layout::igpioReset)
+                  && !board.getPin(Layout::igpioEnable(idrive));
+
+        if (!moves) {
+            m_ignoredSteps[idrive]++;
+            continue;
+        }
+
+        int mslog2 = (board.getPin(Layout::igpioMS2) ? 2 : 0) | (board.getPin(Layout::igpioMS1) ? 1 : 0);
+        int ustep  = USTEPS_PER_STEP >> mslog2;
+
+        /* dir high retracts (c.f. MirrorControlBoard::stepOneDrive) */
+        m_position[idrive] += board.getPin(Layout::igpioDir(idrive)) ? -ustep : ustep;
+        m_steps[idrive]++;
+    }
+}
+
+double SimulatedA3977::getPosition(unsigned idrive)
+{
+    return double(m_position[idrive]) / USTEPS_PER_STEP;
+}
+
+void SimulatedA3977::setPosition(unsigned idrive, double steps)
+{
+    m_position[idrive] = llround(steps * USTEPS_PER_STEP);
+}
+
+uint64_t SimulatedA3977::getSteps(unsigned idrive)
+{
+    return m_steps[idrive];
+}
+
+uint64_t SimulatedA3977::getIgnoredSteps(unsigned idrive)
+{
+    return m_ignoredSteps[idrive];
+}
+
+void SimulatedA3977::setEncoderScale(double voltsPerRevolution, unsigned stepsPerRevolution)
+{
+    m_voltsPerRevolution = voltsPerRevolution;
+    m_stepsPerRevolution = stepsPerRevolution;
+}
+
+double SimulatedA3977::encoderVoltage(SimulatedRegisters& board, unsigned idrive)
+{
+    if (!board.getPin(Layout::igpioEncoderEnable))
+        return 0;
+
+    /* Position 0 sits mid-range; the output wraps once per revolution */
+    double turns = getPosition(idrive) / m_stepsPerRevolution + 0.5;
+    return m_voltsPerRevolution * (turns - floor(turns));
+}
+
+//------------------------------------------------------------------------------
+// TLC3548 ADC
+//------------------------------------------------------------------------------
+
+SimulatedTLC3548::SimulatedTLC3548(unsigned igpioSelect, unsigned igpioPower, uint32_t seed) :
+    m_igpioSelect (igpioSelect),
+    m_igpioPower  (igpioPower),
+    m_fullScale   (5.0),
+    m_noise       (0),
+    m_encoders    (NULL),
+    m_output      (0),
+    m_finished    (0),
+    m_conversionTime (TLC3548::framePeriodNanos()),
+    m_converted   (0),
+    m_earlyFrames (0),
+    m_config      (0),
+    m_frames      (0),
+    m_conversions (0),
+    m_random      (seed),
+    m_gauss       (0.0, 1.0)
+{
+    for (unsigned ichan=0; ichan<8; ichan++)
+        m_voltage[ichan] = 0;
+}
+
+void SimulatedTLC3548::setVoltage(unsigned ichan, double volts)
+{
+    m_voltage[ichan] = volts;
+}
+
+double SimulatedTLC3548::getVoltage(unsigned ichan)
+{
+    return m_voltage[ichan];
+}
+
+void SimulatedTLC3548::setNoise(double rms)
+{
+    m_noise = rms;
+}
+
+void SimulatedTLC3548::connectEncoders(SimulatedA3977* drives)
+{
+    m_encoders = drives;
+}
+
+void SimulatedTLC3548::setConversionTime(uint64_t nanos)
+{
+    m_conversionTime = nanos;
+}
+
+uint64_t SimulatedTLC3548::getEarlyFrames()
+{
+    return m_earlyFrames;
+}
+
+uint64_t SimulatedTLC3548::getFrames()
+{
+    return m_frames;
+}
+
+uint64_t SimulatedTLC3548::getConversions()
+{
+    return m_conversions;
+}
+
+uint16_t SimulatedTLC3548::convert(SimulatedRegisters& board, unsigned ichan)
+{
+    double volts;
+
+    if (ichan == 8)
+        volts = m_fullScale;
+    else if (ichan == 9)
+        volts = m_fullScale / 2;
+    else if (ichan == 10)
+        volts = 0;
+    else if (m_encoders && ichan < SimulatedA3977::NDRIVE)
+        volts = m_encoders->encoderVoltage(board, ichan);
+    else
+        volts = m_voltage[ichan];
+
+    if (m_noise > 0)
+        volts += m_noise * m_gauss(m_random);
+
+    long code = lround(volts / m_fullScale * TLC3548::fullScaleUSB());
+    if (code < 0)
+        code = 0;
+    if (code > long(TLC3548::fullScaleUSB()))
+        code = TLC3548::fullScaleUSB();
+
+    m_conversions++;
+    m_converted = board.frameStart() + m_conversionTime;
+
+    /* 14-bit result, MSB aligned in the 16-bit frame */
+    return uint16_t(code << (16 - NBIT));
+}
+
+bool SimulatedTLC3548::spiExchange(SimulatedRegisters& board, uint16_t tx, uint16_t& rx)
+{
+    if (!board.getPin(m_igpioSelect) || !board.getPin(m_igpioPower))
+        return false;
+
+    m_frames++;
+
+    /* The word shifted out belongs to the previous frame, unless its
+     * conversion is still under way */
+    uint64_t start = board.frameStart();
+    if (start < m_converted) {
+        m_earlyFrames++;
+        m_output = m_finished;
+    }
+    rx         = m_output;
+    m_finished = m_output;
+
+    unsigned cmd = (tx >> 12) & 0xF;
+    switch (cmd) {
+        case 0x0: case 0x1: case 0x2: case 0x3:
+        case 0x4: case 0x5: case 0x6: case 0x7:
+            m_output = convert(board, cmd);
+            break;
+        case 0xB:
+            m_output = convert(board, 9);
+            break;
+        case 0xC:
+            m_output = convert(board, 10);
+            break;
+        case 0xD:
+            m_output = convert(board, 8);
+            break;
+        case 0xA:
+            m_config = tx & 0x0FFF;
+            break;
+        case 0xF:
+            m_config = 0;
+            break;
+        case 0x8:       // power down until the next command
+        case 0xE:       // FIFO read, returns the last conversion once more
+        default:
+            break;
+    }
+
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Board
+//------------------------------------------------------------------------------
+
+SimulatedBoard::SimulatedBoard() :
+    adc0 (Layout::igpioADCSel1, Layout::igpioPowerADC, 1),
+    adc1 (Layout::igpioADCSel2, Layout::igpioPowerADC, 2)
+{
+    /* The pins driven by MirrorControlBoard are outputs from boot on */
+    const unsigned outputs[] = {
+        Layout::igpioEN_IO,         Layout::igpioPowerADC,   Layout::igpioADCSel1,
+        Layout::igpioADCSel2,       Layout::igpioEncoderEnable,
+        Layout::igpioMS1,           Layout::igpioMS2,        Layout::igpioPwrIncBar,
+        Layout::igpioSR,            Layout::igpioReset,      Layout::igpioSleep
+    };
+    for (unsigned i=0; i<sizeof(outputs)/sizeof(outputs[0]); i++)
+        setDirection(outputs[i], false);
+
+    for (unsigned idrive=0; idrive<SimulatedA3977::NDRIVE; idrive++) {
+        setDirection(Layout::igpioStep(idrive),   false);
+        setDirection(Layout::igpioDir(idrive),    false);
+        setDirection(Layout::igpioEnable(idrive), false);
+    }
+
+    for (unsigned iusb=0; iusb<7; iusb++)
+        setDirection(Layout::igpioUSBOff(iusb), false);
+
+    adc0.connectEncoders(&drives);
+    adc0.setVoltage(6, 0.75);     // onboard temperature sensor at 25 C
+
+    attach(&drives);
+    attach(&adc0);
+    attach(&adc1);
+}
@@ -0,0 +1,141 @@
+/*
+ * SimulatedPeripherals.hpp - Behavioural models of the chips on the mirror
+ * control board (TLC3548 ADCs, A3977 stepper drivers and the encoders they
+ * move), wired to a simulated OMAP3 (SimulatedRegisters) through the same
+ * GPIO pins and SPI bus as on the board.
+ */
+
+#ifndef SIMULATEDPERIPHERALS_HPP
+#define SIMULATEDPERIPHERALS_HPP
+
+#include <stdint.h>
+#include <random>
+#include <SimulatedRegisters.hpp>
+
+/*!
+ * The six A3977 drivers with their actuators. A rising edge on a step pin
+ * moves the actuator by one microstep (MS1/MS2) in the direction of its dir
+ * pin, provided the drivers are awake (SLEEP), out of reset (RESET) and the
+ * outputs of the driver are enabled (ENABLE). Positions are kept in eighths of
+ * a full step, the finest microstep.
+ *
+ * Each actuator carries an encoder whose voltage grows linearly with the
+ * position and wraps around once per revolution of the motor.
+ */
+class SimulatedA3977 : public SimulatedRegisters::Device
+{
+    public:
+        SimulatedA3977();
+
+        void gpioChanged(SimulatedRegisters& board, int bank, uint32_t previous, uint32_t current);
+
+        /*! Actuator position of drive 0-5, in full steps (extend = positive) */
+        double getPosition(unsigned idrive);
+        void   setPosition(unsigned idrive, double steps);
+
+        /*! Number of step pulses that moved drive 0-5, and that were ignored */
+        uint64_t getSteps(unsigned idrive);
+        uint64_t getIgnoredSteps(unsigned idrive);
+
+        /*! Encoder output of drive 0-5, 0 V while the encoders are powered down */
+        double encoderVoltage(SimulatedRegisters& board, unsigned idrive);
+
+        /*! Encoder output range over one motor revolution of stepsPerRevolution full steps */
+        void setEncoderScale(double voltsPerRevolution, unsigned stepsPerRevolution);
+
+        static const unsigned NDRIVE = 6;
+
+    private:
+        int64_t  m_position     [NDRIVE];  // eighths of a full step
+        uint64_t m_steps        [NDRIVE];
+        uint64_t m_ignoredSteps [NDRIVE];
+
+        double   m_voltsPerRevolution;
+        unsigned m_stepsPerRevolution;
+};
+
+/*!
+ * A TLC3548 on MCSPI1, selected while its select pin is high. It decodes the
+ * command in the top four bits of each frame (channel select, reference
+ * selects, FIFO read, initialize/configure, power down) and answers every
+ * frame with the conversion started by the previous one, as the chip does:
+ * the result of a select comes back with the next word.
+ *
+ * Inputs are set per channel, with optional gaussian noise; when drives are
+ * connected, channels 0-5 follow their encoders. Reference channels 8-10
+ * read REFP, (REFP+REFM)/2 and REFM, i.e. full scale, half scale and zero.
+ *
+ * A conversion takes the conversion time from the start of the frame which
+ * selected it. A frame starting sooner finds the chip still converting: it
+ * reads out the last finished result once more, and the conversion under way
+ * is lost to the one the frame selects.
+ */
+class SimulatedTLC3548 : public SimulatedRegisters::Device
+{
+    public:
+        /*! igpioSelect is the pin which selects this ADC, igpioPower the pin which powers it */
+        SimulatedTLC3548(unsigned igpioSelect, unsigned igpioPower, uint32_t seed = 1);
+
+        bool spiExchange(SimulatedRegisters& board, uint16_t tx, uint16_t& rx);
+
+        /*! Voltage on input channel 0-7 */
+        void   setVoltage(unsigned ichan, double volts);
+        double getVoltage(unsigned ichan);
+
+        /*! RMS of the gaussian noise added to every conversion [volts] */
+        void setNoise(double rms);
+
+        /*! Time from the start of a frame until its conversion can be read out
+         *  [ns], TLC3548::framePeriodNanos() unless set */
+        void setConversionTime(uint64_t nanos);
+
+        /*! Frames which started before the conversion they read out had finished */
+        uint64_t getEarlyFrames();
+
+        /*! Take channels 0-5 from the encoders of drives 0-5 */
+        void connectEncoders(SimulatedA3977* drives);
+
+        /*! Frames answered, and conversions made */
+        uint64_t getFrames();
+        uint64_t getConversions();
+
+    private:
+        uint16_t convert(SimulatedRegisters& board, unsigned ichan);
+
+        unsigned m_igpioSelect;
+        unsigned m_igpioPower;
+
+        double   m_voltage [8];
+        double   m_fullScale;
+        double   m_noise;
+        SimulatedA3977* m_encoders;
+
+        uint16_t m_output;      // shifted out during the next frame
+        uint16_t m_finished;    // last result shifted out
+        uint64_t m_conversionTime;
+        uint64_t m_converted;   // when the conversion in m_output is done
+        uint64_t m_earlyFrames;
+        uint32_t m_config;      // last CFR written
+
+        uint64_t m_frames;
+        uint64_t m_conversions;
+
+        std::mt19937                     m_random;
+        std::normal_distribution<double> m_gauss;
+};
+
+/*!
+ * The simulated OMAP3 with the board's ADCs and stepper drivers wired to it,
+ * as used by the HW_SIMULATED hardware backend.
+ */
+class SimulatedBoard : public SimulatedRegisters
+{
+    public:
+        SimulatedBoard();
+
+        SimulatedA3977   drives;
+        SimulatedTLC3548 adc0;      // encoders, temperature, channel 7
+        SimulatedTLC3548 adc1;      // auxiliary sensors
+};
+
+#endif // SIMULATEDPERIPHERALS_HPP
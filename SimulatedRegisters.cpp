@@ -0,0 +1,469 @@
+#include <SimulatedRegisters.hpp>
+
+#define BIT(nr)                  (1UL << (nr))
+
+static const off_t ADR_GPIO_BASE[6] = {
+    0x48310000, 0x49050000, 0x49052000, 0x49054000, 0x49056000, 0x49058000
+};
+static const off_t ADR_MCSPI1_BASE   = 0x48098000;
+static const off_t GPIO_SIZE         = 0x1000;
+static const off_t MCSPI_SIZE        = 0x100;
+
+// GPIO register offsets
+#define OFF_GPIO_OE              0x034
+#define OFF_GPIO_DATAIN          0x038
+#define OFF_GPIO_DATAOUT         0x03C
+#define OFF_GPIO_CLEARDATAOUT    0x090
+#define OFF_GPIO_SETDATAOUT      0x094
+
+// MCSPI register offsets (channel 0)
+#define OFF_MCSPI_SYSCONFIG      0x010
+#define OFF_MCSPI_SYSSTATUS      0x014
+#define OFF_MCSPI_IRQSTATUS      0x018
+#define OFF_MCSPI_IRQENABLE      0x01C
+#define OFF_MCSPI_WAKEUPENABLE   0x020
+#define OFF_MCSPI_MODULCTRL      0x028
+#define OFF_MCSPI_CHCONF         0x02C
+#define OFF_MCSPI_CHSTAT         0x030
+#define OFF_MCSPI_CHCTRL         0x034
+#define OFF_MCSPI_TX             0x038
+#define OFF_MCSPI_RX             0x03C
+#define OFF_MCSPI_XFERLEVEL      0x07C
+
+#define SYSCONFIG_SOFTRESET      BIT(1)
+#define SYSSTATUS_RESETDONE      BIT(0)
+#define CHCTRL_EN                BIT(0)
+#define CHCONF_CLKD              (0xF << 2)
+#define CHCONF_CLKG              BIT(29)
+#define CHCTRL_EXTCLK            (0xFF << 8)
+#define CHCONF_FFEW              BIT(27)
+#define CHCONF_FFER              BIT(28)
+
+#define IRQ_TX0_EMPTY            BIT(0)
+#define IRQ_RX0_FULL             BIT(2)
+#define IRQ_EOW                  BIT(17)
+
+#define CHSTAT_RXS               BIT(0)
+#define CHSTAT_TXS               BIT(1)
+#define CHSTAT_EOT               BIT(2)
+#define CHSTAT_TXFFE             BIT(3)
+#define CHSTAT_TXFFF             BIT(4)
+#define CHSTAT_RXFFE             BIT(5)
+#define CHSTAT_RXFFF             BIT(6)
+
+// MCSPI functional clock
+#define MCSPI_FCLK               48000000
+
+static RealClock realClock;
+
+SimulatedRegisters::SimulatedRegisters() :
+    m_accesses   (0),
+    m_clock      (&realClock),
+    m_frameStart (0)
+{
+    for (int i=0; i<6; i++) {
+        m_gpio[i].oe      = 0xFFFFFFFF;  // all inputs out of reset
+        m_gpio[i].dataout = 0;
+        m_gpio[i].input   = 0;
+    }
+    resetMCSPI();
+}
+
+int SimulatedRegisters::map(off_t base, size_t length)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    m_regions.push_back(base);
+    return m_regions.size() - 1;
+}
+
+uint32_t SimulatedRegisters::read(int region, off_t offset)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    m_accesses++;
+    return readPhysical(m_regions[region] + offset);
+}
+
+void SimulatedRegisters::write(int region, off_t offset, uint32_t value)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    m_accesses++;
+    writePhysical(m_regions[region] + offset, value);
+}
+
+void SimulatedRegisters::attach(Device* device)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    m_devices.push_back(device);
+}
+
+uint64_t SimulatedRegisters::getAccesses()
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    return m_accesses;
+}
+
+void SimulatedRegisters::setClock(Clock* clock)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    m_clock = clock ? clock : &realClock;
+}
+
+uint64_t SimulatedRegisters::frameStart()
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    return m_frameStart;
+}
+
+uint32_t SimulatedRegisters::readPhysical(off_t address)
+{
+    int bank = gpioBank(address);
+    if (bank >= 0)
+        return readGPIO(bank, address - ADR_GPIO_BASE[bank]);
+
+    if (address >= ADR_MCSPI1_BASE && address < ADR_MCSPI1_BASE + MCSPI_SIZE)
+        return readMCSPI(address - ADR_MCSPI1_BASE);
+
+    std::map<off_t, uint32_t>::iterator it = m_plain.find(address);
+    return (it == m_plain.end()) ? 0 : it->second;
+}
+
+void SimulatedRegisters::writePhysical(off_t address, uint32_t value)
+{
+    int bank = gpioBank(address);
+    if (bank >= 0)
+        writeGPIO(bank, address - ADR_GPIO_BASE[bank], value);
+    else if (address >= ADR_MCSPI1_BASE && address < ADR_MCSPI1_BASE + MCSPI_SIZE)
+        writeMCSPI(address - ADR_MCSPI1_BASE, value);
+    else
+        m_plain[address] = value;
+}
+
+//------------------------------------------------------------------------------
+// GPIO
+//------------------------------------------------------------------------------
+
+int SimulatedRegisters::gpioBank(off_t address)
+{
+    for (int i=0; i<6; i++)
+        if (address >= ADR_GPIO_BASE[i] && address < ADR_GPIO_BASE[i] + GPIO_SIZE)
+            return i;
+    return -1;
+}
+
+bool SimulatedRegisters::getPin(int ipin)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    return (readGPIO(ipin/32, OFF_GPIO_DATAIN) >> (ipin % 32)) & 0x1;
+}
+
+void SimulatedRegisters::setDirection(int ipin, bool input)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    uint32_t mask = 1u << (ipin % 32);
+    if (input)
+        m_gpio[ipin/32].oe |=  mask;
+    else
+        m_gpio[ipin/32].oe &= ~mask;
+}
+
+void SimulatedRegisters::setInput(int ipin, bool level)
+{
+    std::lock_guard<std::recursive_mutex> lock(m_lock);
+    uint32_t mask = 1u << (ipin % 32);
+    if (level)
+        m_gpio[ipin/32].input |=  mask;
+    else
+        m_gpio[ipin/32].input &= ~mask;
+}
+
+uint32_t SimulatedRegisters::readGPIO(int bank, off_t offset)
+{
+    GPIOBank& gpio = m_gpio[bank];
+
+    switch (offset) {
+        case OFF_GPIO_OE:
+            return gpio.oe;
+        case OFF_GPIO_DATAIN:
+            return (gpio.dataout & ~gpio.oe) | (gpio.input & gpio.oe);
+        case OFF_GPIO_DATAOUT:
+        case OFF_GPIO_CLEARDATAOUT:
+        case OFF_GPIO_SETDATAOUT:
+            return gpio.dataout;
+        default:
+            return m_plain[ADR_GPIO_BASE[bank] + offset];
+    }
+}
+
+void SimulatedRegisters::writeGPIO(int bank, off_t offset, uint32_t value)
+{
+    GPIOBank& gpio = m_gpio[bank];
+
+    switch (offset) {
+        case OFF_GPIO_OE:
+            gpio.oe = value;
+            break;
+        case OFF_GPIO_DATAIN:
+            break;
+        case OFF_GPIO_DATAOUT:
+            setDataOut(bank, value);
+            break;
+        case OFF_GPIO_CLEARDATAOUT:
+            setDataOut(bank, gpio.dataout & ~value);
+            break;
+        case OFF_GPIO_SETDATAOUT:
+            setDataOut(bank, gpio.dataout | value);
+            break;
+        default:
+            m_plain[ADR_GPIO_BASE[bank] + offset] = value;
+    }
+}
+
+void SimulatedRegisters::setDataOut(int bank, uint32_t value)
+{
+    uint32_t previous = m_gpio[bank].dataout;
+    m_gpio[bank].dataout = value;
+
+    if (value != previous)
+        for (unsigned i=0; i<m_devices.size(); i++)
+            m_devices[i]->gpioChanged(*this, bank, previous, value);
+}
+
+//------------------------------------------------------------------------------
+// MCSPI1
+//------------------------------------------------------------------------------
+
+void SimulatedRegisters::resetMCSPI()
+{
+    m_mcspi.sysconfig    = 0;
+    m_mcspi.irqstatus    = 0;
+    m_mcspi.irqenable    = 0;
+    m_mcspi.wakeupenable = 0;
+    m_mcspi.modulctrl    = 0x4;  // slave, as out of reset
+    m_mcspi.chconf       = 0x00060000;
+    m_mcspi.chctrl       = 0;
+    m_mcspi.xferlevel    = 0;
+    m_mcspi.rx           = 0;
+    m_mcspi.rxFull       = false;
+    m_mcspi.wordCount    = 0;
+    m_mcspi.txFIFO.clear();
+    m_mcspi.rxFIFO.clear();
+}
+
+unsigned SimulatedRegisters::fifoDepth()
+{
+    /* 64 bytes, shared between the directions when both FIFOs are enabled;
+     * counted in words of up to 16 bits */
+    bool both = (m_mcspi.chconf & CHCONF_FFEW) && (m_mcspi.chconf & CHCONF_FFER);
+    return both ? 16 : 32;
+}
+
+uint64_t SimulatedRegisters::wordNanos()
+{
+    /* the ratio of the functional clock set by CLKD, or CLKD and EXTCLK */
+    uint32_t clkd = (m_mcspi.chconf & CHCONF_CLKD) >> 2;
+    uint32_t ratio;
+    if (m_mcspi.chconf & CHCONF_CLKG)
+        ratio = ((((m_mcspi.chctrl & CHCTRL_EXTCLK) >> 8) << 4) | clkd) + 1;
+    else
+        ratio = 1u << clkd;
+
+    int wl = (m_mcspi.chconf >> 7) & 0x1F;
+    return uint64_t(wl+1) * ratio * 1000000000ULL / MCSPI_FCLK;
+}
+
+uint16_t SimulatedRegisters::exchange(uint16_t tx)
+{
+    int      wl   = (m_mcspi.chconf >> 7) & 0x1F;
+    uint32_t mask = (wl >= 15) ? 0xFFFF : ((1u << (wl+1)) - 1);
+
+    m_frameStart = m_clock->now();
+
+    uint16_t rx = 0;
+    for (unsigned i=0; i<m_devices.size(); i++)
+        if (m_devices[i]->spiExchange(*this, tx & mask, rx))
+            break;
+
+    m_mcspi.wordCount++;
+
+    /* the word takes its time on the bus */
+    m_clock->spinUntil(m_frameStart + wordNanos());
+
+    return rx & mask;
+}
+
+void SimulatedRegisters::shift()
+{
+    if (!(m_mcspi.chctrl & CHCTRL_EN))
+        return;
+
+    bool rxfifo = m_mcspi.chconf & CHCONF_FFER;
+
+    /* Words leave the TX FIFO as long as there is room for the reply */
+    while (!m_mcspi.txFIFO.empty()) {
+        if (rxfifo ? m_mcspi.rxFIFO.size() >= fifoDepth() : m_mcspi.rxFull)
+            break;
+
+        uint16_t rx = exchange(m_mcspi.txFIFO.front());
+        m_mcspi.txFIFO.pop_front();
+
+        if (rxfifo)
+            m_mcspi.rxFIFO.push_back(rx);
+        else {
+            m_mcspi.rx     = rx;
+            m_mcspi.rxFull = true;
+        }
+    }
+}
+
+uint32_t SimulatedRegisters::chStat()
+{
+    uint32_t stat = 0;
+
+    bool rxAvailable = m_mcspi.rxFull || !m_mcspi.rxFIFO.empty();
+
+    if (rxAvailable)
+        stat |= CHSTAT_RXS;
+    if (m_mcspi.txFIFO.empty())
+        stat |= CHSTAT_TXS | CHSTAT_EOT | CHSTAT_TXFFE;
+    if (m_mcspi.txFIFO.size() >= fifoDepth())
+        stat |= CHSTAT_TXFFF;
+    if (m_mcspi.rxFIFO.empty())
+        stat |= CHSTAT_RXFFE;
+    if (m_mcspi.rxFIFO.size() >= fifoDepth())
+        stat |= CHSTAT_RXFFF;
+
+    return stat;
+}
+
+uint32_t SimulatedRegisters::irqStatus()
+{
+    uint32_t status = m_mcspi.irqstatus;
+
+    if (!(m_mcspi.chctrl & CHCTRL_EN))
+        return status;
+
+    /* XFERLEVEL thresholds are in bytes; words are two bytes */
+    unsigned ael  = ((m_mcspi.xferlevel >> 0) & 0x3F) + 1;
+    unsigned afl  = ((m_mcspi.xferlevel >> 8) & 0x3F) + 1;
+    unsigned wcnt = m_mcspi.xferlevel >> 16;
+
+    if (m_mcspi.chconf & CHCONF_FFEW) {
+        if ((fifoDepth() - m_mcspi.txFIFO.size()) * 2 >= ael)
+            status |= IRQ_TX0_EMPTY;
+    }
+    else if (m_mcspi.txFIFO.empty()) {
+        status |= IRQ_TX0_EMPTY;
+    }
+
+    if (m_mcspi.chconf & CHCONF_FFER) {
+        if (m_mcspi.rxFIFO.size() * 2 >= afl)
+            status |= IRQ_RX0_FULL;
+    }
+    else if (m_mcspi.rxFull) {
+        status |= IRQ_RX0_FULL;
+    }
+
+    if (wcnt && m_mcspi.wordCount >= wcnt)
+        status |= IRQ_EOW;
+
+    return status;
+}
+
+uint32_t SimulatedRegisters::readMCSPI(off_t offset)
+{
+    switch (offset) {
+        case OFF_MCSPI_SYSCONFIG:
+            return m_mcspi.sysconfig;
+        case OFF_MCSPI_SYSSTATUS:
+            return SYSSTATUS_RESETDONE;
+        case OFF_MCSPI_IRQSTATUS:
+            return irqStatus();
+        case OFF_MCSPI_IRQENABLE:
+            return m_mcspi.irqenable;
+        case OFF_MCSPI_WAKEUPENABLE:
+            return m_mcspi.wakeupenable;
+        case OFF_MCSPI_MODULCTRL:
+            return m_mcspi.modulctrl;
+        case OFF_MCSPI_CHCONF:
+            return m_mcspi.chconf;
+        case OFF_MCSPI_CHSTAT:
+            return chStat();
+        case OFF_MCSPI_CHCTRL:
+            return m_mcspi.chctrl;
+        case OFF_MCSPI_XFERLEVEL:
+            return m_mcspi.xferlevel;
+        case OFF_MCSPI_TX:
+            return 0;
+        case OFF_MCSPI_RX: {
+            uint32_t rx;
+            if (m_mcspi.chconf & CHCONF_FFER) {
+                if (m_mcspi.rxFIFO.empty())
+                    return 0;
+                rx = m_mcspi.rxFIFO.front();
+                m_mcspi.rxFIFO.pop_front();
+            }
+            else {
+                rx = m_mcspi.rx;
+                m_mcspi.rxFull = false;
+            }
+            /* reading makes room for words waiting in the TX FIFO */
+            shift();
+            return rx;
+        }
+        default:
+            return m_plain[ADR_MCSPI1_BASE + offset];
+    }
+}
+
+void SimulatedRegisters::writeMCSPI(off_t offset, uint32_t value)
+{
+    switch (offset) {
+        case OFF_MCSPI_SYSCONFIG:
+            if (value & SYSCONFIG_SOFTRESET)
+                resetMCSPI();
+            else
+                m_mcspi.sysconfig = value;
+            break;
+        case OFF_MCSPI_IRQSTATUS:
+            m_mcspi.irqstatus &= ~value;
+            break;
+        case OFF_MCSPI_IRQENABLE:
+            m_mcspi.irqenable = value;
+            break;
+        case OFF_MCSPI_WAKEUPENABLE:
+            m_mcspi.wakeupenable = value;
+            break;
+        case OFF_MCSPI_MODULCTRL:
+            m_mcspi.modulctrl = value;
+            break;
+        case OFF_MCSPI_CHCONF:
+            m_mcspi.chconf = value;
+            break;
+        case OFF_MCSPI_CHCTRL: {
+            bool wasEnabled = m_mcspi.chctrl & CHCTRL_EN;
+            m_mcspi.chctrl  = value;
+            /* enabling or disabling the channel resets the FIFOs and counters */
+            if (wasEnabled != bool(value & CHCTRL_EN)) {
+                m_mcspi.txFIFO.clear();
+                m_mcspi.rxFIFO.clear();
+                m_mcspi.rxFull    = false;
+                m_mcspi.wordCount = 0;
+            }
+            break;
+        }
+        case OFF_MCSPI_XFERLEVEL:
+            m_mcspi.xferlevel = value;
+            break;
+        case OFF_MCSPI_TX:
+            if (!(m_mcspi.chctrl & CHCTRL_EN))
+                break;
+            if (m_mcspi.txFIFO.size() < ((m_mcspi.chconf & CHCONF_FFEW) ? fifoDepth() : 1))
+                m_mcspi.txFIFO.push_back(value & 0xFFFF);
+            shift();
+            break;
+        case OFF_MCSPI_RX:
+            break;
+        default:
+            m_plain[ADR_MCSPI1_BASE + offset] = value;
+    }
+}
@@ -0,0 +1,139 @@
+/*
+ * SimulatedRegisters.hpp - Register-level model of the parts of the OMAP3
+ * used by the library (GPIO banks 1-6, MCSPI1 channel 0, CM_CORE), so that it
+ * can run on a machine without the hardware.
+ */
+
+#ifndef SIMULATEDREGISTERS_HPP
+#define SIMULATEDREGISTERS_HPP
+
+#include <stdint.h>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <vector>
+#include <RegisterBackend.hpp>
+#include <Clock.hpp>
+
+/*!
+ * The GPIO banks model OE, DATAIN, DATAOUT, CLEARDATAOUT and SETDATAOUT:
+ * DATAIN reads the output level of output pins and the externally driven
+ * level (c.f. setInput) of input pins.
+ *
+ * MCSPI1 channel 0 models soft reset, the channel enable, TX/RX registers,
+ * the TX/RX FIFOs with their XFERLEVEL thresholds, CHSTAT and IRQSTATUS. A
+ * word written to TX is shifted out at once and the word clocked in is
+ * supplied by the attached devices. The bus keeps time, though: a frame
+ * starts when it is written (c.f. frameStart) and takes its word time at the
+ * configured rate, which the write spins the clock through. IRQSTATUS is computed from the channel
+ * state when read, so a write-1-to-clear only sticks while its condition is
+ * false, as with a status bit that is immediately raised again.
+ *
+ * Any other register reads back the last value written to it.
+ *
+ * Accesses are serialized, as on the interconnect, so the board can be driven
+ * from several threads. Devices are called with the board locked and may use
+ * its public functions.
+ */
+class SimulatedRegisters : public RegisterBackend
+{
+    public:
+        /*! A peripheral wired to the simulated board */
+        class Device
+        {
+            public:
+                virtual ~Device() {}
+
+                /*! The output levels of a GPIO bank (0-5) changed from previous to current */
+                virtual void gpioChanged(SimulatedRegisters& board, int bank, uint32_t previous, uint32_t current) {}
+
+                /*! A word was clocked out on MCSPI1. Returns true, and the word clocked in
+                 *  through rx, if the device drove the input line. */
+                virtual bool spiExchange(SimulatedRegisters& board, uint16_t tx, uint16_t& rx) { return false; }
+        };
+
+        SimulatedRegisters();
+
+        int      map(off_t base, size_t length = 4096);
+        uint32_t read(int region, off_t offset);
+        void     write(int region, off_t offset, uint32_t value);
+
+        /*! Wire a device to the board; it is not owned and must outlive the board */
+        void attach(Device* device);
+
+        /*! Level of GPIO pin 0-191 as read through DATAIN */
+        bool getPin(int ipin);
+
+        /*! Set the direction of GPIO pin 0-191 (OE) without going through the
+         *  driver, e.g. to the state the bootloader leaves the board in */
+        void setDirection(int ipin, bool input);
+
+        /*! Drive GPIO input pin 0-191 from outside the board */
+        void setInput(int ipin, bool level);
+
+        /*! Number of register reads and writes made so far */
+        uint64_t getAccesses();
+
+        /*! Time source of the bus; not owned, NULL = the monotonic clock */
+        void setClock(Clock* clock);
+
+        /*! Time [ns, of the clock above] at which the frame being exchanged
+         *  started, for the devices to time their response by */
+        uint64_t frameStart();
+
+    private:
+        uint32_t readPhysical  (off_t address);
+        void     writePhysical (off_t address, uint32_t value);
+
+        // GPIO
+        struct GPIOBank {
+            uint32_t oe;
+            uint32_t dataout;
+            uint32_t input;
+        };
+        GPIOBank m_gpio[6];
+
+        int      gpioBank    (off_t address);
+        uint32_t readGPIO    (int bank, off_t offset);
+        void     writeGPIO   (int bank, off_t offset, uint32_t value);
+        void     setDataOut  (int bank, uint32_t value);
+
+        // MCSPI1
+        struct MCSPI {
+            uint32_t sysconfig;
+            uint32_t irqstatus;     // latched events other than the modelled ones
+            uint32_t irqenable;
+            uint32_t wakeupenable;
+            uint32_t modulctrl;
+            uint32_t chconf;
+            uint32_t chctrl;
+            uint32_t xferlevel;
+            uint32_t rx;
+            bool     rxFull;
+            uint32_t wordCount;
+            std::deque<uint16_t> txFIFO;
+            std::deque<uint16_t> rxFIFO;
+        } m_mcspi;
+
+        void     resetMCSPI   ();
+        uint32_t readMCSPI    (off_t offset);
+        void     writeMCSPI   (off_t offset, uint32_t value);
+        uint32_t irqStatus    ();
+        uint32_t chStat       ();
+        unsigned fifoDepth    ();
+        void     shift        ();
+        uint16_t exchange     (uint16_t tx);
+        uint64_t wordNanos    ();
+
+        std::vector<off_t>        m_regions;
+        std::map<off_t, uint32_t> m_plain;
+        std::vector<Device*>      m_devices;
+        uint64_t                  m_accesses;
+
+        Clock*                    m_clock;
+        uint64_t                  m_frameStart;
+
+        std::recursive_mutex      m_lock;
+};
+
+#endif // SIMULATEDREGISTERS_HPP
@@ -0,0 +1,32 @@
+#include <SimulatedSpi.hpp>
+
+SimulatedSpi::SimulatedSpi() :
+    m_previous (0),
+    m_clock    (24000000)
+{
+}
+
+void SimulatedSpi::exchange(const uint16_t* tx, uint16_t* rx, size_t n)
+{
+    for (size_t i=0; i<n; i++)
+        rx[i] = respond(tx[i]);
+    m_stats.words += n;
+}
+
+uint16_t SimulatedSpi::respond(uint16_t tx)
+{
+    uint16_t previous = m_previous;
+    m_previous = tx;
+    return previous;
+}
+
+uint32_t SimulatedSpi::setClockRate(uint32_t hz, int granularity)
+{
+    m_clock = hz;
+    return m_clock;
+}
+
+uint32_t SimulatedSpi::getClockRate()
+{
+    return m_clock;
+}
@@ -0,0 +1,33 @@
+/*
+ * SimulatedSpi.hpp - In-memory SPI backend, for running the library without
+ * hardware
+ */
+
+#ifndef SIMULATEDSPI_HPP
+#define SIMULATEDSPI_HPP
+
+#include <SpiTransport.hpp>
+
+class SimulatedSpi : public SpiTransport
+{
+    public:
+        SimulatedSpi();
+
+        // Any rate is available
+        uint32_t setClockRate(uint32_t hz, int granularity = 0);
+        uint32_t getClockRate();
+
+    protected:
+        void exchange(const uint16_t* tx, uint16_t* rx, size_t n);
+
+        // Returns the word the device clocks out while receiving tx. The
+        // default device echoes each word back one frame late, the way the
+        // TLC3548 returns its conversion results.
+        virtual uint16_t respond(uint16_t tx);
+
+    private:
+        uint16_t m_previous;
+        uint32_t m_clock;
+};
+
+#endif // SIMULATEDSPI_HPP
@@ -11,16 +11,29 @@
 #include <linux/spi/spidev.h>
 #include "SpiInterface.hpp"
 
-const char*     SpiInterface::device = "/dev/spidev1.0";
+// SPI_IOC_MESSAGE(N) encodes N*sizeof(spi_ioc_transfer) in the 14-bit ioctl size field
+#define MAX_IOC_TRANSFERS ((1u << _IOC_SIZEBITS) / sizeof(struct spi_ioc_transfer) - 1)
 
-SpiInterface::SpiInterface(): mode(SPI_MODE_1), bits(16), speed(8000000),
-    delay(0)
+// spidev default buffer size, if the module parameter cannot be read
+#define DEFAULT_BUFSIZ 4096
+
+SpiInterface::SpiInterface(const char* device, uint32_t speed) : SpiTransport(), m_maxBatch(0),
+    device(device), mode(SPI_MODE_1), bits(16), speed(speed), delay(0), fd(-1)
 {
+    Configure();
+    PrepareTransfers();
+}
+
+SpiInterface::SpiInterface(int fd, uint32_t speed) : SpiTransport(), m_maxBatch(0),
+    device(), mode(SPI_MODE_1), bits(16), speed(speed), delay(0), fd(fd)
+{
+    PrepareTransfers();
 }
 
 SpiInterface::~SpiInterface()
 {
-    close(fd);
+    if (fd >= 0)
+        close(fd);
 }
 
 void SpiInterface::pabort(const char *s)
@@ -29,36 +42,96 @@ void SpiInterface::pabort(const char *s)
     abort();
 }
 
-uint32_t SpiInterface::transfer(uint32_t data)
+void SpiInterface::PrepareTransfers()
 {
-
-    uint32_t tx []= {data};
-    uint32_t rx []= {0};
+    /* spidev copies a whole message through its bounce buffer, of bufsiz
+     * bytes, in each direction */
+    unsigned bufsiz = DEFAULT_BUFSIZ;
+    FILE* param = fopen("/sys/module/spidev/parameters/bufsiz", "r");
+    if (param) {
+        if (fscanf(param, "%u", &bufsiz) != 1)
+            bufsiz = DEFAULT_BUFSIZ;
+        fclose(param);
+    }
+
+    m_maxBatch = bufsiz / sizeof(uint16_t);
+    if (m_maxBatch > MAX_IOC_TRANSFERS)
+        m_maxBatch = MAX_IOC_TRANSFERS;
+    if (m_maxBatch < 1)
+        m_maxBatch = 1;
 
     struct spi_ioc_transfer tr;
     memset( (void *) & tr, 0, sizeof(struct spi_ioc_transfer));
-    tr.tx_buf           = (unsigned long) tx;
-    tr.rx_buf           = (unsigned long) rx;
-    tr.len              = 4;
+    tr.len              = 2;
     tr.delay_usecs      = delay;
     tr.speed_hz         = speed;
     tr.bits_per_word    = bits;
+    /* deassert chip select after each word, to frame every word separately */
+    tr.cs_change        = 1;
+
+    m_transfers.assign(m_maxBatch, tr);
+}
+
+unsigned SpiInterface::getMaxBatch()
+{
+    return m_maxBatch;
+}
 
+int SpiInterface::submit(struct spi_ioc_transfer* transfers, unsigned n)
+{
+    return ioctl(fd, SPI_IOC_MESSAGE(n), transfers);
+}
 
-    ioctl(fd, SPI_IOC_MESSAGE(1), &tr);
+void SpiInterface::exchange(const uint16_t* tx, uint16_t* rx, size_t n)
+{
+    size_t done = 0;
+
+    while (done < n) {
+        unsigned nbatch = (n - done < m_maxBatch) ? n - done : m_maxBatch;
+
+        for (unsigned i=0; i<nbatch; i++) {
+            m_transfers[i].tx_buf    = (unsigned long) &tx[done+i];
+            m_transfers[i].rx_buf    = (unsigned long) &rx[done+i];
+            m_transfers[i].speed_hz  = speed;
+            m_transfers[i].cs_change = 1;
+        }
+        /* on the last transfer of a message cs_change would instead keep
+         * chip select asserted afterwards */
+        m_transfers[nbatch-1].cs_change = 0;
+
+        if (submit(m_transfers.data(), nbatch) < 0) {
+            m_error = ERR_IO;
+            for (size_t i=done; i<n; i++)
+                rx[i] = 0;
+            return;
+        }
+
+        done += nbatch;
+        m_stats.words += nbatch;
+    }
+}
 
-    uint32_t read = rx[0];
+uint32_t SpiInterface::setClockRate(uint32_t hz, int granularity)
+{
+    if (fd >= 0 && ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &hz) == -1) {
+        perror("spidev driver error: can't set max speed hz");
+        return speed;
+    }
+    speed = hz;
+    return speed;
+}
 
-    return read;
+uint32_t SpiInterface::getClockRate()
+{
+    return speed;
 }
 
 void SpiInterface::Configure ()
 {
-    fd = open(device, O_RDWR);
     int ret = 0;
 
     //printf("\nOpening SPI device %s", device);
-    fd = open(device, O_RDWR);
+    fd = open(device.c_str(), O_RDWR);
     if (fd < 0)
         pabort("spidev driver error: can't open spi device");
 
@@ -96,9 +169,3 @@ void SpiInterface::Configure ()
     //printf("bits per word: %d\n", bits);
     //printf("max speed: %d Hz (%d KHz)\n", speed, speed/1000);
 }
-
-uint32_t SpiInterface::WriteRead (uint32_t data)
-{
-    uint32_t read = transfer(data);
-    return (read);
-}
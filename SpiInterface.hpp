@@ -1,33 +1,62 @@
 /*
- * SpiInterface.hpp -
+ * SpiInterface.hpp - SPI backend using the kernel spidev driver, for systems
+ * where /dev/mem is not available
  */
 
 #ifndef SPIINTERFACE_HPP
 #define SPIINTERFACE_HPP
 
 #include <stdint.h>
+#include <string>
+#include <vector>
+#include <linux/spi/spidev.h>
+#include <SpiTransport.hpp>
 #define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
 
-class SpiInterface
+class SpiInterface : public SpiTransport
 {
 public:
-    //SpiInterface(const char *device, uint8_t mode, uint8_t bits, uint32_t speed, uint16_t delay);
-    SpiInterface();
+    SpiInterface(const char* device = "/dev/spidev1.0", uint32_t speed = 8000000);
     ~SpiInterface();
 
-    // Write a 32 bit integer to MOSI.
-    // 32 bit MISO value is returned.
-    uint32_t WriteRead(uint32_t data);
-    void     Configure();
+    // Largest number of words submitted per ioctl
+    unsigned getMaxBatch();
+
+    // The driver picks the closest divider it supports below hz; the
+    // granularity is not selectable
+    uint32_t setClockRate(uint32_t hz, int granularity = 0);
+    uint32_t getClockRate();
+
+protected:
+    // The batch is submitted as SPI_IOC_MESSAGE(N) ioctls of up to
+    // getMaxBatch() words each, with chip select toggled between words
+    void exchange(const uint16_t* tx, uint16_t* rx, size_t n);
+
+    // Wraps an already open spidev file descriptor (-1 for none), without
+    // configuring it; for stand-ins which override submit()
+    SpiInterface(int fd, uint32_t speed);
+
+    // Submits n prepared transfers as one message; returns a negative
+    // value on failure, like ioctl()
+    virtual int submit(struct spi_ioc_transfer* transfers, unsigned n);
+
+    // Words per message, limited by the ioctl size field and by the spidev
+    // bufsiz module parameter
+    unsigned m_maxBatch;
 
 private:
-    uint32_t transfer(uint32_t data);
+    void     Configure();
+    void     PrepareTransfers();
     static void pabort(const char *s);
 
-    static const char   *device;
-    const uint8_t       mode;
-    const uint8_t       bits;
-    const uint32_t      speed;
+    // Transfer descriptors, reused by every call; only the buffer
+    // pointers change per word
+    std::vector<struct spi_ioc_transfer> m_transfers;
+
+    std::string         device;
+    uint8_t             mode;
+    uint8_t             bits;
+    uint32_t            speed;
     const uint16_t      delay;
 
     int fd;
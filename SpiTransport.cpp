@@ -0,0 +1,86 @@
+#include <SpiTransport.hpp>
+#include <mcspiInterface.hpp>
+#include <SpiInterface.hpp>
+#include <SimulatedSpi.hpp>
+#include <Metrics.hpp>
+
+SpiTransport::SpiTransport() :
+    m_timeout_ns (1000000),
+    m_retryLimit (100),
+    m_error      (ERR_NONE),
+    m_stats      ()
+{
+}
+
+SpiTransport::~SpiTransport()
+{
+}
+
+SpiTransport* SpiTransport::create(Backend backend, const char* device, RegisterBackend& registers, bool warm)
+{
+    switch (backend) {
+        case BACKEND_SPIDEV:
+            return new SpiInterface(device);
+        case BACKEND_SIMULATED:
+            return new SimulatedSpi();
+        case BACKEND_MCSPI:
+        default:
+            return new mcspiInterface(registers, warm);
+    }
+}
+
+/* Single-word transfers are timed one in SPI_WORD_SAMPLING, keeping the
+ * clock reads off the others */
+static const unsigned SPI_WORD_SAMPLING = 64;
+static thread_local unsigned spiWordPhase = 0;
+
+void SpiTransport::transfer(const uint16_t* tx, uint16_t* rx, size_t n)
+{
+    Metrics::count(Metrics::SPI_WORDS, n);
+    exchange(tx, rx, n);
+}
+
+uint16_t SpiTransport::WriteRead(uint16_t data)
+{
+    uint16_t read;
+
+    if (++spiWordPhase < SPI_WORD_SAMPLING) {
+        transfer(&data, &read, 1);
+        return read;
+    }
+    spiWordPhase = 0;
+
+    Metrics::Timer timer(Metrics::LATENCY_SPI_WORD);
+    transfer(&data, &read, 1);
+    return read;
+}
+
+void SpiTransport::setChipSelectTime(int cycles)
+{
+}
+
+void SpiTransport::setTimeout(unsigned timeout_us, unsigned retries)
+{
+    m_timeout_ns = uint64_t(timeout_us) * 1000;
+    m_retryLimit = retries;
+}
+
+int SpiTransport::getError()
+{
+    return m_error;
+}
+
+void SpiTransport::clearError()
+{
+    m_error = ERR_NONE;
+}
+
+SpiTransport::Stats SpiTransport::getStats()
+{
+    return m_stats;
+}
+
+void SpiTransport::resetStats()
+{
+    m_stats = Stats();
+}
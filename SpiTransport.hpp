@@ -0,0 +1,79 @@
+/*
+ * SpiTransport.hpp - Common interface of the SPI backends used to talk to the
+ * ADCs: the MCSPI registers (mcspiInterface), the kernel spidev driver
+ * (SpiInterface) and an in-memory stand-in (SimulatedSpi).
+ */
+
+#ifndef SPITRANSPORT_HPP
+#define SPITRANSPORT_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+class RegisterBackend;
+
+class SpiTransport
+{
+    public:
+        enum Backend { BACKEND_MCSPI = 0, BACKEND_SPIDEV = 1, BACKEND_SIMULATED = 2 };
+
+        // Transfer errors; sticky until clearError()
+        enum Error { ERR_NONE = 0, ERR_TIMEOUT = 1, ERR_STALL = 2, ERR_IO = 3 };
+
+        // Transfer counters, cumulative since construction or resetStats()
+        struct Stats {
+            uint64_t words;     // words transferred
+            uint64_t polls;     // status register reads spent waiting
+            uint64_t retries;   // words re-sent after the receive side stalled
+            uint64_t stalls;    // words which needed at least one retry
+            uint64_t timeouts;  // waits abandoned after the timeout
+        };
+
+        // Creates a backend; device names the spidev node for BACKEND_SPIDEV,
+        // registers provides the MCSPI registers for BACKEND_MCSPI. With warm,
+        // an MCSPI controller found already set up is adopted, not reset.
+        static SpiTransport* create(Backend backend, const char* device, RegisterBackend& registers, bool warm = false);
+
+        virtual ~SpiTransport();
+
+        // Exchanges n 16-bit words as one batch, each word in its own chip
+        // select frame: rx[i] is the word clocked in while tx[i] was sent.
+        // A backend may submit the whole batch at once. If a word fails, the
+        // error is recorded, the batch stops there and the rest of rx is zeroed.
+        void transfer(const uint16_t* tx, uint16_t* rx, size_t n);
+
+        // Single word transfer
+        uint16_t WriteRead(uint16_t data);
+
+        // Sets the SPI clock to the fastest rate available not above hz; the
+        // meaning of granularity is up to the backend. Returns the rate set.
+        virtual uint32_t setClockRate(uint32_t hz, int granularity = 0) = 0;
+        virtual uint32_t getClockRate() = 0;
+
+        // Clock cycles between chip select and the first/last clock edge,
+        // where the backend supports it
+        virtual void setChipSelectTime(int cycles);
+
+        // Bounds each wait on the hardware to timeout_us microseconds (0 =
+        // wait forever), and each word to retries re-sends after a stall.
+        void setTimeout(unsigned timeout_us, unsigned retries);
+
+        int  getError();
+        void clearError();
+
+        Stats getStats();
+        void  resetStats();
+
+    protected:
+        SpiTransport();
+
+        // The backend's part of transfer(), which counts the words
+        virtual void exchange(const uint16_t* tx, uint16_t* rx, size_t n) = 0;
+
+        uint64_t m_timeout_ns;
+        unsigned m_retryLimit;
+        int      m_error;
+        Stats    m_stats;
+};
+
+#endif // SPITRANSPORT_HPP
@@ -0,0 +1,155 @@
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <StatusPage.hpp>
+
+//------------------------------------------------------------------------------
+// Page layout
+//------------------------------------------------------------------------------
+
+static const uint32_t STATUS_MAGIC = 0x43424331;   // "CBC1"
+
+// Reads of a page whose update never completes give up after this many tries
+static const unsigned STATUS_RETRIES = 100000;
+
+struct StatusPage::Page
+{
+    uint32_t              magic;        // STATUS_MAGIC once initialized
+    uint32_t              size;         // sizeof(Status), to catch mismatched builds
+    std::atomic<uint32_t> sequence;     // odd while an update is in progress
+    uint32_t              reserved;
+    Status                status;
+};
+
+static uint64_t realtimeNanos()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    return uint64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+// Constructor + Destructor
+//------------------------------------------------------------------------------
+
+StatusPage::StatusPage(const char* name, Mode mode) :
+    m_name (name),
+    m_mode (mode),
+    m_page (NULL)
+{
+    memset(&m_status, 0, sizeof(m_status));
+
+    int fd = shm_open(name, (mode == PUBLISH) ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if (fd < 0) {
+        perror("StatusPage: shm_open");
+        return;
+    }
+
+    if (mode == PUBLISH && ftruncate(fd, sizeof(Page)) < 0) {
+        perror("StatusPage: ftruncate");
+        close(fd);
+        return;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(Page)) {
+        fprintf(stderr, "StatusPage: %s is not a status page\n", name);
+        close(fd);
+        return;
+    }
+
+    void* map = mmap(NULL, sizeof(Page), (mode == PUBLISH) ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("StatusPage: mmap");
+        return;
+    }
+    m_page = static_cast<Page*>(map);
+
+    if (mode == PUBLISH) {
+        /* a previous publisher may have died mid-update: start from an even sequence */
+        m_page->sequence.store((m_page->sequence.load(std::memory_order_relaxed) + 1) & ~1u, std::memory_order_relaxed);
+        m_page->size  = sizeof(Status);
+        m_page->magic = STATUS_MAGIC;
+
+        m_status.pid = getpid();
+        begin();
+        commit();
+    }
+}
+
+StatusPage::~StatusPage()
+{
+    if (!m_page)
+        return;
+
+    if (m_mode == PUBLISH) {
+        begin();
+        m_status.pid = 0;
+        commit();
+    }
+
+    munmap(m_page, sizeof(Page));
+}
+
+//------------------------------------------------------------------------------
+// Public Members
+//------------------------------------------------------------------------------
+
+bool StatusPage::isOpen()
+{
+    return m_page != NULL;
+}
+
+const std::string& StatusPage::getName()
+{
+    return m_name;
+}
+
+StatusPage::Status& StatusPage::begin()
+{
+    m_writeLock.lock();
+    return m_status;
+}
+
+void StatusPage::commit()
+{
+    if (m_page) {
+        m_status.updated = realtimeNanos();
+        m_status.updates++;
+
+        uint32_t sequence = m_page->sequence.load(std::memory_order_relaxed);
+        m_page->sequence.store(sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        memcpy(&m_page->status, &m_status, sizeof(Status));
+
+        m_page->sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+    m_writeLock.unlock();
+}
+
+bool StatusPage::read(Status& status)
+{
+    if (!m_page || m_page->magic != STATUS_MAGIC || m_page->size != sizeof(Status))
+        return false;
+
+    for (unsigned itry=0; itry<STATUS_RETRIES; itry++) {
+        uint32_t before = m_page->sequence.load(std::memory_order_acquire);
+        if (before & 1)
+            continue;
+
+        memcpy(&status, &m_page->status, sizeof(Status));
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (m_page->sequence.load(std::memory_order_relaxed) == before)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,88 @@
+/*
+ * StatusPage.hpp - Board state published by the process owning a CBC in a
+ * POSIX shared-memory segment, for monitors running in other processes.
+ *
+ * The page is a seqlock: the publisher makes the sequence number odd, writes
+ * the status, and makes it even again; a reader copies the status and keeps
+ * the copy if the sequence number was even and unchanged across it. Reading
+ * takes no system call and no lock, so any number of monitors can poll the
+ * page without slowing the publisher or touching the hardware.
+ */
+
+#ifndef STATUSPAGE_HPP
+#define STATUSPAGE_HPP
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <Metrics.hpp>
+
+class StatusPage
+{
+    public:
+        struct Status {
+            uint64_t updated;               // CLOCK_REALTIME ns of the last update
+            uint64_t updates;               // number of updates since the publisher opened the page
+            int32_t  pid;                   // of the publisher, 0 once it closed the page
+
+            // Board state, as read back from the GPIOs
+            int32_t  usbEnabled;            // bit i = USB i (0 = ethernet)
+            int32_t  drivesEnabled;         // bit i = drive i+1
+            int32_t  driversAwake;
+            int32_t  highCurrent;
+            int32_t  syncRectification;
+            int32_t  encodersEnabled;
+            int32_t  sensorsEnabled;
+            int32_t  microsteps;            // 1, 2, 4 or 8
+            int32_t  steppingFrequency;     // macrosteps per second
+
+            // Net macrosteps issued to each drive since the publisher opened the page
+            int64_t  position [6];
+
+            // Last encoder readings [V] and board temperature [C], with the
+            // CLOCK_REALTIME ns they were taken at (0 = not yet)
+            float    encoderVoltage [6];
+            uint64_t encoderTime    [6];
+            float    temperature;
+            uint64_t temperatureTime;
+
+            // Library telemetry at the last update
+            Metrics::Snapshot metrics;
+        };
+
+        enum Mode { PUBLISH, OBSERVE };
+
+        // Opens the shared-memory segment name (e.g. "/cbc_status"): PUBLISH
+        // creates it if need be and takes it over, OBSERVE maps it read only.
+        // Failures are reported with perror and leave the page closed.
+        StatusPage(const char* name, Mode mode);
+        ~StatusPage();
+
+        StatusPage(const StatusPage&) = delete;
+        StatusPage& operator= (const StatusPage&) = delete;
+
+        bool isOpen();
+        const std::string& getName();
+
+        // Publisher: begin() locks and returns the status to modify, commit()
+        // writes it to the page and unlocks. Updates from several threads are
+        // serialized.
+        Status& begin();
+        void    commit();
+
+        // Observer: copies a consistent status; false if the page is closed,
+        // has not been published yet, or stayed mid-update while retrying
+        bool read(Status& status);
+
+    private:
+        struct Page;
+
+        std::string m_name;
+        Mode        m_mode;
+        Page*       m_page;
+        std::mutex  m_writeLock;
+        Status      m_status;           // publisher's copy
+};
+
+#endif // STATUSPAGE_HPP
@@ -132,6 +132,11 @@ namespace TLC3548 {
         return (0x1<<NBIT)-1;
     }
 
+    uint32_t framePeriodNanos()
+    {
+        return 5000;
+    }
+
     uint32_t decodeUSB(uint32_t data)
     {
         data >>= (16-NBIT);
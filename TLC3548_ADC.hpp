@@ -33,6 +33,11 @@ namespace TLC3548
     uint32_t codeConfigDefault();
 
     uint32_t fullScaleUSB();
+
+    // Shortest interval between the starts of two frames which lets the
+    // conversion selected by the first finish before the second reads it
+    // out, i.e. one period at the 200 kSPS maximum throughput [ns]
+    uint32_t framePeriodNanos();
     uint32_t decodeUSB(uint32_t data);
     int32_t decodeBOB(uint32_t data);
     int32_t decodeBTC(uint32_t data);
@@ -0,0 +1,161 @@
+/*
+ * bench_concurrency - Stress test of the library's concurrency domains on the
+ * simulated board (HW_SIMULATED): one thread steps drive 1 back and forth
+ * while another reads the encoders of the stationary drives and the ADC
+ * references. Every pulse must reach the simulated A3977 and every reading
+ * must match the simulated TLC3548, i.e. the GPIO writes of the stepping
+ * thread and the SPI transactions of the reading thread must not interfere.
+ * Runs on the real clock, so the two threads overlap in time.
+ *
+ * Usage: bench_concurrency [cycles] [steps per cycle] [samples per read]
+ *
+ * Exits with 1 if any pulse was lost or any reading was out of tolerance.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include <cbc.hpp>
+#include <MirrorControlBoard.hpp>
+#include <SimulatedPeripherals.hpp>
+
+static double nanos()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+struct StepThread {
+    CBC*              cbc;
+    int               ncycle;
+    int               nsteps;
+    std::atomic<bool> done;
+    double            elapsed;
+};
+
+struct ReadThread {
+    CBC*             cbc;
+    StepThread*      stepper;
+    int              nsamples;
+    double           expected [6];
+    double           tolerance;
+    unsigned         nread;
+    unsigned         nbad;
+    unsigned         nerror;
+    double           maxerror;
+};
+
+static void stepDrive(StepThread* args)
+{
+    double t0 = nanos();
+    for (int icycle=0; icycle<args->ncycle; icycle++) {
+        args->cbc->driver.step(1,  args->nsteps);
+        args->cbc->driver.step(1, -args->nsteps);
+    }
+    args->elapsed = nanos() - t0;
+    args->done    = true;
+}
+
+static void check(ReadThread* args, const CBC::ADC::adcData& data, double expected)
+{
+    double error = fabs(data.voltage - expected);
+    if (error > args->maxerror)
+        args->maxerror = error;
+    if (error > args->tolerance)
+        args->nbad++;
+    if (data.status != CBC::ADC::STATUS_OK)
+        args->nerror++;
+    args->nread++;
+}
+
+static void readEncoders(ReadThread* args)
+{
+    /* keep reading for as long as the drive moves */
+    while (!args->stepper->done) {
+        for (int iencoder=2; iencoder<=6; iencoder++)
+            check(args, args->cbc->adc.readEncoder(iencoder, args->nsamples), args->expected[iencoder-1]);
+
+        check(args, args->cbc->adc.readRefHigh (0, args->nsamples), 5.0);
+        check(args, args->cbc->adc.readRefMid  (0, args->nsamples), 2.5);
+        check(args, args->cbc->adc.readRefLow  (1, args->nsamples), 0.0);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int ncycle   = (argc > 1) ? atoi(argv[1]) : 20;
+    int nsteps   = (argc > 2) ? atoi(argv[2]) : 50;
+    int nsamples = (argc > 3) ? atoi(argv[3]) : 100;
+
+    CBC::Config config;
+    config.hardwareBackend   = CBC::HW_SIMULATED;
+    config.steppingFrequency = 10000;
+    config.driveEnable       = 0x1;
+    config.delayTime         = 0;
+    config.defaultADCSamples = nsamples;
+
+    CBC cbc(config);
+
+    /* RESET comes out of power up low; the drivers ignore steps until released */
+    cbc.driver.reset();
+    cbc.encoder.enable();
+
+    SimulatedBoard* board = cbc.board().simulatedBoard();
+    board->adc0.setNoise(0.001);
+    board->adc1.setNoise(0.001);
+
+    /* spread the stationary drives over the encoder range */
+    for (unsigned idrive=1; idrive<6; idrive++)
+        board->drives.setPosition(idrive, 30.0 * idrive);
+
+    StepThread stepper;
+    stepper.cbc     = &cbc;
+    stepper.ncycle  = ncycle;
+    stepper.nsteps  = nsteps;
+    stepper.done    = false;
+    stepper.elapsed = 0;
+
+    ReadThread reader;
+    reader.cbc       = &cbc;
+    reader.stepper   = &stepper;
+    reader.nsamples  = nsamples;
+    reader.tolerance = 0.01;
+    reader.nread     = 0;
+    reader.nbad      = 0;
+    reader.nerror    = 0;
+    reader.maxerror  = 0;
+    for (unsigned idrive=0; idrive<6; idrive++)
+        reader.expected[idrive] = board->drives.encoderVoltage(*board, idrive);
+
+    double   position = board->drives.getPosition(0);
+    uint64_t pulses   = board->drives.getSteps(0);
+
+    std::thread step (stepDrive,    &stepper);
+    std::thread read (readEncoders, &reader);
+    step.join();
+    read.join();
+
+    uint64_t expectedPulses = uint64_t(2) * ncycle * nsteps * cbc.driver.getMicrosteps();
+    pulses = board->drives.getSteps(0) - pulses;
+
+    bool ok = (pulses == expectedPulses)
+           && (board->drives.getIgnoredSteps(0) == 0)
+           && (board->drives.getPosition(0) == position)
+           && (reader.nread > 0) && (reader.nbad == 0) && (reader.nerror == 0);
+
+    printf("cycles               %d (%d steps each way, %d samples per read)\n", ncycle, nsteps, nsamples);
+    printf("stepping    [ms]     %10.2f\n", stepper.elapsed / 1e6);
+    printf("pulses               %10llu of %llu, %llu ignored\n",
+            (unsigned long long) pulses, (unsigned long long) expectedPulses,
+            (unsigned long long) board->drives.getIgnoredSteps(0));
+    printf("position    [steps]  %10.3f (started at %.3f)\n", board->drives.getPosition(0), position);
+    printf("reads                %10u, %u out of tolerance, %u SPI errors\n", reader.nread, reader.nbad, reader.nerror);
+    printf("max error   [V]      %10.4f\n", reader.maxerror);
+    printf("%s\n", ok ? "PASS" : "FAIL");
+
+    return ok ? 0 : 1;
+}
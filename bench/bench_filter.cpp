@@ -0,0 +1,128 @@
+/*
+ * bench_filter - samples needed against achieved precision, for the plain
+ * mean and the ADCFilter pipeline.
+ *
+ * Usage: bench_filter [recording]
+ *
+ * The recording holds raw ADC samples in counts, one per line, taken from a
+ * constant input. Without one, a synthetic recording with white noise,
+ * occasional spikes and mains pickup is generated. The reference value is the
+ * median of the whole recording; for each sample count the recording is cut
+ * into windows and the RMS error of each estimator over the windows is
+ * reported, along with the equivalent resolution in bits.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <ADCFilter.hpp>
+#include <TLC3548_ADC.hpp>
+
+static std::vector<uint32_t> synthesize(unsigned n)
+{
+    std::mt19937 rng(12345);
+    std::normal_distribution<double>  noise(0.0, 4.0);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+    std::vector<uint32_t> samples(n);
+    for (unsigned i=0; i<n; i++) {
+        double v = 8000.37 + noise(rng) + 3.0*sin(2*M_PI*i/733.0);
+        if (uniform(rng) < 0.01)
+            v += (uniform(rng) < 0.5 ? -1 : 1) * 500;
+        samples[i] = static_cast<uint32_t>(lround(v));
+    }
+    return samples;
+}
+
+static std::vector<uint32_t> load(const char* filename)
+{
+    std::vector<uint32_t> samples;
+    FILE* f = fopen(filename, "r");
+    if (!f) {
+        perror(filename);
+        exit(EXIT_FAILURE);
+    }
+    unsigned long v;
+    while (fscanf(f, "%lu", &v) == 1)
+        samples.push_back(v);
+    fclose(f);
+    return samples;
+}
+
+static double filteredEstimate(ADCFilter& filter, const uint32_t* samples, int n, std::vector<float>& out)
+{
+    filter.reset();
+    int nout    = filter.filter(samples, n, out.data());
+    int nsettle = std::min(filter.settling(), nout-1);
+    double sum = 0;
+    for (int i=nsettle; i<nout; i++)
+        sum += out[i];
+    return sum / (nout-nsettle);
+}
+
+static double bits(double rms)
+{
+    return log2(TLC3548::fullScaleUSB() / (sqrt(12.0) * rms));
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<uint32_t> samples = (argc > 1) ? load(argv[1]) : synthesize(1<<20);
+    if (samples.size() < 64) {
+        fprintf(stderr, "bench_filter: recording too short\n");
+        return (EXIT_FAILURE);
+    }
+
+    std::vector<uint32_t> sorted(samples);
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size()/2, sorted.end());
+    double reference = sorted[sorted.size()/2];
+    if (argc == 1)
+        reference = 8000.37;
+
+    CBC::ADC::filterConfig config;
+    config.median     = 3;
+    config.decimation = 16;
+    config.cicOrder   = 1;
+    config.firTaps    = 8;
+    config.firCutoff  = 0.25;
+    ADCFilter filter(config);
+
+    printf("# %zu samples, reference %.3f counts\n", samples.size(), reference);
+    printf("# %8s %8s %12s %8s %12s %8s %12s\n", "nsamples", "windows", "mean_rms", "bits", "filter_rms", "bits", "filter_ns/s");
+
+    for (unsigned n=64; n<=16384 && n<=samples.size(); n*=2) {
+        unsigned nwindows = std::min<size_t>(samples.size()/n, 2000);
+        std::vector<float> out(n / filter.decimation() + 1);
+
+        double errmean=0, errfilt=0;
+        struct timespec t0, t1;
+        double filter_ns = 0;
+
+        for (unsigned w=0; w<nwindows; w++) {
+            const uint32_t* window = &samples[w*n];
+
+            double sum = 0;
+            for (unsigned i=0; i<n; i++)
+                sum += window[i];
+            double e = sum/n - reference;
+            errmean += e*e;
+
+            clock_gettime(CLOCK_MONOTONIC, &t0);
+            e = filteredEstimate(filter, window, n, out) - reference;
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+            filter_ns += (t1.tv_sec - t0.tv_sec)*1e9 + (t1.tv_nsec - t0.tv_nsec);
+            errfilt += e*e;
+        }
+
+        double rmsmean = sqrt(errmean/nwindows);
+        double rmsfilt = sqrt(errfilt/nwindows);
+        printf("  %8u %8u %12.4f %8.2f %12.4f %8.2f %12.2f\n", n, nwindows,
+                rmsmean, bits(rmsmean), rmsfilt, bits(rmsfilt), filter_ns/(double(nwindows)*n));
+    }
+
+    return (EXIT_SUCCESS);
+}
@@ -0,0 +1,86 @@
+/*
+ * bench_move_read - End-to-end move-and-read cycles through the CBC API on
+ * the simulated board (HW_SIMULATED): each cycle steps an actuator and reads
+ * back its encoder, which the simulated A3977 and TLC3548 derive from the
+ * step pulses the library produced. Delays run on a virtual clock, so the
+ * wall time is the CPU cost of the cycle and the board time is what the
+ * cycle would take on the hardware. Runs on any Linux machine.
+ *
+ * Usage: bench_move_read [cycles] [steps per cycle] [samples per read]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <cbc.hpp>
+#include <MirrorControlBoard.hpp>
+#include <SimulatedPeripherals.hpp>
+
+static double nanos()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+int main(int argc, char** argv)
+{
+    int ncycle   = (argc > 1) ? atoi(argv[1]) : 200;
+    int nsteps   = (argc > 2) ? atoi(argv[2]) : 10;
+    int nsamples = (argc > 3) ? atoi(argv[3]) : 100;
+
+    CBC::Config config;
+    config.hardwareBackend   = CBC::HW_SIMULATED;
+    config.virtualTime       = true;
+    config.steppingFrequency = 400;
+    config.driveEnable       = 0x1;
+    config.defaultADCSamples = nsamples;
+
+    CBC cbc(config);
+
+    /* RESET comes out of power up low; the drivers ignore steps until released */
+    cbc.driver.reset();
+
+    SimulatedBoard* board = cbc.board().simulatedBoard();
+    board->adc0.setNoise(0.001);
+
+    uint64_t tboard   = cbc.board().monotonicNanos();
+    double   tstep    = 0;
+    double   tread    = 0;
+    double   maxerror = 0;
+    uint64_t accesses = board->getAccesses();
+
+    for (int icycle=0; icycle<ncycle; icycle++) {
+        /* back and forth, so the encoder stays clear of its wrap */
+        int move = (icycle % 2) ? -nsteps : nsteps;
+
+        double t0 = nanos();
+        cbc.driver.step(1, move);
+        double t1 = nanos();
+        CBC::ADC::adcData data = cbc.adc.readEncoder(1, nsamples);
+        double t2 = nanos();
+
+        tstep += t1 - t0;
+        tread += t2 - t1;
+
+        double expected = board->drives.encoderVoltage(*board, 0);
+        if (fabs(data.voltage - expected) > maxerror)
+            maxerror = fabs(data.voltage - expected);
+    }
+
+    accesses = board->getAccesses() - accesses;
+    tboard   = cbc.board().monotonicNanos() - tboard;
+
+    printf("cycles               %d (%d steps, %d samples each)\n", ncycle, nsteps, nsamples);
+    printf("step        [us]     %10.2f per cycle\n", tstep / ncycle / 1e3);
+    printf("read        [us]     %10.2f per cycle\n", tread / ncycle / 1e3);
+    printf("board time  [ms]     %10.2f per cycle\n", tboard / double(ncycle) / 1e6);
+    printf("registers            %10.1f accesses per cycle\n", double(accesses) / ncycle);
+    printf("pulses               %10llu moved, %llu ignored\n",
+            (unsigned long long) board->drives.getSteps(0), (unsigned long long) board->drives.getIgnoredSteps(0));
+    printf("position    [steps]  %10.3f\n", board->drives.getPosition(0));
+    printf("max error   [V]      %10.4f\n", maxerror);
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * bench_spidev - system calls and CPU time per sample of the spidev backend,
+ * submitting one word per ioctl (as SpiInterface used to) and whole batches
+ * of SPI_IOC_MESSAGE(N). The device is a loopback stand-in, so no spidev node
+ * is needed; the times are the user-space cost of the transport alone.
+ *
+ * Usage: bench_spidev [nsamples]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+#include <SpiInterface.hpp>
+
+/* Loopback stand-in: every word is read back as sent, and each message
+ * counts as one system call */
+class LoopbackSpi : public SpiInterface
+{
+    public:
+        LoopbackSpi(unsigned maxBatch) : SpiInterface(-1, 24000000), nsyscalls(0)
+        {
+            if (maxBatch < m_maxBatch)
+                m_maxBatch = maxBatch;
+        }
+
+        unsigned long nsyscalls;
+
+    protected:
+        int submit(struct spi_ioc_transfer* transfers, unsigned n)
+        {
+            nsyscalls++;
+            for (unsigned i=0; i<n; i++)
+                memcpy((void*) (unsigned long) transfers[i].rx_buf,
+                       (const void*) (unsigned long) transfers[i].tx_buf, transfers[i].len);
+            return 0;
+        }
+};
+
+static double nowSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+int main(int argc, char** argv)
+{
+    unsigned nsamples = (argc > 1) ? atoi(argv[1]) : 1000;
+    if (nsamples == 0) {
+        fprintf(stderr, "Usage: %s [nsamples]\n", argv[0]);
+        return (EXIT_FAILURE);
+    }
+
+    /* an acquisition plan as built by MirrorControlBoard: burn word,
+     * nsamples selects and a FIFO read */
+    unsigned nwords = nsamples + 2;
+    std::vector<uint16_t> tx (nwords), rx (nwords);
+    for (unsigned i=0; i<nwords; i++)
+        tx[i] = i;
+
+    const unsigned batches[] = {1, 16, 64, 511};
+    const int      nrepeat   = 200;
+
+    printf("# %u samples per acquisition, %d acquisitions\n", nsamples, nrepeat);
+    printf("# %8s %14s %14s\n", "maxbatch", "syscalls/smp", "ns/sample");
+
+    for (unsigned ib=0; ib<sizeof(batches)/sizeof(batches[0]); ib++) {
+        LoopbackSpi spi (batches[ib]);
+
+        double start = nowSeconds();
+        for (int r=0; r<nrepeat; r++)
+            spi.transfer(tx.data(), rx.data(), nwords);
+        double elapsed = nowSeconds() - start;
+
+        if (memcmp(tx.data(), rx.data(), nwords*sizeof(uint16_t))) {
+            fprintf(stderr, "bench_spidev: loopback mismatch\n");
+            return (EXIT_FAILURE);
+        }
+
+        printf("  %8u %14.4f %14.2f\n", spi.getMaxBatch(),
+                double(spi.nsyscalls) / (double(nsamples) * nrepeat),
+                1e9 * elapsed / (double(nsamples) * nrepeat));
+    }
+
+    return (EXIT_SUCCESS);
+}
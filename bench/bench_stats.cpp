@@ -0,0 +1,89 @@
+/*
+ * bench_stats - CPU cost of turning accumulated ADC sums into statistics,
+ * for the double precision path and the fixed-point path (c.f.
+ * CBC::ADC::setFixedPoint). Run it on the board to choose between them.
+ *
+ * Usage: bench_stats [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <random>
+#include <ADCStatistics.hpp>
+#include <TLC3548_ADC.hpp>
+
+static double nanos()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+int main(int argc, char** argv)
+{
+    int niter = (argc > 1) ? atoi(argv[1]) : 1000000;
+    const int nsamples = 1000;
+
+    /* A pool of realistic sums */
+    const int npool = 1024;
+    std::vector<MirrorControlBoard::ADCStat> pool(npool);
+    std::mt19937 rng(1);
+    std::normal_distribution<double> noise(0.0, 3.0);
+    for (int i=0; i<npool; i++) {
+        double center = 1000 + (rng() % 14000);
+        MirrorControlBoard::ADCStat& stat = pool[i];
+        stat.sum = 0; stat.sumsq = 0; stat.min = ~0u; stat.max = 0;
+        for (int k=0; k<nsamples; k++) {
+            uint32_t v = static_cast<uint32_t>(lround(center + noise(rng)));
+            stat.sum   += v;
+            stat.sumsq += static_cast<uint64_t>(v)*v;
+            if (v < stat.min) stat.min = v;
+            if (v > stat.max) stat.max = v;
+        }
+    }
+
+    CBC::ADC::adcData      data;
+    CBC::ADC::adcDataFixed fixed;
+    memset(&data, 0, sizeof(data));
+    volatile float  sinkf = 0;
+    volatile uint32_t sinki = 0;
+
+    double t0 = nanos();
+    for (int i=0; i<niter; i++) {
+        ADCStatistics::floatStat(pool[i & (npool-1)], nsamples, 1, 0, data);
+        sinkf = sinkf + data.voltage;
+    }
+    double t1 = nanos();
+    for (int i=0; i<niter; i++) {
+        ADCStatistics::toVolts(ADCStatistics::fixedStat(pool[i & (npool-1)], nsamples), 1, 0, data);
+        sinkf = sinkf + data.voltage;
+    }
+    double t2 = nanos();
+    for (int i=0; i<niter; i++) {
+        fixed = ADCStatistics::fixedStat(pool[i & (npool-1)], nsamples);
+        sinki = sinki + fixed.mean;
+    }
+    double t3 = nanos();
+
+    /* Agreement of the two paths, against an exact double computation */
+    double maxerr_float = 0, maxerr_fixed = 0;
+    for (int i=0; i<npool; i++) {
+        double exact = 5.0 * pool[i].sum / (double(nsamples) * TLC3548::fullScaleUSB());
+        ADCStatistics::floatStat(pool[i], nsamples, 1, 0, data);
+        maxerr_float = fmax(maxerr_float, fabs(data.voltage - exact));
+        ADCStatistics::toVolts(ADCStatistics::fixedStat(pool[i], nsamples), 1, 0, data);
+        maxerr_fixed = fmax(maxerr_fixed, fabs(data.voltage - exact));
+    }
+
+    printf("# %d measurements of %d samples\n", niter, nsamples);
+    printf("# %-14s %12s %14s\n", "path", "ns/measure", "max_err_volts");
+    printf("  %-14s %12.2f %14.3g\n", "float",        (t1-t0)/niter, maxerr_float);
+    printf("  %-14s %12.2f %14.3g\n", "fixed+volts",  (t2-t1)/niter, maxerr_fixed);
+    printf("  %-14s %12.2f %14s\n",   "fixed",        (t3-t2)/niter, "-");
+
+    return (EXIT_SUCCESS);
+}
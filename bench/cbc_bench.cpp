@@ -0,0 +1,309 @@
+/*
+ * cbc_bench - Throughput and latency of the library's hot paths, written to a
+ * JSON file so that releases can be compared:
+ *
+ *   gpio_write, gpio_read      GPIO accesses per second
+ *   step                       stepOneDrive rate achieved, and its jitter
+ *   spi_writeread              mcspiInterface::WriteRead words per second
+ *   spi_burst                  mcspiInterface::WriteReadBurst words per second
+ *   spi_burst_mismatches       burst words which differ from the TLC3548 model,
+ *                              at the fastest clock whose frames span a
+ *                              conversion (simulated board only)
+ *   spi_burst_fast_mismatches  the same at the configured clock, where frames
+ *                              come back to back faster than the TLC3548
+ *                              converts: the model must catch these
+ *   adc_stat                   measureADCStat samples per second
+ *   adc_mismatches             samples of acquisitions at the configured clock
+ *                              and no read delay which differ from the model
+ *   read_encoder               CBC::ADC::readEncoder latency
+ *   startup                    CBC constructor time
+ *   metrics_count, metrics_timer  cost of a telemetry counter and timed event
+ *
+ * Usage: cbc_bench [--hardware] [--quick] [--output file]
+ *
+ * Runs on the simulated board unless --hardware is given. On the hardware the
+ * step benchmark moves drive 1 back and forth by the same number of steps.
+ * --quick cuts the iteration counts by ten. The results go to cbc_bench.json
+ * unless another file is named.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cbc.hpp>
+#include <MirrorControlBoard.hpp>
+#include <SimulatedPeripherals.hpp>
+#include <RegisterBackend.hpp>
+#include <mcspiInterface.hpp>
+#include <TLC3548_ADC.hpp>
+#include <Metrics.hpp>
+
+static double nanos()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+struct Result {
+    std::string name;
+    std::string unit;
+    double      value;
+};
+
+static std::vector<Result> results;
+
+static void report(const char* name, double value, const char* unit)
+{
+    Result result;
+    result.name  = name;
+    result.unit  = unit;
+    result.value = value;
+    results.push_back(result);
+
+    printf("%-28s %14.3f %s\n", name, value, unit);
+}
+
+/* Mean, standard deviation and 99th percentile of a set of durations */
+static void reportDistribution(const char* name, std::vector<double> values, double scale, const char* unit)
+{
+    double sum = 0, sumsq = 0;
+    for (unsigned i=0; i<values.size(); i++) {
+        sum   += values[i];
+        sumsq += values[i]*values[i];
+    }
+    double mean = sum / values.size();
+    double var  = sumsq / values.size() - mean*mean;
+
+    std::sort(values.begin(), values.end());
+    double p99 = values[(values.size()*99)/100];
+    double max = values.back();
+
+    std::string base = name;
+    report((base + "_mean").c_str(),   mean / scale,                   unit);
+    report((base + "_stddev").c_str(), sqrt(var > 0 ? var : 0) / scale, unit);
+    report((base + "_p99").c_str(),    p99 / scale,                    unit);
+    report((base + "_max").c_str(),    max / scale,                    unit);
+}
+
+/* Words of FIFO bursts of various lengths at the given SPI clock which read
+ * back other than the expected code of the channel selected before them */
+static unsigned burstMismatches(mcspiInterface* spi, unsigned clock, const uint32_t code[4], const uint32_t expected[4])
+{
+    const unsigned lengths[] = {2, 3, 7, 8, 9, 15, 16, 17, 25, 100, 1001};
+    const unsigned nlength   = sizeof(lengths)/sizeof(lengths[0]);
+
+    spi->setClockRate(clock);
+
+    unsigned mismatches = 0;
+    for (unsigned ilength=0; ilength<nlength; ilength++) {
+        unsigned n = lengths[ilength];
+        std::vector<uint16_t> tx (n), rx (n);
+        for (unsigned i=0; i<n; i++)
+            tx[i] = code[(i*3 + ilength) % 4];
+
+        spi->WriteReadBurst(tx.data(), rx.data(), n);
+        for (unsigned i=1; i<n; i++)
+            if (TLC3548::decodeUSB(rx[i]) != expected[((i-1)*3 + ilength) % 4])
+                mismatches++;
+    }
+    return mismatches;
+}
+
+static bool writeJSON(const char* path, bool hardware)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) {
+        perror(path);
+        return false;
+    }
+
+    char date[32];
+    time_t now = time(NULL);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"backend\": \"%s\",\n", hardware ? "hardware" : "simulated");
+    fprintf(file, "  \"date\": \"%s\",\n", date);
+    fprintf(file, "  \"results\": [\n");
+    for (unsigned i=0; i<results.size(); i++)
+        fprintf(file, "    {\"name\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}%s\n",
+                results[i].name.c_str(), results[i].value, results[i].unit.c_str(),
+                (i+1 < results.size()) ? "," : "");
+    fprintf(file, "  ]\n");
+    fprintf(file, "}\n");
+
+    fclose(file);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    bool        hardware = false;
+    int         scale    = 1;
+    const char* output   = "cbc_bench.json";
+
+    for (int i=1; i<argc; i++) {
+        if (!strcmp(argv[i], "--hardware"))
+            hardware = true;
+        else if (!strcmp(argv[i], "--quick"))
+            scale = 10;
+        else if (!strcmp(argv[i], "--output") && i+1 < argc)
+            output = argv[++i];
+        else {
+            fprintf(stderr, "Usage: %s [--hardware] [--quick] [--output file]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    CBC::Config config;
+    config.hardwareBackend   = hardware ? CBC::HW_DEVMEM : CBC::HW_SIMULATED;
+    config.driveEnable       = 0x1;
+    config.delayTime         = 0;
+    config.defaultADCSamples = 100;
+
+    /* Startup */
+    double t0 = nanos();
+    CBC* cbc = new CBC(config);
+    report("startup", (nanos() - t0) / 1e6, "ms");
+
+    MirrorControlBoard& board = cbc->board();
+    cbc->driver.reset();
+
+    /* GPIO */
+    int ngpio = 1000000 / scale;
+
+    t0 = nanos();
+    for (int i=0; i<ngpio; i++)
+        board.enableDriveHiCurrent(i & 0x1);
+    report("gpio_write", ngpio / ((nanos() - t0) / 1e9), "ops/s");
+    board.disableDriveHiCurrent();
+
+    t0 = nanos();
+    unsigned nset = 0;
+    for (int i=0; i<ngpio; i++)
+        nset += board.isDriveHiCurrentEnabled();
+    report("gpio_read", ngpio / ((nanos() - t0) / 1e9), "ops/s");
+
+    /* Stepping, half the pulses out and half back */
+    int      nstep     = 4000 / scale;
+    unsigned frequency = 4000;
+    std::vector<double> period (nstep);
+
+    t0 = nanos();
+    double last = t0;
+    for (int i=0; i<nstep; i++) {
+        MirrorControlBoard::Dir dir = (i < nstep/2) ? MirrorControlBoard::DIR_EXTEND : MirrorControlBoard::DIR_RETRACT;
+        board.stepOneDrive(0, dir, frequency);
+        double now = nanos();
+        period[i]  = now - last;
+        last       = now;
+    }
+    report("step_rate", nstep / ((last - t0) / 1e9), "Hz");
+    report("step_rate_target", frequency, "Hz");
+    for (int i=0; i<nstep; i++)
+        period[i] = fabs(period[i] - 1e9/frequency);
+    reportDistribution("step_jitter", period, 1e3, "us");
+
+    /* ADC statistics */
+    int nsamples = 1000;
+    int nstat    = 1000 / scale;
+    uint32_t min, max;
+    uint64_t sum, sumsq;
+
+    t0 = nanos();
+    for (int i=0; i<nstat; i++)
+        board.measureADCStat(0, 6, nsamples, sum, sumsq, min, max);
+    report("adc_stat", double(nstat) * nsamples / ((nanos() - t0) / 1e9), "samples/s");
+
+    /* channel 7 and the REFP, mid-scale and REFM references, with their codes */
+    const uint32_t code     [4] = {TLC3548::codeSelect(7), TLC3548::codeSelect(8), TLC3548::codeSelect(9), TLC3548::codeSelect(10)};
+    const uint32_t expected [4] = {uint32_t(lround(1.25/5.0 * TLC3548::fullScaleUSB())), TLC3548::fullScaleUSB(),
+                                   uint32_t(lround(0.5 * TLC3548::fullScaleUSB())), 0};
+
+    if (!hardware) {
+        board.simulatedBoard()->adc0.setVoltage(7, 1.25);
+        board.simulatedBoard()->adc0.setNoise(0);
+
+        /* Acquisitions pace their frames by the conversion time themselves */
+        std::vector<uint32_t> samples (4 * nsamples);
+        unsigned mismatches = 0;
+        for (int i=0; i<nstat/10; i++) {
+            board.readADCSamplesMulti(0, 7, 4, nsamples, samples.data());
+            for (unsigned j=0; j<samples.size(); j++)
+                if (samples[j] != expected[j / nsamples])
+                    mismatches++;
+        }
+        report("adc_mismatches", mismatches, "");
+    }
+
+    /* Encoder readout */
+    int nread = 2000 / scale;
+    std::vector<double> latency (nread);
+    for (int i=0; i<nread; i++) {
+        t0 = nanos();
+        cbc->adc.readEncoder(1, config.defaultADCSamples);
+        latency[i] = nanos() - t0;
+    }
+    reportDistribution("read_encoder", latency, 1e3, "us");
+
+    /* Telemetry, on a histogram of its own making; the counts are reset after */
+    int nevent = 10000000 / scale;
+
+    t0 = nanos();
+    for (int i=0; i<nevent; i++)
+        Metrics::count(Metrics::SPI_WORDS);
+    report("metrics_count", (nanos() - t0) / nevent, "ns");
+
+    t0 = nanos();
+    for (int i=0; i<nevent; i++)
+        Metrics::Timer timer(Metrics::LATENCY_SPI_WORD);
+    report("metrics_timer", (nanos() - t0) / nevent, "ns");
+    cbc->resetMetrics();
+
+    /* SPI words, on a controller of our own; last, as it resets MCSPI1 under the library */
+    RegisterBackend* registers = hardware ? static_cast<RegisterBackend*>(new DevMemBackend()) : NULL;
+    mcspiInterface*  spi       = new mcspiInterface(hardware ? *registers : *board.simulatedBoard());
+    spi->setClockRate(config.spiClockRate);
+    board.selectADC(0);
+
+    int nword = 1000000 / scale;
+    t0 = nanos();
+    for (int i=0; i<nword; i++)
+        spi->WriteRead(TLC3548::codeSelect(i % 8));
+    report("spi_writeread", nword / ((nanos() - t0) / 1e9), "words/s");
+    report("spi_errors", spi->getError(), "");
+
+    /* FIFO bursts, of lengths around the 8-word FIFO chunk; each word reads
+     * back the conversion selected by the word before. Back to back, that
+     * takes frames of at least a conversion time, i.e. a slow clock. */
+    unsigned slowClock = 16 * 1000000000ULL / TLC3548::framePeriodNanos();
+    unsigned mismatches     = burstMismatches(spi, slowClock, code, expected);
+    unsigned fastMismatches = burstMismatches(spi, config.spiClockRate, code, expected);
+
+    std::vector<uint16_t> tx (1000), rx (1000);
+    for (unsigned i=0; i<tx.size(); i++)
+        tx[i] = code[i % 4];
+
+    int nburst = 1000 / scale;
+    t0 = nanos();
+    for (int i=0; i<nburst; i++)
+        spi->WriteReadBurst(tx.data(), rx.data(), tx.size());
+    report("spi_burst", nburst * tx.size() / ((nanos() - t0) / 1e9), "words/s");
+    if (!hardware) {
+        report("spi_burst_mismatches", mismatches, "");
+        report("spi_burst_fast_mismatches", fastMismatches, "");
+    }
+    report("spi_burst_errors", spi->getError(), "");
+
+    delete spi;
+    delete registers;
+    delete cbc;
+
+    return writeJSON(output, hardware) ? 0 : 1;
+}
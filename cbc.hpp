@@ -2,6 +2,16 @@
 #define CBC_H
 
 #include <vector>
+#include <string>
+#include <array>
+#include <mutex>
+#include <stdint.h>
+
+class MirrorControlBoard;
+class VirtualClock;
+class StatusPage;
+class MeasurementScheduler;
+class OperationScheduler;
 
 /*!
  * The CBC class is responsible for the control of all mirror control board functions.
@@ -22,6 +32,24 @@ class CBC
          * parameters.
          */
 
+        /*! Backends through which the ADCs can be read */
+        enum SpiBackend {
+            /*! MCSPI controller registers, mapped from /dev/mem */
+            SPI_MCSPI     = 0,
+            /*! Kernel spidev driver, for systems where /dev/mem is not available */
+            SPI_SPIDEV    = 1,
+            /*! In-memory stand-in, for running without hardware */
+            SPI_SIMULATED = 2
+        };
+
+        /*! Where the GPIO and MCSPI registers live */
+        enum HardwareBackend {
+            /*! The board's registers, mapped from /dev/mem */
+            HW_DEVMEM    = 0,
+            /*! A register-level simulation of the board, for running on any Linux machine */
+            HW_SIMULATED = 1
+        };
+
         struct Config
         {
             int  steppingFrequency ;
@@ -29,10 +57,26 @@ class CBC
             bool driveSR           ;
             int  adcReadDelay      ;
             int  defaultADCSamples ;
+            int  adcCalibrationInterval ;
+            bool adcFixedPoint     ;
+            bool adcCoalescing     ;
+            int  adcCoalescingMaxAge ;
+            int  spiClockRate      ;
+            int  spiClockGranularity ;
+            int  spiChipSelectTime ;
+            int  spiTimeout        ;
+            int  spiRetryLimit     ;
+            SpiBackend  spiBackend ;
+            std::string spiDevice  ;
+            HardwareBackend hardwareBackend ;
+            bool virtualTime       ;
             int  usbEnable         ;
             int  driveEnable       ;
             int  microsteps        ;
             int  delayTime         ;
+            std::string statusPage ;
+            int  safetyWaitLimit   ;
+            bool warmStart         ;
 
             std::vector<float>  encoderVoltageSlope      = {0,0,0,0,0,0};
             std::vector<float>  encoderVoltageOffset     = {0,0,0,0,0,0};
@@ -45,8 +89,21 @@ class CBC
              * @param steppingFrequency               Stepping frequency [in Hertz]
              * @param highCurrentMode                 Stepper motor High Current Mode [true/false]
              * @param driveSR                         Drive synchronous rectification mode [true/false]
-             * @param adcReadDelay                    Delay inserted between subsequent ADC reads [any integer]
+             * @param adcReadDelay                    Minimum interval between the start of subsequent ADC reads [nanoseconds, at least the 5000 ns conversion period of the TLC3548]
              * @param defaultADCSamples               Set a global default number of ADC samples. Can be overrode for individual measurements.
+             * @param adcCalibrationInterval          Maximum age of the ADC gain/offset self-calibration before it is re-measured [milliseconds, 0 = disabled]
+             * @param adcFixedPoint                   Compute measurement statistics in fixed point rather than double precision (c.f. ADC::setFixedPoint) [true/false]
+             * @param adcCoalescing                   Concurrent requests for the same measurement (adc, channel, nsamples, read delay) share one acquisition [true/false]
+             * @param adcCoalescingMaxAge             With adcCoalescing, longest a result is reused for after its acquisition [microseconds, 0 = only while it is under way]
+             * @param spiClockRate                    ADC SPI clock rate; the fastest rate available not above it is used [Hertz]
+             * @param spiClockGranularity             SPI clock divider granularity: 0 = powers of two of 48 MHz, 1 = any integer fraction of 48 MHz
+             * @param spiChipSelectTime               Delay between chip select and the first/last SPI clock edge [0-3 SPI clock cycles, plus a half cycle]
+             * @param spiTimeout                      Longest wait for the SPI bus before a measurement is abandoned [microseconds, 0 = wait forever]
+             * @param spiRetryLimit                   Number of times an unanswered SPI word is re-sent before a measurement is abandoned
+             * @param spiBackend                      Backend used to read the ADCs [SPI_MCSPI, SPI_SPIDEV or SPI_SIMULATED]
+             * @param spiDevice                       spidev device node used by the SPI_SPIDEV backend
+             * @param hardwareBackend                 Registers accessed for GPIO and MCSPI [HW_DEVMEM or HW_SIMULATED]
+             * @param virtualTime                     Delays complete at once on a virtual clock instead of waiting, for simulated hardware [true/false]
              * @param usbEnable                       Integer bitmask to enable USB channels according to the simple scheme:
              *                                        <UL>
              *                                        <LI> (0x00) 000000 Disable All
@@ -62,6 +119,9 @@ class CBC
              *                                        of the individual masks. Use a calculator or just put "usbEnable = (0x1 | 0x2 | 0x4)", for example...
              * @param driveEnable                     Integer bitmask to enable encoder drives, working ala usbEnable
              * @param delayTime                       Microseconds delay to pad between stepping, reading encoders, enable/disable motors
+             * @param statusPage                      Name of a POSIX shared-memory segment, e.g. "/cbc_status", in which the board state is published for monitors in other processes (c.f. StatusPage.hpp) [empty = none]
+             * @param safetyWaitLimit                 Longest a safety command (disabling drives, driver sleep, powerDown) waits for other operations to give way [microseconds, 0 = no limit]
+             * @param warmStart                       Read back the board state and change only the settings which differ, e.g. when restarting a control process on a board already set up; the MCSPI controller is kept if set up and the ADCs are not re-initialized [true/false]
              * @param encoderVoltageSlope             C++ std::vector containing 6 floats for correcting the encoder readings (c.f. libcbc.cpp for notes on how the correction is applied)
              * @param encoderVoltageOffset            C++ std::vector containing 6 floats for correcting the encoder readings (c.f. libcbc.cpp for notes on how the correction is applied)
              * @param encoderTemperatureSlope         C++ std::vector containing 6 floats for correcting the encoder readings (c.f. libcbc.cpp for notes on how the correction is applied)
@@ -75,10 +135,26 @@ class CBC
             driveSR                  (true),
             adcReadDelay             (0),
             defaultADCSamples        (1000),
+            adcCalibrationInterval   (0),
+            adcFixedPoint            (false),
+            adcCoalescing            (false),
+            adcCoalescingMaxAge      (0),
+            spiClockRate             (24000000),
+            spiClockGranularity      (0),
+            spiChipSelectTime        (3),
+            spiTimeout               (1000),
+            spiRetryLimit            (100),
+            spiBackend               (SPI_MCSPI),
+            spiDevice                ("/dev/spidev1.0"),
+            hardwareBackend          (HW_DEVMEM),
+            virtualTime              (false),
             usbEnable                (0),
             driveEnable              (0),
             microsteps               (8),
             delayTime                (25000),
+            statusPage               (""),
+            safetyWaitLimit          (10000),
+            warmStart                (false),
             encoderVoltageSlope      {0,0,0,0,0,0},
             encoderVoltageOffset     {0,0,0,0,0,0},
             encoderTemperatureSlope  {0,0,0,0,0,0},
@@ -94,6 +170,9 @@ class CBC
         CBC(struct Config config=CBC::config_default);
         ~CBC();
 
+        CBC(const CBC&) = delete;
+        CBC& operator= (const CBC&) = delete;
+
         /*! Power down CBC
          *
          * Puts the CBC board into a power-down state, decreasing power consumption. Specifically:
@@ -116,6 +195,99 @@ class CBC
          */
         void powerUp();
 
+        /*! The board layer this CBC drives; each CBC owns its own, so several
+         *  simulated boards can run side by side */
+        MirrorControlBoard& board();
+
+        //////////////////////////////////////////////////////////////////////////////
+        ///Library telemetry
+        //////////////////////////////////////////////////////////////////////////////
+
+        /*! Latency distribution of one kind of operation */
+        struct latency {
+            /*! Operations timed */
+            uint64_t count;
+            /*! Mean duration in microseconds */
+            float    mean;
+            /*! Median and 99th percentile in microseconds, as the upper edge of
+             *  their power-of-two bucket, i.e. at most twice the true value */
+            float    median;
+            float    p99;
+            /*! buckets[i] counts operations which took [2^i, 2^(i+1)) nanoseconds */
+            uint64_t buckets[40];
+        };
+
+        /*! Event counts and latencies since the last resetMetrics() */
+        struct metrics {
+            /*! Step pulses issued by Driver::step */
+            uint64_t steps;
+            /*! ADC measurements, and the samples they took */
+            uint64_t adcMeasurements;
+            uint64_t adcSamples;
+            /*! ADC measurements answered with the result of another (c.f. ADC::setCoalescing) */
+            uint64_t adcCoalesced;
+            /*! SPI words transferred */
+            uint64_t spiWords;
+            /*! Delays slept */
+            uint64_t sleeps;
+            /*! powerUp and powerDown sequences */
+            uint64_t powerSequences;
+            /*! Long operations paused for more urgent ones */
+            uint64_t yields;
+            /*! Safety commands which went ahead at the wait limit */
+            uint64_t safetyOverrides;
+
+            /*! Driver::step, per move */
+            latency  step;
+            /*! ADC measurements, including any wait for the SPI bus */
+            latency  measure;
+            /*! Single SPI words, sampled one in 64 */
+            latency  spiWord;
+            /*! Delays, as actually slept */
+            latency  sleep;
+            /*! powerUp and powerDown */
+            latency  power;
+            /*! Wait of safety commands for other operations to give way */
+            latency  safetyWait;
+            /*! Safety commands on the drives (Driver::disable, disableAll and sleep), from call to done */
+            latency  safety;
+        };
+
+        ///@{
+        /*! @name Telemetry
+         *
+         * The library counts and times its operations as they run, at a cost of
+         * tens of nanoseconds per operation. The figures are for the whole
+         * process, i.e. they include all CBC objects and threads.
+         */
+        /*! @brief Returns the counts and latencies since start up or the last resetMetrics() */
+        metrics getMetrics();
+        /*! @brief Restart the counts and latencies from zero */
+        void resetMetrics();
+        /*! @brief Turn the counting on (the default) or off */
+        void enableMetrics(bool enable);
+        ///@}
+
+        ///@{
+        /*! @name Operation Scheduling
+         *
+         * When several threads share a CBC, its operations take turns by priority:
+         * safety commands (Driver::disable, disableAll and sleep, and powerDown) before
+         * motion, motion before measurements, and measurements before housekeeping
+         * (power, USB, calibration and configuration). Stepping and measurements still
+         * overlap. A long move or measurement pauses between microsteps, or between
+         * bursts of ADC samples, for a waiting safety command, which thus waits for at
+         * most about one of those; past the safety wait limit it goes ahead regardless.
+         * Waits are reported in metrics::safetyWait, and the whole of each command on the
+         * drives in metrics::safety; disableAll disables all six drives under one turn.
+         */
+        /*! @brief Sets the safety wait limit.
+         *  @param limit Longest wait of a safety command, in microseconds (0 = no limit) */
+        void setSafetyWaitLimit(int limit);
+        /*! @brief Returns the safety wait limit, in microseconds */
+        int  getSafetyWaitLimit();
+        ///@}
+
         //////////////////////////////////////////////////////////////////////////////
         ///USB Control
         //////////////////////////////////////////////////////////////////////////////
@@ -342,6 +514,18 @@ class CBC
 
         struct ADC {
             public:
+                /*! Outcome of an ADC measurement, reported in adcData::status */
+                enum Status {
+                    /*! Measurement completed */
+                    STATUS_OK          = 0,
+                    /*! The SPI bus did not respond within the timeout; the data is incomplete */
+                    STATUS_SPI_TIMEOUT = 1,
+                    /*! The ADC stopped answering after the maximum number of retries; the data is incomplete */
+                    STATUS_SPI_STALL   = 2,
+                    /*! The spidev driver rejected a transfer; the data is incomplete */
+                    STATUS_SPI_IO      = 3
+                };
+
                 //////////////////////////////////////////////////////////////////////////////
                 ///Structure to hold statistical data from ADC measurements
                 //////////////////////////////////////////////////////////////////////////////
@@ -363,6 +547,70 @@ class CBC
                     float rawVoltageMin;
                     /*! Uncorrected voltage Max reading */
                     float rawVoltageMax;
+
+                    /*! Achieved sample rate of the measurement, in samples per second */
+                    float sampleRate;
+                    /*! Time spent acquiring the samples, in seconds */
+                    float acquisitionTime;
+
+                    /*! STATUS_OK, or the Status of a failed measurement */
+                    int status;
+                };
+
+                //////////////////////////////////////////////////////////////////////////////
+                ///Statistical data from ADC measurements, in integer ADC counts
+                //////////////////////////////////////////////////////////////////////////////
+                /*! Fixed-point counterpart of adcData for callers which stay in ADC counts.
+                 *  Fields marked Q16 hold counts scaled by 2^16, i.e. 16 fractional bits. */
+                struct adcDataFixed {
+                    /*! Averaged reading [counts, Q16] */
+                    uint32_t mean;
+                    /*! Standard deviation [counts, Q16] */
+                    uint32_t stddev;
+                    /*! Minimum reading [counts] */
+                    uint32_t min;
+                    /*! Maximum reading [counts] */
+                    uint32_t max;
+                    /*! Defined as stddev / sqrt(N) [counts, Q16] */
+                    uint32_t error;
+                    /*! Number of samples */
+                    uint32_t nsamples;
+                    /*! STATUS_OK, or the Status of a failed measurement */
+                    int      status;
+                };
+
+                //////////////////////////////////////////////////////////////////////////////
+                ///SPI bus counters, for monitoring the health of the bus
+                //////////////////////////////////////////////////////////////////////////////
+                struct spiStats {
+                    /*! Words transferred */
+                    uint64_t words;
+                    /*! Status register reads spent waiting on the bus */
+                    uint64_t polls;
+                    /*! Words re-sent after the ADC failed to answer */
+                    uint64_t retries;
+                    /*! Words which needed at least one retry */
+                    uint64_t stalls;
+                    /*! Waits abandoned after the timeout */
+                    uint64_t timeouts;
+                    /*! Average status register reads per word */
+                    float    pollsPerWord;
+                };
+
+                //////////////////////////////////////////////////////////////////////////////
+                ///Configuration of the oversampling filter used by measureFiltered
+                //////////////////////////////////////////////////////////////////////////////
+                struct filterConfig {
+                    /*! Running median pre-filter window: 3, 5, or 0 to disable */
+                    int   median;
+                    /*! CIC decimation ratio R (1 = no decimation) */
+                    int   decimation;
+                    /*! Number of CIC stages N (1 = boxcar average over R samples) */
+                    int   cicOrder;
+                    /*! Length of the FIR low-pass at the decimated rate (0 = disabled) */
+                    int   firTaps;
+                    /*! FIR cutoff frequency, as a fraction of the decimated sample rate (0-0.5) */
+                    float firCutoff;
                 };
 
                 ///@{
@@ -393,6 +641,32 @@ class CBC
                  *  @param nsamples Number of samples to take.
                  */
                 adcData measure(int adc, int channel, int nsamples);
+
+                /*! @brief Measure from ADC channel, returning the statistics in integer ADC counts.
+                 *
+                 *  Uses only integer arithmetic, and does not apply the ADC self-calibration.
+                 *  @param adc Select ADC 0 or 1
+                 *  @param channel Measure from ADC channel 0-11
+                 *  @param nsamples Number of samples to take.
+                 */
+                adcDataFixed measureFixed(int adc, int channel, int nsamples);
+
+                /*! @brief Measure from ADC channel through the oversampling filter (c.f. setFilter).
+                 *
+                 *  The raw samples are passed through the filter pipeline, and the statistics are
+                 *  taken over the settled filter outputs rather than the raw samples, so stddev
+                 *  describes the noise after filtering. voltageError allows for the correlation
+                 *  between successive outputs.
+                 *  @param adc Select ADC 0 or 1
+                 *  @param channel Measure from ADC channel 0-11
+                 *  @param nsamples Number of raw samples to take.
+                 */
+                adcData measureFiltered(int adc, int channel, int nsamples);
+
+                /*! @brief Set the filter pipeline used by measureFiltered */
+                void setFilter(const filterConfig& filter);
+                /*! @brief Returns the filter pipeline used by measureFiltered */
+                filterConfig getFilter();
                 ///@}
 
                 ///@{
@@ -409,6 +683,17 @@ class CBC
                  */
                 adcData readEncoder (int iencoder, int nsamples);
                 float readEncoderVoltage (int iencoder);
+
+                /*! @brief Read all six encoders with global default number of ADC samples. */
+                std::array<adcData,6> readAllEncoders ();
+                /*! @brief Read all six encoders with specified number of ADC samples.
+                 *
+                 *  Equivalent to calling readEncoder for encoders 1-6, but the delay, ADC
+                 *  initialization and temperature measurement are shared, and the encoder and
+                 *  temperature channels are sampled in one interleaved acquisition.
+                 *  @param nsamples Number of ADC Samples to average per encoder
+                 *  @return Readings of encoders 1-6, at indices 0-5 */
+                std::array<adcData,6> readAllEncoders (int nsamples);
                 ///@}
 
 
@@ -460,14 +745,118 @@ class CBC
                 ///@{
                 /*! @name ADC Read Delay
                  *
-                 *  Controls a delay which is inserted between successive ADC reads, to slow down
-                 *  measurement.
+                 *  Controls the minimum interval between the start of successive ADC reads, to slow down
+                 *  measurement. Samples are paced against the monotonic clock, so the resulting sample rate
+                 *  is independent of the CPU and compiler. The achieved rate is reported in adcData::sampleRate.
                  */
-                /*! @brief Returns current ADC read delay. */
+                /*! @brief Returns current ADC read delay, in nanoseconds. */
                 int  getReadDelay();
-                /*! @brief Sets ADC read delay (in uncalibrated for-loop cycles).
-                 *  @param delay Integer delay, counted in "number of for-loop cycles" */
+                /*! @brief Sets ADC read delay.
+                 *  @param delay Interval between successive ADC reads, in nanoseconds (0 = as fast as possible).
+                 *              Reads are never closer than the 5000 ns conversion period of the TLC3548. */
                 void setReadDelay(int delay);
+                /*! @brief Returns the target sample rate in samples per second (0 = as fast as possible). */
+                float getSampleRate();
+                /*! @brief Sets the read delay from a target sample rate.
+                 *  @param rate Target sample rate, in samples per second (0 = as fast as possible).
+                 *              Negative rates, and rates below 1e9/INT_MAX (about 0.47 Hz), are ignored. */
+                void setSampleRate(float rate);
+                ///@}
+
+                ///@{
+                /*! @name ADC Self-Calibration
+                 *
+                 * The gain and offset of each ADC are measured against its internal LOW-, MID- and
+                 * HIGH- point references (channels 8-10), and every subsequent measurement on that
+                 * ADC is corrected accordingly. The correction is applied to the accumulated
+                 * statistics, so it costs nothing per sample.
+                 *
+                 * With a non-zero calibration interval, a measurement re-calibrates its ADC first
+                 * whenever the cached correction is older than the interval.
+                 */
+                /*! @brief Measure the references of an ADC and update its gain/offset correction.
+                 *  @param adc Select ADC 0 or 1 */
+                void calibrate(int adc);
+                /*! @brief Drop the gain/offset correction of both ADCs, returning to the ideal 0-5 V scale. */
+                void resetCalibration();
+                /*! @brief Returns the gain correction of ADC 0 or 1 (corrected = gain*measured + offset) */
+                float getCalibrationGain(int adc);
+                /*! @brief Returns the offset correction of ADC 0 or 1, in volts (corrected = gain*measured + offset) */
+                float getCalibrationOffset(int adc);
+                /*! @brief Returns the automatic calibration interval, in milliseconds (0 = disabled) */
+                int  getCalibrationInterval();
+                /*! @brief Compute the statistics of measure(), readEncoder() and readAllEncoders() in
+                 *  Q16 fixed point instead of double precision (the default), for FPUs on which double
+                 *  precision is slow; bench/bench_stats tells which is faster on a given board.
+                 *  @param enable true for fixed point */
+                void setFixedPoint(bool enable);
+                /*! @brief Returns whether the statistics are computed in fixed point */
+                bool isFixedPoint();
+                /*! @brief Sets the automatic calibration interval.
+                 *  @param interval Maximum age of the correction, in milliseconds (0 = disabled) */
+                void setCalibrationInterval(int interval);
+                ///@}
+
+                ///@{
+                /*! @name Measurement Coalescing
+                 *
+                 * With coalescing on, a measure() of the same ADC, channel, number of
+                 * samples and read delay as one already under way in another thread waits
+                 * for that acquisition and returns its result, rather than making its own.
+                 * The encoder and temperature readings, which go through measure(), are
+                 * coalesced likewise. Results may further be reused for a maximum age;
+                 * a change of calibration or arithmetic (c.f. setFixedPoint) drops them.
+                 */
+                /*! @brief Turn coalescing on or off (the default) */
+                void setCoalescing(bool enable);
+                /*! @brief Returns whether coalescing is on */
+                bool isCoalescing();
+                /*! @brief Sets the longest a result is reused for.
+                 *  @param maxAge Maximum age of a reused result, in microseconds (0 = only while it is being acquired) */
+                void setCoalescingMaxAge(int maxAge);
+                /*! @brief Returns the longest a result is reused for, in microseconds */
+                int  getCoalescingMaxAge();
+                ///@}
+
+                ///@{
+                /*! @name ADC SPI Clock
+                 *
+                 * The ADCs are read over SPI with a clock derived from a 48 MHz functional clock. The
+                 * ADCs convert on their internal oscillator (TLC3548::CC_INTERNAL), so the SPI clock
+                 * only limits the transfer of commands and results; the rate at which a given board
+                 * still reads correctly depends on its wiring, and can be found with tuneSPIClock.
+                 */
+                /*! @brief Returns the current SPI clock rate, in Hz */
+                int  getSPIClock();
+                /*! @brief Sets the SPI clock.
+                 *  @param rate Maximum clock rate, in Hz; the fastest available rate not above it is used
+                 *  @param granularity 0 = power of two dividers of 48 MHz, 1 = any integer divider
+                 *  @param csTime Delay between chip select and the first/last clock edge, in clock cycles (0-3)
+                 *  @return The resulting clock rate, in Hz */
+                int  setSPIClock(int rate, int granularity=0, int csTime=3);
+                /*! @brief Find the fastest SPI clock at which the ADC references read correctly.
+                 *
+                 * The LOW-, MID- and HIGH- point references of both ADCs are first measured at a slow,
+                 * safe clock. Clock rates are then tried from maxRate downwards (with one clock
+                 * granularity), and the first one at which every reference agrees with the slow reading
+                 * is kept: its mean must be within tolerance, and its min/max within tolerance of the
+                 * slow min/max. If no rate qualifies, the slow clock is kept.
+                 *  @param tolerance Allowed deviation from the slow reading, in volts
+                 *  @param maxRate Fastest clock rate to try, in Hz
+                 *  @return The selected clock rate, in Hz */
+                int  tuneSPIClock(float tolerance=0.005, int maxRate=48000000);
+                /*! @brief Bound the time spent waiting on the SPI bus.
+                 *
+                 * A measurement which exceeds either bound stops early and reports
+                 * STATUS_SPI_TIMEOUT or STATUS_SPI_STALL in its status field.
+                 *  @param timeout Longest wait for the bus, in microseconds (0 = wait forever)
+                 *  @param retries Number of times a word is re-sent before the ADC is considered stalled */
+                void setSPITimeout(int timeout, int retries);
+                /*! @brief Returns the SPI bus counters accumulated since construction or resetSPIStats().
+                 *  A rising pollsPerWord, retries or stalls count indicates a degrading bus. */
+                spiStats getSPIStats();
+                /*! @brief Zero the SPI bus counters */
+                void resetSPIStats();
                 ///@}
 
                 ///@{
@@ -494,19 +883,76 @@ class CBC
                 void  setEncoderVoltageSlope      ( int iencoder, float slope  ) ;
                 void  setEncoderVoltageOffset     ( int iencoder, float offset ) ;
 
+                ///@{
+                /*! @name Encoder Correction
+                 *
+                 * Apply the encoder voltage/temperature correction (c.f. readEncoder) to raw encoder
+                 * voltages. The correction coefficients are computed once per temperature and cached,
+                 * so repeated calls at the same temperature only cost one multiply-add per reading.
+                 */
+                /*! @brief Correct a single reading of all six encoders.
+                 *  @param raw Raw voltages of encoders 1-6
+                 *  @param temperature Onboard temperature sensor voltage
+                 *  @param out Corrected voltages of encoders 1-6 */
+                void correctEncoders (const float raw[6], float temperature, float out[6]);
+                /*! @brief Correct a block of readings of all six encoders.
+                 *  @param raw nframes consecutive frames of six raw encoder voltages
+                 *  @param nframes Number of frames in the block
+                 *  @param temperature Onboard temperature sensor voltage
+                 *  @param out nframes corrected frames */
+                void correctEncoders (const float* raw, int nframes, float temperature, float* out);
+                ///@}
+
 
                 ADC(CBC *cbc);
+                ~ADC();
 
             private:
                 CBC *cbc;
                 int m_readDelay;
                 int m_defaultSamples;
-
-                float m_encoderTemperatureOffset [6];
-                float m_encoderTemperatureSlope  [6];
-                float m_encoderTemperatureRef       ;
-                float m_encoderVoltageOffset     [6];
-                float m_encoderVoltageSlope      [6];
+                bool m_fixedPoint;      // c.f. setFixedPoint
+
+                /* Shares acquisitions between concurrent measure() calls */
+                MeasurementScheduler* m_scheduler;
+
+                /* The acquisition behind measure() */
+                adcData acquire (int adc, int channel, int nsamples);
+
+                filterConfig m_filter;
+
+                /* ADC self-calibration: corrected = gain*measured + offset */
+                float    m_adcGain            [2];
+                float    m_adcOffset          [2];
+                uint64_t m_adcCalibrationTime [2];  // monotonic nanoseconds
+                bool     m_adcCalibrated      [2];  // the time above is that of a calibration
+                int      m_calibrationInterval;      // milliseconds
+
+                /* Re-calibrates the ADC if its calibration is older than the interval,
+                 * and returns the correction in force */
+                void refreshCalibration (int adc, float& gain, float& offset);
+
+                /* Guards the ADC and encoder calibrations, so that they may be read and
+                 * updated from several threads. Taken before the SPI bus lock; the ADC
+                 * calibration reads its references without it and takes it to publish. */
+                std::recursive_mutex m_calibrationLock;
+
+                /* Encoder calibration stored as a structure of arrays (padded to 8 lanes)
+                 * together with the shift and gain derived from it at the temperature
+                 * of the last correction */
+                struct EncoderCalibration {
+                    alignas(16) float voltageOffset     [8];
+                    alignas(16) float voltageSlope      [8];
+                    alignas(16) float temperatureOffset [8];
+                    alignas(16) float temperatureSlope  [8];
+                    alignas(16) float shift             [8];
+                    alignas(16) float gain              [8];
+                    float temperatureRef;
+                    float temperature;
+                    bool  valid;
+                } m_calibration;
+
+                void updateEncoderCorrection (float temperature);
         } adc;
 
         //////////////////////////////////////////////////////////////////////////////
@@ -537,6 +983,22 @@ class CBC
         int m_delay; // in milliseconds
         void setDelayTime(int delay);
         int getDelayTime();
+
+    private:
+        MirrorControlBoard* m_board;
+        VirtualClock*       m_virtualClock;   // c.f. Config::virtualTime
+        StatusPage*         m_statusPage;     // c.f. Config::statusPage, NULL if none
+        OperationScheduler* m_operations;     // turns of the operations of concurrent threads
+
+        /* powerUp for a warm start: powers up only what is off, and leaves
+         * the ADCs, which every acquisition initializes, as they are */
+        void resume();
+
+        /* Update the status page, if any, with the board state, a move of
+         * drive idrive (0-5), or the encoders iencoder.. (0-5) and temperature */
+        void publishStatus   ();
+        void publishStep     (int idrive, int nsteps);
+        void publishReadings (int iencoder, int nencoder, const float* voltage, float temperatureVolts);
 };
 
 #endif
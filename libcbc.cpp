@@ -3,9 +3,11 @@
  */
 
 #include <iomanip>
+#include <algorithm>
 #include <cstdlib>
 #include <cassert>
 #include <cstring>
+#include <climits>
 #include <unistd.h>
 #include <time.h>
 #include <math.h>
@@ -16,17 +18,13 @@
 #include <cbc.hpp>
 #include "MirrorControlBoard.hpp"
 #include "TLC3548_ADC.hpp"
-
-void usleep2 (int usdelay)
-{
-    static const int NANOS =  1000000000LL;
-    static const int MICROS = 1000000LL;
-    int nanodelay = usdelay * NANOS / MICROS;
-    struct timespec delay;
-    delay.tv_sec = 0;
-    delay.tv_nsec = nanodelay;
-    clock_nanosleep(CLOCK_MONOTONIC, 0, &delay, NULL);
-}
+#include "ADCFilter.hpp"
+#include "ADCStatistics.hpp"
+#include "Clock.hpp"
+#include "Metrics.hpp"
+#include "StatusPage.hpp"
+#include "MeasurementScheduler.hpp"
+#include "OperationScheduler.hpp"
 
 //----------------------------------------------------------------------------------------------------------------------
 // CBC
@@ -34,34 +32,208 @@ void usleep2 (int usdelay)
 
     CBC::~CBC()
     {
+        delete m_statusPage;
+        delete m_operations;
+        delete m_board;
+        delete m_virtualClock;
     };
 
     // Constructor..
-    CBC::CBC (struct Config config) : usb(this), driver(this), encoder (this), adc (this), auxSensor(this)
+    CBC::CBC (struct Config config) : usb(this), driver(this), encoder (this), adc (this), auxSensor(this),
+        m_delay (config.delayTime > 0 ? config.delayTime : 0),
+        m_board (new MirrorControlBoard(config.hardwareBackend)), m_virtualClock (new VirtualClock()), m_statusPage (NULL),
+        m_operations (new OperationScheduler())
     {
         configure(config);
-        powerUp();
+        if (config.warmStart)
+            resume();
+        else
+            powerUp();
+    }
+
+    MirrorControlBoard& CBC::board()
+    {
+        return *m_board;
+    }
+
+    static CBC::latency latencyData(const Metrics::HistogramData& histogram)
+    {
+        static_assert(sizeof(CBC::latency::buckets)/sizeof(uint64_t) == Metrics::NBUCKET, "bucket count");
+
+        CBC::latency data;
+        data.count  = histogram.count;
+        data.mean   = histogram.count ? histogram.sum / 1000.0 / histogram.count : 0;
+        data.median = Metrics::percentile(histogram, 0.50) / 1000.0;
+        data.p99    = Metrics::percentile(histogram, 0.99) / 1000.0;
+        for (int i=0; i<Metrics::NBUCKET; i++)
+            data.buckets[i] = histogram.bucket[i];
+        return (data);
+    }
+
+    CBC::metrics CBC::getMetrics()
+    {
+        Metrics::Snapshot snapshot;
+        Metrics::snapshot(snapshot);
+
+        metrics data;
+        data.steps           = snapshot.counter[Metrics::STEPS];
+        data.adcMeasurements = snapshot.counter[Metrics::ADC_MEASUREMENTS];
+        data.adcSamples      = snapshot.counter[Metrics::ADC_SAMPLES];
+        data.adcCoalesced    = snapshot.counter[Metrics::ADC_COALESCED];
+        data.spiWords        = snapshot.counter[Metrics::SPI_WORDS];
+        data.sleeps          = snapshot.counter[Metrics::SLEEPS];
+        data.powerSequences  = snapshot.counter[Metrics::POWER_SEQUENCES];
+        data.yields          = snapshot.counter[Metrics::YIELDS];
+        data.safetyOverrides = snapshot.counter[Metrics::SAFETY_OVERRIDES];
+
+        data.step    = latencyData(snapshot.histogram[Metrics::LATENCY_STEP]);
+        data.measure = latencyData(snapshot.histogram[Metrics::LATENCY_MEASURE]);
+        data.spiWord = latencyData(snapshot.histogram[Metrics::LATENCY_SPI_WORD]);
+        data.sleep   = latencyData(snapshot.histogram[Metrics::LATENCY_SLEEP]);
+        data.power   = latencyData(snapshot.histogram[Metrics::LATENCY_POWER]);
+
+        data.safetyWait = latencyData(snapshot.histogram[Metrics::LATENCY_SAFETY_WAIT]);
+        data.safety     = latencyData(snapshot.histogram[Metrics::LATENCY_SAFETY]);
+
+        return (data);
+    }
+
+    void CBC::resetMetrics()
+    {
+        Metrics::reset();
+    }
+
+    void CBC::enableMetrics(bool enable)
+    {
+        Metrics::setEnabled(enable);
+    }
+
+    void CBC::setSafetyWaitLimit(int limit)
+    {
+        m_operations->setSafetyWaitLimit(limit);
+    }
+
+    int CBC::getSafetyWaitLimit()
+    {
+        return (m_operations->getSafetyWaitLimit());
+    }
+
+    // Status Page
+    //---------------------------------------------
+
+    /* Board state as read back from the GPIOs, and the telemetry */
+    static void statusFromBoard(CBC& cbc, StatusPage::Status& status)
+    {
+        status.usbEnabled = 0;
+        for (int i=0; i<7; i++)
+            if (cbc.board().isUSBPoweredUp(i))
+                status.usbEnabled |= 0x1 << i;
+
+        status.drivesEnabled = 0;
+        for (int i=0; i<6; i++)
+            if (cbc.board().isDriveEnabled(i))
+                status.drivesEnabled |= 0x1 << i;
+
+        status.driversAwake      = cbc.board().isDriveControllersPoweredUp();
+        status.highCurrent       = cbc.board().isDriveHiCurrentEnabled();
+        status.syncRectification = cbc.board().isDriveSREnabled();
+        status.encodersEnabled   = cbc.board().isEncodersPoweredUp();
+        status.sensorsEnabled    = cbc.board().isSensorsPoweredUp();
+        status.microsteps        = cbc.driver.getMicrosteps();
+        status.steppingFrequency = cbc.driver.getSteppingFrequency();
+
+        Metrics::snapshot(status.metrics);
+    }
+
+    void CBC::publishStatus()
+    {
+        if (!m_statusPage)
+            return;
+
+        StatusPage::Status& status = m_statusPage->begin();
+        statusFromBoard(*this, status);
+        m_statusPage->commit();
+    }
+
+    void CBC::publishStep(int idrive, int nsteps)
+    {
+        if (!m_statusPage)
+            return;
+
+        StatusPage::Status& status = m_statusPage->begin();
+        status.position[idrive] += nsteps;
+        statusFromBoard(*this, status);
+        m_statusPage->commit();
+    }
+
+    void CBC::publishReadings(int iencoder, int nencoder, const float* voltage, float temperatureVolts)
+    {
+        if (!m_statusPage)
+            return;
+
+        struct timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        uint64_t time = uint64_t(now.tv_sec) * 1000000000 + now.tv_nsec;
+
+        StatusPage::Status& status = m_statusPage->begin();
+        for (int i=0; i<nencoder; i++) {
+            status.encoderVoltage [iencoder+i] = voltage[i];
+            status.encoderTime    [iencoder+i] = time;
+        }
+        status.temperature     = (temperatureVolts-0.5)*100;
+        status.temperatureTime = time;
+        Metrics::snapshot(status.metrics);
+        m_statusPage->commit();
     }
 
     void CBC::configure(struct Config config)
     {
+        OperationScheduler::Turn turn(*m_operations, OperationScheduler::HOUSEKEEPING);
+
+        /* Status page; kept, with the positions it holds, if its name is unchanged */
+        if (!m_statusPage || m_statusPage->getName() != config.statusPage) {
+            delete m_statusPage;
+            m_statusPage = NULL;
+            if (!config.statusPage.empty())
+                m_statusPage = new StatusPage(config.statusPage.c_str(), StatusPage::PUBLISH);
+        }
+
+        /* Time source; everything below may wait */
+        board().setClock(config.virtualTime ? m_virtualClock : NULL);
+
+        /* Registers and SPI Backend; everything below may talk to the hardware */
+        board().setHardwareBackend(config.hardwareBackend);
+        board().setWarmStart(config.warmStart);
+        board().setSPIBackend(config.spiBackend, config.spiDevice.c_str());
+
+        /* CBC Delay Times; the drive enables and disables below wait them */
+        setDelayTime(config.delayTime);
+
+        /* On a warm start, settings the board already has are left alone */
+        bool warm = config.warmStart;
+
         /* Microsteps */
-        driver.setMicrosteps(config.microsteps);
+        if (!warm || driver.getMicrosteps() != config.microsteps)
+            driver.setMicrosteps(config.microsteps);
 
         /* Set Stepping Frequency */
         driver.setSteppingFrequency(config.steppingFrequency);
 
         /* High Current Mode */
-        if (config.highCurrentMode)
-            driver.enableHighCurrent();
-        else
-            driver.disableHighCurrent();
+        if (!warm || driver.isHighCurrentEnabled() != config.highCurrentMode) {
+            if (config.highCurrentMode)
+                driver.enableHighCurrent();
+            else
+                driver.disableHighCurrent();
+        }
 
         /* Drive SR */
-        if (config.driveSR)
-            driver.enableSR();
-        else
-            driver.disableSR();
+        if (!warm || driver.isSREnabled() != config.driveSR) {
+            if (config.driveSR)
+                driver.enableSR();
+            else
+                driver.disableSR();
+        }
 
         /* ADC Read Delay */
         adc.setReadDelay(config.adcReadDelay);
@@ -69,27 +241,73 @@ void usleep2 (int usdelay)
         /* ADC Number of Samples */
         adc.setDefaultSamples(config.defaultADCSamples);
 
+        /* ADC Self-Calibration */
+        adc.setCalibrationInterval(config.adcCalibrationInterval);
+
+        /* ADC Statistics Arithmetic */
+        adc.setFixedPoint(config.adcFixedPoint);
+
+        /* ADC Measurement Coalescing */
+        adc.setCoalescingMaxAge(config.adcCoalescingMaxAge);
+        adc.setCoalescing(config.adcCoalescing);
+
+        /* ADC SPI Clock */
+        adc.setSPIClock(config.spiClockRate, config.spiClockGranularity, config.spiChipSelectTime);
+        adc.setSPITimeout(config.spiTimeout, config.spiRetryLimit);
+
         /* Turn on Ethernet Dongle */
-        usb.enableEthernet();
+        if (!warm || !board().isUSBPoweredUp(0))
+            usb.enableEthernet();
 
         /* Configure USBs */
         for (int i=0; i<6; i++) {
-            if ((config.usbEnable >> i) & 0x1)
+            bool on = (config.usbEnable >> i) & 0x1;
+            if (warm && usb.isEnabled(i+1) == on)
+                continue;
+            if (on)
                 usb.enable(i+1);
             else
                 usb.disable(i+1);
         }
 
         /* Configure Drives */
-        for (int i=0; i<6; i++) {
-            if ((config.driveEnable >> i) & 0x1)
-                driver.enable(i+1);
-            else
-                driver.disable(i+1);
+        if (!warm) {
+            for (int i=0; i<6; i++) {
+                if ((config.driveEnable >> i) & 0x1)
+                    driver.enable(i+1);
+                else
+                    driver.disable(i+1);
+            }
+        }
+        else {
+            /* Only the drives to change, waiting the delay time once before
+             * all the disables and once after all the enables */
+            int enabled = 0;
+            for (int i=0; i<6; i++)
+                if (driver.isEnabled(i+1))
+                    enabled |= 0x1 << i;
+            int disable = enabled & ~config.driveEnable & 0x3F;
+            int enable  = ~enabled & config.driveEnable & 0x3F;
+
+            if (disable) {
+                board().sleepMicros(getDelayTime());
+                for (int i=0; i<6; i++)
+                    if ((disable >> i) & 0x1)
+                        board().disableDrive(i); //MCB counts from zero
+            }
+            if (enable) {
+                for (int i=0; i<6; i++)
+                    if ((enable >> i) & 0x1)
+                        board().enableDrive(i); //MCB counts from zero
+            }
+            if (disable || enable)
+                publishStatus();
+            if (enable)
+                board().sleepMicros(getDelayTime());
         }
 
-        /* CBC Delay Times */
-        setDelayTime(config.delayTime);
+        /* Safety Command Wait Limit */
+        setSafetyWaitLimit(config.safetyWaitLimit);
 
         /* Encoder Calibration */
         for (int i=0; i<6; i++) {
@@ -102,22 +320,50 @@ void usleep2 (int usdelay)
 
     void CBC::powerUp()
     {
+        OperationScheduler::Turn turn(*m_operations, OperationScheduler::HOUSEKEEPING);
+
+        Metrics::Timer timer(Metrics::LATENCY_POWER);
+        Metrics::count(Metrics::POWER_SEQUENCES);
+
         // Configure GPIOs
         //gpio->ConfigureAll();
 
         // turn on level shifters
-        MirrorControlBoard::enableIO();
+        board().enableIO();
 
         driver.wakeup();
         //driver.reset();
         encoder.enable();
         auxSensor.enable();
 
-        MirrorControlBoard::initializeADC(0);
-        MirrorControlBoard::initializeADC(1);
+        board().initializeADC(0);
+        board().initializeADC(1);
+    }
+
+    void CBC::resume()
+    {
+        OperationScheduler::Turn turn(*m_operations, OperationScheduler::HOUSEKEEPING);
+
+        Metrics::Timer timer(Metrics::LATENCY_POWER);
+        Metrics::count(Metrics::POWER_SEQUENCES);
+
+        if (!board().isIOEnabled())
+            board().enableIO();
+
+        if (!driver.isAwake())
+            driver.wakeup();
+        if (!board().isEncodersPoweredUp())
+            encoder.enable();
+        if (!board().isSensorsPoweredUp())
+            auxSensor.enable();
     }
 
     void CBC::powerDown() {
+        OperationScheduler::Turn turn(*m_operations, OperationScheduler::SAFETY);
+
+        Metrics::Timer timer(Metrics::LATENCY_POWER);
+        Metrics::count(Metrics::POWER_SEQUENCES);
+
         driver.sleep();
         encoder.disable();
         auxSensor.disable();
@@ -152,14 +398,18 @@ void usleep2 (int usdelay)
     {
         if((iusb<1)||(iusb>6))
             return;
-        MirrorControlBoard::powerUpUSB(iusb);
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::HOUSEKEEPING);
+        cbc->board().powerUpUSB(iusb);
+        cbc->publishStatus();
     }
 
     void CBC::USB::disable(int iusb)
     {
         if((iusb<1)||(iusb>6))
             return;
-        MirrorControlBoard::powerDownUSB(iusb);
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::HOUSEKEEPING);
+        cbc->board().powerDownUSB(iusb);
+        cbc->publishStatus();
     }
 
     void CBC::USB::enableAll()
@@ -179,23 +429,27 @@ void usleep2 (int usdelay)
         if ((iusb<1) | (iusb>6))
             return(-1);
         else
-            return (MirrorControlBoard::isUSBPoweredUp(iusb));
+            return (cbc->board().isUSBPoweredUp(iusb));
     }
 
     void CBC::USB::enableEthernet()
     {
-        MirrorControlBoard::powerUpUSB(0);
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::HOUSEKEEPING);
+        cbc->board().powerUpUSB(0);
+        cbc->publishStatus();
     }
 
     void CBC::USB::disableEthernet()
     {
-        MirrorControlBoard::powerDownUSB(0);
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::HOUSEKEEPING);
+        cbc->board().powerDownUSB(0);
+        cbc->publishStatus();
     }
 
     void CBC::USB::resetEthernet()
     {
         disableEthernet();
-        sleep(1);
+        cbc->board().sleepMicros(1000000);
         enableEthernet();
     }
 
@@ -226,12 +480,14 @@ void usleep2 (int usdelay)
             default:
                 return;
         }
-        MirrorControlBoard::setUStep(us);
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::MOTION);
+        cbc->board().setUStep(us);
+        cbc->publishStatus();
     }
 
     int CBC::Driver::getMicrosteps()
     {
-        unsigned us = MirrorControlBoard::getUStep();
+        unsigned us = cbc->board().getUStep();
         int steps = 0;
         switch(us) {
             case 0:
@@ -259,8 +515,12 @@ void usleep2 (int usdelay)
             return;
 
         //enable drive
-        MirrorControlBoard::enableDrive(drive-1); //MCB counts from zero
-        usleep2(cbc->getDelayTime());
+        {
+            OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::MOTION);
+            cbc->board().enableDrive(drive-1); //MCB counts from zero
+            cbc->publishStatus();
+        }
+        cbc->board().sleepMicros(cbc->getDelayTime());
     }
 
     void CBC::Driver::disable(int drive)
@@ -269,9 +529,14 @@ void usleep2 (int usdelay)
         if ((drive<1)||(drive>6))
             return;
 
-        //disable drive
-        usleep2(cbc->getDelayTime());
-        MirrorControlBoard::disableDrive(drive-1); //MCB counts from zero
+        //disable drive at once; the delay follows, as for enable
+        {
+            Metrics::Timer timer(Metrics::LATENCY_SAFETY);
+            OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::SAFETY);
+            cbc->board().disableDrive(drive-1); //MCB counts from zero
+            cbc->publishStatus();
+        }
+        cbc->board().sleepMicros(cbc->getDelayTime());
     }
 
     void CBC::Driver::enableAll()
@@ -282,68 +547,96 @@ void usleep2 (int usdelay)
 
     void CBC::Driver::disableAll()
     {
-        for (int i=1; i<7; i++)
-            disable(i);
+        //all drives under one turn, so motion cannot take the board back between them
+        {
+            Metrics::Timer timer(Metrics::LATENCY_SAFETY);
+            OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::SAFETY);
+            for (int i=0; i<6; i++)
+                cbc->board().disableDrive(i);
+            cbc->publishStatus();
+        }
+        cbc->board().sleepMicros(cbc->getDelayTime());
     }
 
     bool CBC::Driver::isEnabled(int drive)
     {
-        return (MirrorControlBoard::isDriveEnabled(drive-1)); // MCB counts from zero
+        return (cbc->board().isDriveEnabled(drive-1)); // MCB counts from zero
     }
 
     void CBC::Driver::sleep()
     {
-        MirrorControlBoard::powerDownDriveControllers();
+        Metrics::Timer timer(Metrics::LATENCY_SAFETY);
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::SAFETY);
+        cbc->board().powerDownDriveControllers();
+        cbc->publishStatus();
     }
 
     void CBC::Driver::wakeup()
     {
-        MirrorControlBoard::powerUpDriveControllers();
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::MOTION);
+        cbc->board().powerUpDriveControllers();
+        cbc->publishStatus();
     }
 
     bool CBC::Driver::isAwake()
     {
-        return(MirrorControlBoard::isDriveControllersPoweredUp());
+        return(cbc->board().isDriveControllersPoweredUp());
     }
 
     bool CBC::Driver::isHighCurrentEnabled()
     {
-        return(MirrorControlBoard::isDriveHiCurrentEnabled());
+        return(cbc->board().isDriveHiCurrentEnabled());
     }
 
     void CBC::Driver::enableHighCurrent ()
     {
-        MirrorControlBoard::enableDriveHiCurrent();
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::MOTION);
+        cbc->board().enableDriveHiCurrent();
+        cbc->publishStatus();
     }
 
     void CBC::Driver::disableHighCurrent ()
     {
-        MirrorControlBoard::disableDriveHiCurrent();
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::MOTION);
+        cbc->board().disableDriveHiCurrent();
+        cbc->publishStatus();
     }
 
     bool CBC::Driver::isSREnabled()
     {
-        return(MirrorControlBoard::isDriveSREnabled());
+        return(cbc->board().isDriveSREnabled());
     }
 
     void CBC::Driver::enableSR()
     {
-        MirrorControlBoard::enableDriveSR();
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::MOTION);
+        cbc->board().enableDriveSR();
+        cbc->publishStatus();
     }
 
     void CBC::Driver::disableSR()
     {
-        MirrorControlBoard::disableDriveSR();
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::MOTION);
+        cbc->board().disableDriveSR();
+        cbc->publishStatus();
     }
 
     void CBC::Driver::setSteppingFrequency (int frequency)
     {
         m_steppingFrequency = frequency;
+        cbc->publishStatus();
+    }
+
+    int CBC::Driver::getSteppingFrequency ()
+    {
+        return (m_steppingFrequency);
     }
 
     void CBC::Driver::reset()
     {
-        MirrorControlBoard::setPhaseZeroOnAllDrives();
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::MOTION);
+        cbc->board().setPhaseZeroOnAllDrives();
+        cbc->publishStatus();
     }
 
     void CBC::Driver::step(int drive, int nsteps)
@@ -363,7 +656,7 @@ void usleep2 (int usdelay)
         if ((drive<1)||(drive>6))
             return;
 
-        usleep2(cbc->getDelayTime());
+        cbc->board().sleepMicros(cbc->getDelayTime());
         if (isEnabled(drive)) {
             /* MCB counts from 0 */
             drive = drive - 1;
@@ -373,11 +666,18 @@ void usleep2 (int usdelay)
             if (nsteps<0)
                 dir = MirrorControlBoard::DIR_RETRACT, nsteps=-nsteps;
 
+            OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::MOTION);
+
             /* Convert from microsteps to macrosteps */
             unsigned microsteps = nsteps * getMicrosteps();
 
-            /* loop over number of micro Steps */
+            Metrics::Timer timer(Metrics::LATENCY_STEP);
+            Metrics::count(Metrics::STEPS, microsteps);
+
+            /* loop over number of micro Steps, pausing between them for safety commands */
             for (unsigned istep=0; istep<microsteps; istep++) {
+                cbc->m_operations->yield();
+
                 /* Give this thread higher priority to improve timing stability */
                 pthread_t this_thread = pthread_self();
                 struct sched_param params;
@@ -385,8 +685,9 @@ void usleep2 (int usdelay)
                 pthread_setschedparam(this_thread, SCHED_FIFO, &params);
 
                 /* Step the drive */
-                MirrorControlBoard::stepOneDrive(drive, dir, frequency * getMicrosteps());
+                cbc->board().stepOneDrive(drive, dir, frequency * getMicrosteps());
             }
+            cbc->publishStep(drive, (dir == MirrorControlBoard::DIR_RETRACT) ? -nsteps : nsteps);
             sched_yield();
             return;
         }
@@ -402,17 +703,21 @@ void usleep2 (int usdelay)
 
     void CBC::Encoder::enable()
     {
-        MirrorControlBoard::powerUpEncoders();
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::HOUSEKEEPING);
+        cbc->board().powerUpEncoders();
+        cbc->publishStatus();
     }
 
     void CBC::Encoder::disable()
     {
-        MirrorControlBoard::powerDownEncoders();
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::HOUSEKEEPING);
+        cbc->board().powerDownEncoders();
+        cbc->publishStatus();
     }
 
     bool CBC::Encoder::isEnabled()
     {
-        return (MirrorControlBoard::isEncodersPoweredUp());
+        return (cbc->board().isEncodersPoweredUp());
     }
 
 //----------------------------------------------------------------------------------------------------------------------
@@ -422,20 +727,184 @@ void usleep2 (int usdelay)
     // Constructor
     //---------------------------------------------
 
-    CBC::ADC::ADC (CBC *thiscbc) : cbc(thiscbc)
+    CBC::ADC::ADC (CBC *thiscbc) : cbc(thiscbc), m_fixedPoint(false), m_scheduler(new MeasurementScheduler), m_calibrationInterval(0)
     {
+        memset(&m_calibration, 0, sizeof(m_calibration));
+        resetCalibration();
+
+        /* 16x boxcar decimation followed by an 8-tap low-pass */
+        m_filter.median     = 3;
+        m_filter.decimation = 16;
+        m_filter.cicOrder   = 1;
+        m_filter.firTaps    = 8;
+        m_filter.firCutoff  = 0.25;
+    }
+
+    CBC::ADC::~ADC ()
+    {
+        delete m_scheduler;
     }
 
     // Generic ADC Readout
     //---------------------------------------------
 
+    /* Converts accumulated ADC statistics into an adcData struct, applying the
+     * ADC gain/offset correction to the results */
+    static CBC::ADC::adcData statData(const MirrorControlBoard::ADCStat& stat, int nsamples, uint64_t elapsed, float gain, float offset, int status, bool fixedPoint)
+    {
+        /* initialize to zero */
+        CBC::ADC::adcData data;
+        memset(&data, 0, sizeof(CBC::ADC::adcData));
+
+        /* fixed point statistics are converted to volts once */
+        if (fixedPoint)
+            ADCStatistics::toVolts(ADCStatistics::fixedStat(stat, nsamples), gain, offset, data);
+        else
+            ADCStatistics::floatStat(stat, nsamples, gain, offset, data);
+
+        // raw copies
+        data.rawVoltage    = data.voltage;
+        data.rawVoltageMin = data.voltageMin;
+        data.rawVoltageMax = data.voltageMax;
+
+        // achieved timing
+        data.acquisitionTime = elapsed * 1e-9;
+        if (elapsed > 0)
+            data.sampleRate = nsamples / data.acquisitionTime;
+
+        // errors of the acquisition just made
+        data.status = status;
+
+        return (data);
+    }
+
+    /* Longest burst of SPI words in one acquisition: longer measurements are
+     * made in bursts, between which they give way to safety commands */
+    static const unsigned MEASUREMENT_BURST = 1024;
+
+    /* MirrorControlBoard::readADCSamplesMulti, in bursts, into samples stored
+     * per channel (nchan*nsamples entries). Stops at a burst which fails,
+     * leaving its SPI error and the samples not read zero. */
+    static uint64_t readInBursts(MirrorControlBoard& board, OperationScheduler& operations, unsigned adc, unsigned channel,
+            unsigned nchan, unsigned nsamples, uint32_t* samples, unsigned readDelay)
+    {
+        unsigned burst = std::max(MEASUREMENT_BURST / nchan, 1u);
+        if (nsamples <= burst)
+            return (board.readADCSamplesMulti(adc, channel, nchan, nsamples, samples, readDelay));
+
+        std::vector<uint32_t> part (nchan*burst);
+        memset(samples, 0, nchan*nsamples*sizeof(uint32_t));
+
+        uint64_t elapsed = 0;
+        for (unsigned done=0; done<nsamples; done+=burst) {
+            if (done > 0)
+                operations.yield();
+
+            unsigned n = std::min(burst, nsamples-done);
+            elapsed += board.readADCSamplesMulti(adc, channel, nchan, n, part.data(), readDelay);
+            if (board.getSPIError())
+                break;
+
+            for (unsigned ich=0; ich<nchan; ich++)
+                memcpy(samples + ich*nsamples + done, &part[ich*n], n*sizeof(uint32_t));
+        }
+        return (elapsed);
+    }
+
+    /* MirrorControlBoard::measureADCStatMulti, in bursts (c.f. readInBursts).
+     * The statistics of each channel are accumulated once over the samples of
+     * all the bursts, so that an encoder at home has the same side rejected
+     * throughout. */
+    static uint64_t measureInBursts(MirrorControlBoard& board, OperationScheduler& operations, unsigned adc, unsigned channel,
+            unsigned nchan, unsigned nsamples, MirrorControlBoard::ADCStat* stat, unsigned readDelay)
+    {
+        std::vector<uint32_t> samples (nchan*nsamples);
+        uint64_t elapsed = readInBursts(board, operations, adc, channel, nchan, nsamples, samples.data(), readDelay);
+
+        for (unsigned ich=0; ich<nchan; ich++)
+            MirrorControlBoard::accumulateADCStat(&samples[ich*nsamples], nsamples, stat[ich]);
+        return (elapsed);
+    }
+
     CBC::ADC::adcData CBC::ADC::measure(int adc, int channel, int nsamples)
     {
-        uint32_t sum;
-        uint64_t sumsq;
-        uint32_t min;
-        uint32_t max;
+        /* initialize to zero */
+        adcData data;
+        memset(&data, 0, sizeof(adcData));
+
+        /* Make sure we are doing something sensible */
+        if ((adc > 1) | (adc < 0 ))
+            return(data);
+        if ((channel > 10) | (channel < 0 ))
+            return(data);
+        if (nsamples <= 0)
+            return(data);
+
+        /* share an acquisition with concurrent requests for the same measurement */
+        MeasurementScheduler::Key key = {adc, channel, nsamples, m_readDelay};
+        MeasurementScheduler::Role role = m_scheduler->begin(key, cbc->board().monotonicNanos(), data);
+        if (role == MeasurementScheduler::SERVED) {
+            Metrics::count(Metrics::ADC_COALESCED);
+            return(data);
+        }
+
+        /* should acquire() throw, the lead wakes the waiting requests on the way out */
+        MeasurementScheduler::Lead lead(*m_scheduler, role, key);
+        data = acquire(adc, channel, nsamples);
+        lead.complete(cbc->board().monotonicNanos(), data);
+
+        return(data);
+    }
+
+    CBC::ADC::adcData CBC::ADC::acquire(int adc, int channel, int nsamples)
+    {
+        MirrorControlBoard::ADCStat stat;
+
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::MEASUREMENT);
+
+        Metrics::Timer timer(Metrics::LATENCY_MEASURE);
+        Metrics::count(Metrics::ADC_MEASUREMENTS);
+        Metrics::count(Metrics::ADC_SAMPLES, nsamples);
+
+        float gain, offset;
+        refreshCalibration(adc, gain, offset);
 
+        uint64_t elapsed = measureInBursts(cbc->board(), *cbc->m_operations, adc, channel, 1, nsamples, &stat, m_readDelay);
+
+        return (statData(stat, nsamples, elapsed, gain, offset, cbc->board().getSPIError(), m_fixedPoint));
+    }
+
+    CBC::ADC::adcDataFixed CBC::ADC::measureFixed(int adc, int channel, int nsamples)
+    {
+        MirrorControlBoard::ADCStat stat;
+
+        /* initialize to zero */
+        adcDataFixed data;
+        memset(&data, 0, sizeof(adcDataFixed));
+
+        /* Make sure we are doing something sensible */
+        if ((adc > 1) | (adc < 0 ))
+            return(data);
+        if ((channel > 10) | (channel < 0 ))
+            return(data);
+        if (nsamples <= 0)
+            return(data);
+
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::MEASUREMENT);
+
+        Metrics::Timer timer(Metrics::LATENCY_MEASURE);
+        Metrics::count(Metrics::ADC_MEASUREMENTS);
+        Metrics::count(Metrics::ADC_SAMPLES, nsamples);
+
+        measureInBursts(cbc->board(), *cbc->m_operations, adc, channel, 1, nsamples, &stat, m_readDelay);
+
+        data = ADCStatistics::fixedStat(stat, nsamples);
+        data.status = cbc->board().getSPIError();
+        return (data);
+    }
+
+    CBC::ADC::adcData CBC::ADC::measureFiltered(int adc, int channel, int nsamples)
+    {
         /* initialize to zero */
         adcData data;
         memset(&data, 0, sizeof(adcData));
@@ -445,27 +914,223 @@ void usleep2 (int usdelay)
             return(data);
         if ((channel > 10) | (channel < 0 ))
             return(data);
-        if (nsamples < 0)
+        if (nsamples <= 0)
             return(data);
 
-        MirrorControlBoard::measureADCStat(adc, channel, nsamples, sum, sumsq, min, max, m_readDelay);
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::MEASUREMENT);
+
+        Metrics::Timer timer(Metrics::LATENCY_MEASURE);
+        Metrics::count(Metrics::ADC_MEASUREMENTS);
+        Metrics::count(Metrics::ADC_SAMPLES, nsamples);
 
-        float mean   = double(sum)/nsamples;
-        float var    = double((1.0*sumsq) - ((1.0*sum*sum)/nsamples))/nsamples;
-        float stddev = sqrt(var);
+        float gain, offset;
+        refreshCalibration(adc, gain, offset);
 
-        data.voltage      = TLC3548::voltData(mean);
-        data.stddev       = TLC3548::voltData(stddev);
-        data.voltageMin   = TLC3548::voltData(min);
-        data.voltageMax   = TLC3548::voltData(max);
-        data.voltageError = TLC3548::voltData(stddev/sqrt(nsamples));
+        std::vector<uint32_t> samples (nsamples);
+        uint64_t elapsed = readInBursts(cbc->board(), *cbc->m_operations, adc, channel, 1, nsamples, samples.data(), m_readDelay);
+
+        data.status = cbc->board().getSPIError();
+        if (data.status != STATUS_OK)
+            return(data);
+
+        ADCFilter filter (m_filter);
+        std::vector<float> out (nsamples / filter.decimation() + 1);
+        int nout    = filter.filter(samples.data(), nsamples, out.data());
+        int nsettle = filter.settling();
+
+        /* Not enough samples to settle the filter; fall back to the last output */
+        if (nout <= nsettle)
+            nsettle = (nout > 0) ? nout-1 : 0;
+        if (nout == 0)
+            return(data);
+
+        double sum=0, sumsq=0;
+        float  min=out[nsettle], max=out[nsettle];
+        for (int i=nsettle; i<nout; i++) {
+            sum   += out[i];
+            sumsq += double(out[i])*out[i];
+            if (out[i] < min) min = out[i];
+            if (out[i] > max) max = out[i];
+        }
+
+        int    n      = nout - nsettle;
+        double mean   = sum/n;
+        double var    = sumsq/n - mean*mean;
+        double stddev = sqrt(var > 0 ? var : 0);
+
+        /* counts to volts, with the ADC gain/offset correction */
+        float volts  = 5.0f / TLC3548::fullScaleUSB();
+
+        data.voltage      = mean   * volts * gain + offset;
+        data.stddev       = stddev * volts * gain;
+        data.voltageMin   = min    * volts * gain + offset;
+        data.voltageMax   = max    * volts * gain + offset;
+        data.voltageError = stddev / sqrt(filter.effectiveSamples(n)) * volts * gain;
 
         // raw copies
         data.rawVoltage    = data.voltage;
         data.rawVoltageMin = data.voltageMin;
         data.rawVoltageMax = data.voltageMax;
 
-        return (data);
+        // achieved timing
+        data.acquisitionTime = elapsed * 1e-9;
+        if (elapsed > 0)
+            data.sampleRate = nsamples / data.acquisitionTime;
+
+        return(data);
+    }
+
+    void CBC::ADC::setFilter(const filterConfig& filter)
+    {
+        m_filter = filter;
+    }
+
+    CBC::ADC::filterConfig CBC::ADC::getFilter()
+    {
+        return (m_filter);
+    }
+
+    // ADC Self-Calibration
+    //---------------------------------------------
+
+    void CBC::ADC::calibrate(int adc)
+    {
+        if ((adc > 1) | (adc < 0 ))
+            return;
+
+        int nsamples = m_defaultSamples;
+        if (nsamples <= 0)
+            return;
+
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::HOUSEKEEPING);
+
+        /* HIGH-, MID- and LOW- point references sit on consecutive channels 8-10.
+         * They are read without the calibration lock, which is only taken to
+         * publish the result. */
+        MirrorControlBoard::ADCStat stat[3];
+        measureInBursts(cbc->board(), *cbc->m_operations, adc, 8, 3, nsamples, stat, m_readDelay);
+
+        /* An incomplete measurement must not replace the correction */
+        if (cbc->board().getSPIError())
+            return;
+
+        /* Least-squares line through (nominal, measured) for the three references */
+        const float nominal[3] = {5.0, 2.5, 0.0};
+        float sx=0, sy=0, sxx=0, sxy=0;
+        for (int i=0; i<3; i++) {
+            float measured = 5.0 * stat[i].sum / (double(nsamples) * TLC3548::fullScaleUSB());
+            sx  += nominal[i];
+            sy  += measured;
+            sxx += nominal[i]*nominal[i];
+            sxy += nominal[i]*measured;
+        }
+        float slope     = (3*sxy - sx*sy) / (3*sxx - sx*sx);
+        float intercept = (sy - slope*sx) / 3;
+
+        /* A dead or disconnected reference would produce a nonsense scale; keep the old one */
+        if (!(slope > 0.5 && slope < 2.0))
+            return;
+
+        /* measured = slope*nominal + intercept, inverted */
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        m_adcGain            [adc] = 1.0f / slope;
+        m_adcOffset          [adc] = -intercept / slope;
+        m_adcCalibrationTime [adc] = cbc->board().monotonicNanos();
+        m_adcCalibrated      [adc] = true;
+
+        /* results kept for reuse were corrected with the old line */
+        m_scheduler->forget();
+    }
+
+    void CBC::ADC::refreshCalibration(int adc, float& gain, float& offset)
+    {
+        bool due = false;
+        if (m_calibrationInterval != 0) {
+            std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+            uint64_t age = cbc->board().monotonicNanos() - m_adcCalibrationTime[adc];
+            due = !m_adcCalibrated[adc] || age > uint64_t(m_calibrationInterval) * 1000000;
+        }
+
+        /* not under the lock, which calibrate() only takes to publish */
+        if (due)
+            calibrate(adc);
+
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        gain   = m_adcGain   [adc];
+        offset = m_adcOffset [adc];
+    }
+
+    void CBC::ADC::resetCalibration()
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        for (int i=0; i<2; i++) {
+            m_adcGain            [i] = 1;
+            m_adcOffset          [i] = 0;
+            m_adcCalibrationTime [i] = 0;
+            m_adcCalibrated      [i] = false;
+        }
+        m_scheduler->forget();
+    }
+
+    float CBC::ADC::getCalibrationGain(int adc)
+    {
+        if ((adc > 1) | (adc < 0 ))
+            return (1);
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        return (m_adcGain[adc]);
+    }
+
+    float CBC::ADC::getCalibrationOffset(int adc)
+    {
+        if ((adc > 1) | (adc < 0 ))
+            return (0);
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        return (m_adcOffset[adc]);
+    }
+
+    int CBC::ADC::getCalibrationInterval()
+    {
+        return (m_calibrationInterval);
+    }
+
+    void CBC::ADC::setCalibrationInterval(int interval)
+    {
+        if (interval >= 0)
+            m_calibrationInterval = interval;
+    }
+
+    void CBC::ADC::setFixedPoint(bool enable)
+    {
+        m_fixedPoint = enable;
+        m_scheduler->forget();
+    }
+
+    bool CBC::ADC::isFixedPoint()
+    {
+        return (m_fixedPoint);
+    }
+
+    // Measurement Coalescing
+    //---------------------------------------------
+
+    void CBC::ADC::setCoalescing(bool enable)
+    {
+        m_scheduler->setEnabled(enable);
+    }
+
+    bool CBC::ADC::isCoalescing()
+    {
+        return (m_scheduler->isEnabled());
+    }
+
+    void CBC::ADC::setCoalescingMaxAge(int maxAge)
+    {
+        m_scheduler->setMaxAge(maxAge);
+    }
+
+    int CBC::ADC::getCoalescingMaxAge()
+    {
+        return (m_scheduler->getMaxAge());
     }
 
     // Encoder Readout
@@ -491,7 +1156,7 @@ void usleep2 (int usdelay)
         /* we count from zero in MCB */
         iencoder = (iencoder-1);
 
-        usleep2(cbc->getDelayTime());
+        cbc->board().sleepMicros(cbc->getDelayTime());
         data = measure(0,iencoder,nsamples);
 
         /* Encoder Voltage Voltage Circuit Offset and Slope Correction
@@ -511,27 +1176,84 @@ void usleep2 (int usdelay)
         *
         *  a = voltage_offset
         *  b = voltage_slope CORRECTION
-        *  c = temperature_slope
-        *  d = temperature_offset
+        *  c = temperature_offset
+        *  d = temperature_slope
         *
-        *  This correction is applied below.
+        *  This correction is applied below, through the shift and gain cached by updateEncoderCorrection.
         */
 
-        float voltage_offset     = getEncoderVoltageOffset     (iencoder+1);  // we count from one in CBC
-        float voltage_slope      = getEncoderVoltageSlope      (iencoder+1);  // we count from one in CBC
-
-        float temperature_offset = getEncoderTemperatureOffset (iencoder+1);  // we count from one in CBC
-        float temperature_slope  = getEncoderTemperatureSlope  (iencoder+1);  // we count from one in CBC
+        float temperature = readTemperatureVolts().voltage;
 
-        float temperature_diff = (readTemperatureVolts().voltage - getEncoderTemperatureRef());
+        float shift, gain;
+        {
+            std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+            updateEncoderCorrection(temperature);
+            shift = m_calibration.shift[iencoder];
+            gain  = m_calibration.gain [iencoder];
+        }
 
         // correct data
-        data.voltage    = (data.voltage    - voltage_offset - temperature_offset*temperature_diff ) /
-                            (1+voltage_slope + temperature_slope*temperature_diff);
-        data.voltageMin = (data.voltageMin - voltage_offset - temperature_offset*temperature_diff ) /
-                            (1+voltage_slope + temperature_slope*temperature_diff);
-        data.voltageMax = (data.voltageMax - voltage_offset - temperature_offset*temperature_diff ) /
-                            (1+voltage_slope + temperature_slope*temperature_diff);
+        data.voltage    = (data.voltage    - shift) * gain;
+        data.voltageMin = (data.voltageMin - shift) * gain;
+        data.voltageMax = (data.voltageMax - shift) * gain;
+
+        if (data.status == STATUS_OK)
+            cbc->publishReadings(iencoder, 1, &data.voltage, temperature);
+
+        return(data);
+    }
+
+    std::array<CBC::ADC::adcData,6> CBC::ADC::readAllEncoders ()
+    {
+        return(readAllEncoders(m_defaultSamples));
+    }
+
+    std::array<CBC::ADC::adcData,6> CBC::ADC::readAllEncoders (int nsamples)
+    {
+        std::array<adcData,6> data;
+        memset(data.data(), 0, sizeof(data));
+
+        if (nsamples <= 0)
+            return(data);
+
+        cbc->board().sleepMicros(cbc->getDelayTime());
+
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::MEASUREMENT);
+
+        Metrics::Timer timer(Metrics::LATENCY_MEASURE);
+        Metrics::count(Metrics::ADC_MEASUREMENTS);
+        Metrics::count(Metrics::ADC_SAMPLES, 7*nsamples);
+
+        float gain, offset;
+        refreshCalibration(0, gain, offset);
+
+        /* Encoders on channels 0-5 and the onboard temperature sensor on
+         * channel 6 in one interleaved acquisition (see readEncoder) */
+        MirrorControlBoard::ADCStat stat[7];
+        uint64_t elapsed = measureInBursts(cbc->board(), *cbc->m_operations, 0, 0, 7, nsamples, stat, m_readDelay);
+
+        int status = cbc->board().getSPIError();
+
+        float raw [3][6];
+        for (int i=0; i<6; i++) {
+            data[i]   = statData(stat[i], nsamples, elapsed, gain, offset, status, m_fixedPoint);
+            raw[0][i] = data[i].voltage;
+            raw[1][i] = data[i].voltageMin;
+            raw[2][i] = data[i].voltageMax;
+        }
+
+        float corrected [3][6];
+        float temperature = statData(stat[6], nsamples, elapsed, gain, offset, status, m_fixedPoint).voltage;
+        correctEncoders(&raw[0][0], 3, temperature, &corrected[0][0]);
+
+        for (int i=0; i<6; i++) {
+            data[i].voltage    = corrected[0][i];
+            data[i].voltageMin = corrected[1][i];
+            data[i].voltageMax = corrected[2][i];
+        }
+
+        if (status == STATUS_OK)
+            cbc->publishReadings(0, 6, corrected[0], temperature);
 
         return(data);
     }
@@ -545,17 +1267,21 @@ void usleep2 (int usdelay)
         assert(iencoder<7);
 
         iencoder = (iencoder-1);
-        return (m_encoderTemperatureSlope[iencoder]);
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        return (m_calibration.temperatureSlope[iencoder]);
     }
 
     void CBC::ADC::setEncoderTemperatureRef   (float ref)
     {
-        m_encoderTemperatureRef = ref;
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        m_calibration.temperatureRef = ref;
+        m_calibration.valid = false;
     }
 
     float CBC::ADC::getEncoderTemperatureRef ()
     {
-        return (m_encoderTemperatureRef);
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        return (m_calibration.temperatureRef);
     }
 
     void CBC::ADC::setEncoderTemperatureSlope (int iencoder, float slope)
@@ -564,7 +1290,9 @@ void usleep2 (int usdelay)
         assert(iencoder<7);
 
         iencoder = (iencoder-1);
-        m_encoderTemperatureSlope[iencoder] = slope;
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        m_calibration.temperatureSlope[iencoder] = slope;
+        m_calibration.valid = false;
     }
 
     float CBC::ADC::getEncoderTemperatureOffset(int iencoder)
@@ -573,7 +1301,8 @@ void usleep2 (int usdelay)
         assert(iencoder<7);
 
         iencoder = (iencoder-1);
-        return (m_encoderTemperatureOffset[iencoder]);
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        return (m_calibration.temperatureOffset[iencoder]);
     }
 
     void CBC::ADC::setEncoderTemperatureOffset (int iencoder, float offset)
@@ -582,7 +1311,9 @@ void usleep2 (int usdelay)
         assert(iencoder<7);
 
         iencoder = (iencoder-1);
-        m_encoderTemperatureOffset[iencoder] = offset;
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        m_calibration.temperatureOffset[iencoder] = offset;
+        m_calibration.valid = false;
     }
 
     float CBC::ADC::getEncoderVoltageSlope(int iencoder)
@@ -591,7 +1322,8 @@ void usleep2 (int usdelay)
         assert(iencoder<7);
 
         iencoder = (iencoder-1);
-        return (m_encoderVoltageSlope[iencoder]);
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        return (m_calibration.voltageSlope[iencoder]);
     }
 
     void CBC::ADC::setEncoderVoltageSlope (int iencoder, float slope)
@@ -600,7 +1332,9 @@ void usleep2 (int usdelay)
         assert(iencoder<7);
 
         iencoder = (iencoder-1);
-        m_encoderVoltageSlope[iencoder] = slope;
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        m_calibration.voltageSlope[iencoder] = slope;
+        m_calibration.valid = false;
     }
 
     float CBC::ADC::getEncoderVoltageOffset(int iencoder)
@@ -609,7 +1343,8 @@ void usleep2 (int usdelay)
         assert(iencoder<7);
 
         iencoder = (iencoder-1);
-        return (m_encoderVoltageOffset[iencoder]);
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        return (m_calibration.voltageOffset[iencoder]);
     }
 
     void CBC::ADC::setEncoderVoltageOffset (int iencoder, float offset)
@@ -618,7 +1353,55 @@ void usleep2 (int usdelay)
         assert(iencoder<7);
 
         iencoder = (iencoder-1);
-        m_encoderVoltageOffset[iencoder] = offset;
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+        m_calibration.voltageOffset[iencoder] = offset;
+        m_calibration.valid = false;
+    }
+
+    // Encoder Correction
+    //---------------------------------------------
+
+    /* Folds the calibration at the given temperature into one shift and one
+     * gain per encoder, V_act = (V_meas - shift) * gain, so that the per-reading
+     * correction below is a single multiply-add with no division. */
+    void CBC::ADC::updateEncoderCorrection (float temperature)
+    {
+        EncoderCalibration &cal = m_calibration;
+
+        if (cal.valid && cal.temperature == temperature)
+            return;
+
+        float temperature_diff = temperature - cal.temperatureRef;
+
+        for (int i=0; i<8; i++) {
+            cal.shift[i] = cal.voltageOffset[i] + cal.temperatureOffset[i]*temperature_diff;
+            cal.gain [i] = 1.0f / (1 + cal.voltageSlope[i] + cal.temperatureSlope[i]*temperature_diff);
+        }
+
+        cal.temperature = temperature;
+        cal.valid       = true;
+    }
+
+    void CBC::ADC::correctEncoders (const float raw[6], float temperature, float out[6])
+    {
+        correctEncoders(raw, 1, temperature, out);
+    }
+
+    void CBC::ADC::correctEncoders (const float* __restrict raw, int nframes, float temperature, float* __restrict out)
+    {
+        std::lock_guard<std::recursive_mutex> lock(m_calibrationLock);
+
+        updateEncoderCorrection(temperature);
+
+        const float* __restrict shift = m_calibration.shift;
+        const float* __restrict gain  = m_calibration.gain;
+
+        for (int iframe=0; iframe<nframes; iframe++) {
+            for (int i=0; i<6; i++)
+                out[i] = (raw[i] - shift[i]) * gain[i];
+            raw += 6;
+            out += 6;
+        }
     }
 
 
@@ -632,7 +1415,10 @@ void usleep2 (int usdelay)
 
     float CBC::ADC::readTemperature(int nsamples)
     {
-        return((readTemperatureVolts(nsamples).voltage-0.5)*100);
+        adcData data = readTemperatureVolts(nsamples);
+        if (data.status == STATUS_OK)
+            cbc->publishReadings(0, 0, NULL, data.voltage);
+        return((data.voltage-0.5)*100);
     }
 
     CBC::ADC::adcData CBC::ADC::readTemperatureVolts ()
@@ -701,11 +1487,134 @@ void usleep2 (int usdelay)
             m_readDelay = delay;
     }
 
+    float CBC::ADC::getSampleRate()
+    {
+        if (m_readDelay == 0)
+            return (0);
+        return (1e9 / m_readDelay);
+    }
+
+    void CBC::ADC::setSampleRate(float rate)
+    {
+        if (rate == 0) {
+            m_readDelay = 0;
+            return;
+        }
+
+        /* negative, NaN, or so slow that the delay would not fit an int */
+        double delay = 1e9 / rate + 0.5;
+        if (rate > 0 && delay < INT_MAX)
+            m_readDelay = static_cast<int>(delay);
+    }
+
+    int CBC::ADC::getSPIClock()
+    {
+        return (cbc->board().getSPIClock());
+    }
+
+    int CBC::ADC::setSPIClock(int rate, int granularity, int csTime)
+    {
+        if (rate <= 0)
+            return (getSPIClock());
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::HOUSEKEEPING);
+        return (cbc->board().setSPIClock(rate, granularity, csTime));
+    }
+
+    /* Mean, min and max of the references (channels 8-10) of both ADCs, in volts */
+    struct ReferenceReading { float mean, min, max; };
+
+    static bool measureReferences(MirrorControlBoard& board, OperationScheduler& operations, int nsamples, int readDelay, ReferenceReading readings[2][3])
+    {
+        if (nsamples <= 0)
+            return (false);
+        for (int iadc=0; iadc<2; iadc++) {
+            MirrorControlBoard::ADCStat stat[3];
+            measureInBursts(board, operations, iadc, 8, 3, nsamples, stat, readDelay);
+            if (board.getSPIError())
+                return (false);
+            for (int i=0; i<3; i++) {
+                readings[iadc][i].mean = 5.0 * stat[i].sum / (double(nsamples) * TLC3548::fullScaleUSB());
+                readings[iadc][i].min  = 5.0 * stat[i].min / TLC3548::fullScaleUSB();
+                readings[iadc][i].max  = 5.0 * stat[i].max / TLC3548::fullScaleUSB();
+            }
+        }
+        return (true);
+    }
+
+    int CBC::ADC::tuneSPIClock(float tolerance, int maxRate)
+    {
+        /* 1.5 MHz: slow enough to read correctly on any board */
+        const int safeRate = 1500000;
+
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::HOUSEKEEPING);
+
+        ReferenceReading safe[2][3];
+        cbc->board().setSPIClock(safeRate, 1);
+        if (!measureReferences(cbc->board(), *cbc->m_operations, m_defaultSamples, m_readDelay, safe))
+            return (safeRate);
+
+        /* Try each integer divider of 48 MHz, fastest first */
+        for (int ratio=1; 48000000/ratio > safeRate; ratio++) {
+            int rate = 48000000/ratio;
+            if (rate > maxRate)
+                continue;
+
+            cbc->board().setSPIClock(rate, 1);
+
+            ReferenceReading trial[2][3];
+            bool good = measureReferences(cbc->board(), *cbc->m_operations, m_defaultSamples, m_readDelay, trial);
+
+            for (int iadc=0; good && iadc<2; iadc++) {
+                for (int i=0; i<3; i++) {
+                    if (fabs(trial[iadc][i].mean - safe[iadc][i].mean) > tolerance ||
+                            trial[iadc][i].min < safe[iadc][i].min - tolerance ||
+                            trial[iadc][i].max > safe[iadc][i].max + tolerance)
+                        good = false;
+                }
+            }
+
+            if (good)
+                return (rate);
+        }
+
+        return (cbc->board().setSPIClock(safeRate, 1));
+    }
+
+    void CBC::ADC::setSPITimeout(int timeout, int retries)
+    {
+        if (timeout >= 0 && retries >= 0)
+            cbc->board().setSPITimeout(timeout, retries);
+    }
+
+    CBC::ADC::spiStats CBC::ADC::getSPIStats()
+    {
+        SpiTransport::Stats counters = cbc->board().getSPIStats();
+
+        spiStats stats;
+        stats.words        = counters.words;
+        stats.polls        = counters.polls;
+        stats.retries      = counters.retries;
+        stats.stalls       = counters.stalls;
+        stats.timeouts     = counters.timeouts;
+        stats.pollsPerWord = counters.words ? float(counters.polls) / counters.words : 0;
+
+        return (stats);
+    }
+
+    void CBC::ADC::resetSPIStats()
+    {
+        cbc->board().resetSPIStats();
+    }
+
     void CBC::ADC::setDefaultSamples(int nsamples) {
         if (nsamples > 0)
             m_defaultSamples = nsamples;
     }
 
+    int CBC::ADC::getDefaultSamples() {
+        return m_defaultSamples;
+    }
+
 //----------------------------------------------------------------------------------------------------------------------
 // Sensor Control
 //----------------------------------------------------------------------------------------------------------------------
@@ -716,15 +1625,19 @@ void usleep2 (int usdelay)
 
     void CBC::AUXsensor::enable()
     {
-        MirrorControlBoard::powerUpSensors();
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::HOUSEKEEPING);
+        cbc->board().powerUpSensors();
+        cbc->publishStatus();
     }
 
     void CBC::AUXsensor::disable()
     {
-        MirrorControlBoard::powerDownSensors();
+        OperationScheduler::Turn turn(*cbc->m_operations, OperationScheduler::HOUSEKEEPING);
+        cbc->board().powerDownSensors();
+        cbc->publishStatus();
     }
 
     bool CBC::AUXsensor::isEnabled()
     {
-        return(MirrorControlBoard::isSensorsPoweredUp());
+        return(cbc->board().isSensorsPoweredUp());
     }
@@ -13,6 +13,7 @@
 #include <unistd.h>
 #include <stdint.h>
 #include <sys/mman.h>
+#include <time.h>
 #include <mcspiInterface.hpp>
 
 #define DEBUG 0
@@ -43,6 +44,11 @@
 #define TX_EN0                   BIT(16)
 #define TX_EN1                   BIT(17)
 #define FORCE                    BIT(20)
+#define CLKG                     BIT(29)
+#define EXTCLK                   (0xFF << 8)
+
+// MCSPI functional clock
+#define MCSPI_FCLK               48000000
 
 #define SYSCONFIG_SOFTRESET      BIT(1)
 #define SYSCONFIG_AUTOIDLE       BIT(0)
@@ -51,6 +57,21 @@
 
 #define WAKEUPENABLE            BIT(0)
 
+#define IRQ_TX0_EMPTY            BIT(0)
+#define IRQ_RX0_FULL             BIT(2)
+#define IRQ_EOW                  BIT(17)
+
+#define CHSTAT_EOT               BIT(2)
+#define CHSTAT_RXFFE             BIT(5)
+
+#define FFEW                     BIT(27)
+#define FFER                     BIT(28)
+
+// With both FIFOs enabled, each direction gets 32 bytes, i.e. 16 16-bit words.
+// Refills are done in half-FIFO chunks, signalled through XFERLEVEL AEL/AFL.
+#define FIFO_WORDS               16
+#define FIFO_CHUNK_WORDS         8
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -66,100 +87,61 @@
 #define FATAL do { fprintf(stderr, "Error at line %d, file %s (%d) [%s]\n", \
         __LINE__, __FILE__, errno, strerror(errno)); exit(1); } while(0)
 
-#define MAP_SIZE 4096UL
-#define MAP_MASK (MAP_SIZE - 1)
+// Polls between checks of the clock while waiting; the clock is only read
+// once a wait is already slower than usual
+#define POLLS_PER_CLOCK_CHECK    64
+
 
 //------------------------------------------------------------------------------
 // Public Members
 //------------------------------------------------------------------------------
 
 // constructor
-mcspiInterface::mcspiInterface() :
-    cm_fclken1_core   (NULL),
-    cm_iclken1_core   (NULL),
-    mcspi_sysconfig   (NULL),
-    mcspi_sysstatus   (NULL),
-    mcspi_wakeupenable(NULL),
-    mcspi_modulctrl   (NULL),
-    mcspi_chconf      (NULL),
-    mcspi_chstat      (NULL),
-    mcspi_chctrl      (NULL),
-    mcspi_tx          (NULL),
-    mcspi_rx          (NULL),
-    mcspi_irqstatus   (NULL),
-    mcspi_irqenable   (NULL),
-    m_mmap_fd(-1),
-    m_cm_core_base(NULL),
-    m_mcspi1_base(NULL)
-    //m_padconf(),
+mcspiInterface::mcspiInterface(RegisterBackend& registers, bool warm) :
+    m_chconf          (0),
+    m_chconfWritten   (0),
+    m_chctrl          (0)
 {
     debug_print("%s\n", "Start of MCSPI Constructor");
 
-
-    // open /dev/mem and check for failure
-    m_mmap_fd = open("/dev/mem", O_RDWR | O_SYNC);
-    if(m_mmap_fd<0)
-    {
-        perror("open(\"/dev/mem\")");
-        exit(EXIT_FAILURE);
+    int mcspi1  = registers.map(ADR_MCSPI_BASE);
+    int cm_core = registers.map(ADR_CM_CORE_BASE);
+
+    cm_fclken1_core    .bind(registers, cm_core, OFF_CM_FCLKEN1_CORE);
+    cm_iclken1_core    .bind(registers, cm_core, OFF_CM_ICLKEN1_CORE);
+
+    mcspi_sysconfig    .bind(registers, mcspi1, OFF_MCSPI_SYSCONFIG);
+    mcspi_sysstatus    .bind(registers, mcspi1, OFF_MCSPI_SYSSTATUS);
+    mcspi_wakeupenable .bind(registers, mcspi1, OFF_MCSPI_WAKEUPENABLE);
+    mcspi_modulctrl    .bind(registers, mcspi1, OFF_MCSPI_MODULCTRL);
+    mcspi_chconf       .bind(registers, mcspi1, OFF_MCSPI_CHCONF);
+    mcspi_chstat       .bind(registers, mcspi1, OFF_MCSPI_CHSTAT);
+    mcspi_chctrl       .bind(registers, mcspi1, OFF_MCSPI_CHCTRL);
+    mcspi_tx           .bind(registers, mcspi1, OFF_MCSPI_TX);
+    mcspi_rx           .bind(registers, mcspi1, OFF_MCSPI_RX);
+    mcspi_irqstatus    .bind(registers, mcspi1, OFF_MCSPI_IRQSTATUS);
+    mcspi_irqenable    .bind(registers, mcspi1, OFF_MCSPI_IRQENABLE);
+    mcspi_xferlevel    .bind(registers, mcspi1, OFF_MCSPI_XFERLEVEL);
+
+    if (warm && IsSetUp()) {
+        /* Take over the register contents; ConfigureInterruptMode then writes
+         * the channel configuration only if it differs */
+        m_chconf         = mcspi_chconf;
+        m_chctrl         = mcspi_chctrl & ~CHANNEL_ENABLE;
+        m_chconfWritten  = m_chconf;
     }
+    else
+        Reset();
+    ConfigureInterruptMode();
 
-    //      virtual adr     physical adr
-    m_mcspi1_base  = makeMap(ADR_MCSPI_BASE);
-    m_cm_core_base = makeMap(ADR_CM_CORE_BASE);
-
-
-    cm_fclken1_core    = mappedAddress(OFF_CM_FCLKEN1_CORE, m_cm_core_base);
-    cm_iclken1_core    = mappedAddress(OFF_CM_ICLKEN1_CORE, m_cm_core_base);
-
-    mcspi_sysconfig    = mappedAddress(OFF_MCSPI_SYSCONFIG , m_mcspi1_base);
-    mcspi_sysstatus    = mappedAddress(OFF_MCSPI_SYSSTATUS , m_mcspi1_base);
-    mcspi_wakeupenable = mappedAddress(OFF_MCSPI_WAKEUPENABLE , m_mcspi1_base);
-    mcspi_modulctrl    = mappedAddress(OFF_MCSPI_MODULCTRL, m_mcspi1_base);
-    mcspi_chconf       = mappedAddress(OFF_MCSPI_CHCONF, m_mcspi1_base);
-    mcspi_chstat       = mappedAddress(OFF_MCSPI_CHSTAT, m_mcspi1_base);
-    mcspi_chctrl       = mappedAddress(OFF_MCSPI_CHCTRL, m_mcspi1_base);
-    mcspi_tx           = mappedAddress(OFF_MCSPI_TX, m_mcspi1_base);
-    mcspi_rx           = mappedAddress(OFF_MCSPI_RX, m_mcspi1_base);
-    mcspi_irqstatus    = mappedAddress(OFF_MCSPI_IRQSTATUS, m_mcspi1_base);
-    mcspi_irqenable    = mappedAddress(OFF_MCSPI_IRQENABLE, m_mcspi1_base);
-
-    //makeMap(m_padconf,      ADR_PADCONF_BASE);
     debug_print("%s\n", "End of MCSPI Constructor");
-
-    Reset();
 }
 
 // destructor
 mcspiInterface::~mcspiInterface()
 {
-    munmap(m_mcspi1_base, 4096);
-    munmap(m_cm_core_base, 4096);
-    //MUNMAP(m_padconf);
 }
 
-/* Initializes MCSPI Controller: Enables clocks, and performs soft-reset of the
- * MCSPI system
- */
-
-void* mcspiInterface::makeMap(off_t target)
-{
-    void *map_base = mmap(0, MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, m_mmap_fd, target & ~MAP_MASK);
-    if (map_base == (void*) -1)
-        exit(EXIT_FAILURE);
-
-    void *virt_address = static_cast<char *>(map_base) + (target & MAP_MASK);
-
-    return virt_address;
-}
-
-volatile uint32_t* mcspiInterface::mappedAddress(off_t offset, void* mappedBaseAddress)
-{
-    void* mappedAddress = static_cast<char *>(mappedBaseAddress) + offset;
-    return reinterpret_cast<volatile uint32_t*>(mappedAddress);
-}
-
-
 void mcspiInterface::EnableClocks()
 {
     /*  Clock Enable
@@ -167,10 +149,10 @@ void mcspiInterface::EnableClocks()
      */
 
     /* interface clock */
-    *cm_iclken1_core |= ENABLE_INTERFACE_CLOCK;
+    cm_iclken1_core |= ENABLE_INTERFACE_CLOCK;
 
     /* functional clock */
-    *cm_fclken1_core |= ENABLE_FUNCTIONAL_CLOCK;
+    cm_fclken1_core |= ENABLE_FUNCTIONAL_CLOCK;
 }
 
 void mcspiInterface::DisableClocks()
@@ -184,10 +166,10 @@ void mcspiInterface::DisableClocks()
      */
 
     /* interface clock */
-    *cm_iclken1_core &= ~ENABLE_INTERFACE_CLOCK;
+    cm_iclken1_core &= ~uint32_t(ENABLE_INTERFACE_CLOCK);
 
     /* functional clock */
-    *cm_fclken1_core &= ~ENABLE_FUNCTIONAL_CLOCK;
+    cm_fclken1_core &= ~uint32_t(ENABLE_FUNCTIONAL_CLOCK);
 }
 
 void mcspiInterface::Reset()
@@ -207,46 +189,70 @@ void mcspiInterface::Reset()
     debug_print("%s\n", "Finished Enabling Clocks");
 
     debug_print("Reset:mcspi_sysconfig%s\n", "");
-    *mcspi_sysconfig |= SYSCONFIG_SOFTRESET;
+    mcspi_sysconfig |= SYSCONFIG_SOFTRESET;
     debug_print("%s\n", "before while loop");
 
     // SPIm.MCSPI_SYSSTATUS[0] will be set to 1 when the reset is finished
     // wait until it is 1..
-    while (true)
-    {
-        debug_print("%s\n", "waiting while true");
-        if ( (*mcspi_sysstatus & RESETDONE)==1 )
-            break;
-    }
+    if (!WaitForBit(mcspi_sysstatus, RESETDONE))
+        fprintf(stderr, "mcspiInterface: timed out waiting for MCSPI reset\n");
 
     debug_print("%s\n", "sysconfig");
-    *mcspi_sysconfig |= (SYSCONFIG_AUTOIDLE | SYSCONFIG_ENAWAKEUP | SYSCONFIG_SMARTIDLE);
+    mcspi_sysconfig |= (SYSCONFIG_AUTOIDLE | SYSCONFIG_ENAWAKEUP | SYSCONFIG_SMARTIDLE);
 
     debug_print("%s\n", "wakeup");
-    *mcspi_wakeupenable |= WAKEUPENABLE;
+    mcspi_wakeupenable |= WAKEUPENABLE;
 
     debug_print("%s\n", "Set Master Mode");
     SetMasterMode();
 
+    /* Start the register images from the post-reset contents */
+    m_chconf         = mcspi_chconf;
+    m_chctrl         = mcspi_chctrl & ~CHANNEL_ENABLE;
+    m_chconfWritten  = m_chconf;
+
     debug_print("%s\n", "Disable Clocks");
     //DisableClocks();
 }
 
+bool mcspiInterface::IsSetUp()
+{
+    const uint32_t sysconfig = SYSCONFIG_AUTOIDLE | SYSCONFIG_ENAWAKEUP | SYSCONFIG_SMARTIDLE;
+
+    if ((cm_iclken1_core & ENABLE_INTERFACE_CLOCK) == 0 || (cm_fclken1_core & ENABLE_FUNCTIONAL_CLOCK) == 0)
+        return false;
+    if ((mcspi_sysstatus & RESETDONE) == 0)
+        return false;
+    if ((mcspi_sysconfig & sysconfig) != sysconfig || (mcspi_wakeupenable & WAKEUPENABLE) == 0)
+        return false;
+    return (mcspi_modulctrl & MASTER_SLAVE) == 0;
+}
+
 void mcspiInterface::EnableChannel()
 {
     // Start Channel
-    *mcspi_chctrl |= CHANNEL_ENABLE;
+    mcspi_chctrl = m_chctrl | CHANNEL_ENABLE;
 }
 
 void mcspiInterface::DisableChannel()
 {
     //Stop Channel
-    *mcspi_chctrl &= ~CHANNEL_ENABLE;
+    mcspi_chctrl = m_chctrl;
+}
+
+void mcspiInterface::CommitChannelConfig()
+{
+    /* One store of the composed image, and only when it differs from what
+     * the register already holds */
+    if (m_chconf != m_chconfWritten) {
+        mcspi_chconf   = m_chconf;
+        m_chconfWritten = m_chconf;
+    }
 }
 
 void mcspiInterface::SetMasterMode()
 {
-    *mcspi_modulctrl &= ~MASTER_SLAVE;
+    mcspi_modulctrl &= ~uint32_t(MASTER_SLAVE);
 
     // Manage CS with force
     //*mcspi_modulctrl |= 0x1;
@@ -273,132 +279,192 @@ void mcspiInterface::ConfigureInterruptMode()
     setTXfifoEnable(0);
     setRXfifoEnable(0);
     //setClockDividerGranularity (0);
+
+    CommitChannelConfig();
+
+    /* 2. Initialize interrupts: set the SPI1.MCSPI_IRQENABLE[3:0] field to 0x7.
+     *    Only the status bits are polled, but they are set regardless. */
+    mcspi_irqenable = (mcspi_irqenable & ~0xF) | 0x7;
 }
 
-uint16_t mcspiInterface::WriteRead(uint16_t data)
+void mcspiInterface::exchange(const uint16_t* tx, uint16_t* rx, size_t n)
 {
-    return((uint16_t) WriteReadInterruptMode(data));
+    /* Chip select still frames every word, as the TLC3548 needs, since
+     * FORCE is left clear */
+    if (n > 1) {
+        if (!WriteReadBurst(tx, rx, n))
+            for (size_t i=0; i<n; i++)
+                rx[i] = 0;
+        return;
+    }
+
+    for (size_t i=0; i<n; i++) {
+        uint32_t readdata;
+        if (!WriteReadInterruptMode(tx[i], readdata)) {
+            for (; i<n; i++)
+                rx[i] = 0;
+            return;
+        }
+        rx[i] = readdata;
+    }
 }
 
-uint32_t mcspiInterface::WriteReadInterruptMode(uint32_t data)
+bool mcspiInterface::WriteReadInterruptMode(uint32_t data, uint32_t& readdata)
 {
     ///* 20.6.2.6.3 Programming in Interrupt Mode
     // * This section follows the flow of Figure 20-26.
     // * 1. Initialize software variables: WRITE_COUNT = 0 and READ_COUNT = 0.
     // */
-    int         write_count = 0;
-    int         read_count  = 0;
-    int         nwrite      = 1;
-    int         nread       = 1;
-
-    uint32_t    readdata    = 0x0;
-
-    bool finished_reading = false;
-    while (!finished_reading) {
-        debug_print("%s\n", "Start Reset");
-        //Reset();
-        debug_print("%s\n", "End Reset");
-
-        ///* 2. Initialize interrupts: Write 0x7 in the SPI1.MCSPI_IRQSTATUS[3:0]
-        //*     field and set the SPI1.MCSPI_IRQENABLE[3:0] field to 0x7.
-        //*/
-        *mcspi_irqenable &= ~0x7;
-        *mcspi_irqenable |=  0x7;
+    unsigned    nretry      = 0;
 
-        debug_print("%s\n", "irqenabled");
+    readdata = 0x0;
 
-        *mcspi_irqstatus &= ~0x7;
-        *mcspi_irqstatus |=  0x7;
+    /* The channel configuration and interrupt enables are programmed once by
+     * ConfigureInterruptMode; per word only IRQSTATUS, TX, RX and CHCTRL are
+     * touched. Steps follow 20.6.2.6.3, Programming in Interrupt Mode. */
+    CommitChannelConfig();
 
-        debug_print("%s %08x\n", "irqstatus updated", *mcspi_irqstatus);
-
-        /* 3. Follow the steps described in Section 20.6.2.6.2.1.1, Mode Selection.  */
-        ConfigureInterruptMode();
-
-        /* Clock Initialization and spi1_cs0 Enable
-         * In master mode, the SPI must provide the clock and enable the channel:
-         * Set the SPI1.MCSPI_MODULCTRL[2] MS bit to 0 to provide the clock.
-         */
-        SetMasterMode();
-
-        /*     Set the INPUTENABLE bit of the corresponding CONTROL_PADCONF_x
-         *     register to achieve the synchronous clock by using loopback through
-         *     the output and input buffers of the pad.
-         *
-         *     CONTROL_PADCONF_MCSPI1_CLK[15:0]
-         *     0x4800 21C8
-         *     Section 13.4.4
-         *     Bit 8 == Input Enable
-         */
-
-        //this should be uncommented
-        //*mcspiPadConf |= 0x1 << 8;
+    uint64_t rxTimeout = m_timeout_ns ? WordNanos() + m_timeout_ns : 0;
 
+    while (true) {
+        /* Clear any stale TX0_EMPTY/TX0_UNDERFLOW/RX0_FULL status (write 1 to clear) */
+        mcspi_irqstatus = 0x7;
 
         /* Set the SPI1.MCSPI_CHxCTRL[0] EN bit to 1 (where x = 0) to enable channel 0. */
         EnableChannel();
 
-        // assert !CS
-        //*mcspi_chconf &= ~(FORCE);
-
         /* 4. If WRITE_COUNT = w and READ_COUNT = w, write SPI1.MCSPI_CHxCTRL[0] = 0x0 (x = 0) to stop
          *    the channel.  This interrupt routine follows the flow of Table
          *    20-16 and Figure 20-28.
          *      1. Read the SPI1.MCSPI_IRQSTATUS[3:0] field.
          *      2. If the SPI1.MCSPI_IRQSTATUS[0] TX0_EMPTY bit is set to 1:
          */
-
-        int read_attempts = 0;
-        while (write_count < nwrite)
-        {
-            /*  2. If the SPI1.MCSPI_IRQSTATUS[0] TX0_EMPTY bit is set to 1: */
-            if ((*mcspi_irqstatus & 0x1)==1)
-            {
-                //printf("Writing Data: %04x\n", data);
-                /* (a) Write the command/address or data value in SPI1.MCSPI_TXx (where x = 0). */
-                *mcspi_tx = data;
-                /* (b) WRITE_COUNT + = 1 */
-                write_count++;
-                /* (c) Write SPI1.MCSPI_IRQSTATUS[0] = 0x1. */
-                *mcspi_irqstatus |= 0x1;
-            }
+        if (!WaitForBit(mcspi_irqstatus, IRQ_TX0_EMPTY)) {
+            DisableChannel();
+            return false;
         }
 
-        while (read_count < nread)
-        {
-            //usleep(1);
-            //printf("Waiting for read\n");
-            /* 3. If the SPI1.MCSPI_IRQSTATUS[2] RX0_FULL bit is set to 1: */
-            if (((*mcspi_irqstatus >> 2) & 0x1)==1)
-            {
-                /* a) Read SPI1.MCSPI_RXx (where x = 0) */
-                //readdata = (*mcspi_rx >> 16) & 0xFFFF;
-                readdata = (*mcspi_rx & 0xFFFF);
-                //printf("Read Data: %04x\n",readdata);
-                /* b) READ_COUNT += 1 */
-                read_count++;
-                /* c) Write SPI1.MCSPI_IRQSTATUS[2] = 0x1 */
-                *mcspi_irqstatus |= (0x1 << 2);
-                finished_reading = true;
-            }
-            else {
-                read_attempts += 1;
-                if (read_attempts > 5) {
-                    debug_print("%s\n","Stalled... reset");
-                    write_count = 0;
-                    break;
-                }
-            }
+        /* (a) Write the command/address or data value in SPI1.MCSPI_TXx (where x = 0). */
+        mcspi_tx = data;
+        /* (c) Write SPI1.MCSPI_IRQSTATUS[0] = 0x1. */
+        mcspi_irqstatus = 0x1;
+
+        /* 3. If the SPI1.MCSPI_IRQSTATUS[2] RX0_FULL bit is set to 1. It is
+         *    within a word time at the current clock; a word still unanswered
+         *    past that and the timeout has stalled and is re-sent. */
+        if (PollForBit(mcspi_irqstatus, IRQ_RX0_FULL, rxTimeout)) {
+            /* a) Read SPI1.MCSPI_RXx (where x = 0) */
+            readdata = (mcspi_rx & 0xFFFF);
+            /* c) Write SPI1.MCSPI_IRQSTATUS[2] = 0x1 */
+            mcspi_irqstatus = 0x4;
+            DisableChannel();
+            m_stats.words++;
+            return true;
         }
+
         DisableChannel();
-    }
+        debug_print("%s\n","Stalled... reset");
 
-    return readdata;
+        if (nretry == 0)
+            m_stats.stalls++;
+        if (nretry == m_retryLimit) {
+            m_error = ERR_STALL;
+            return false;
+        }
+        nretry++;
+        m_stats.retries++;
+    }
 
     // deassert !CS
     //*mcspi_chconf |= (FORCE);
 }
 
+bool mcspiInterface::WriteReadBurst(const uint16_t* tx, uint16_t* rx, size_t n)
+{
+    if (n == 0)
+        return true;
+
+    /* 20.6.2.8 FIFO Buffer Management: with FFEW/FFER set, TX0_EMPTY means
+     * the TX FIFO has room for AEL+1 bytes and RX0_FULL means the RX FIFO holds
+     * AFL+1 bytes, so each event moves a whole chunk. WCNT counts the words of
+     * the transfer when it fits the 16-bit field; otherwise it is left at 0
+     * (unbounded) and the channel is simply stopped after the last word. */
+    const uint32_t chunk_bytes = FIFO_CHUNK_WORDS * sizeof(uint16_t);
+    uint32_t wcnt = (n <= 0xFFFF) ? n : 0;
+
+    DisableChannel();
+    setTXfifoEnable(1);
+    setRXfifoEnable(1);
+    CommitChannelConfig();
+
+    mcspi_xferlevel = (wcnt << 16) | ((chunk_bytes-1) << 8) | (chunk_bytes-1);
+    mcspi_irqstatus = IRQ_TX0_EMPTY | IRQ_RX0_FULL | IRQ_EOW | 0x2;
+
+    EnableChannel();
+
+    size_t nsent     = 0;
+    size_t nreceived = 0;
+
+    /* Polls without progress, for the timeout */
+    uint32_t npoll    = 0;
+    uint64_t deadline = 0;
+
+    while (nreceived < n) {
+        size_t progress = nsent + nreceived;
+
+        uint32_t irqstatus = mcspi_irqstatus;
+        m_stats.polls++;
+
+        /* Refill the TX FIFO a chunk at a time, never running more than a
+         * FIFO's worth ahead of the receive side */
+        if ((irqstatus & IRQ_TX0_EMPTY) && nsent < n && nsent - nreceived + FIFO_CHUNK_WORDS <= FIFO_WORDS) {
+            size_t nchunk = n - nsent;
+            if (nchunk > FIFO_CHUNK_WORDS)
+                nchunk = FIFO_CHUNK_WORDS;
+            for (size_t i=0; i<nchunk; i++)
+                mcspi_tx = tx[nsent++];
+            mcspi_irqstatus = IRQ_TX0_EMPTY;
+        }
+
+        /* Drain a full chunk from the RX FIFO */
+        if (irqstatus & IRQ_RX0_FULL) {
+            for (size_t i=0; i<FIFO_CHUNK_WORDS && nreceived < n; i++)
+                rx[nreceived++] = mcspi_rx & 0xFFFF;
+            mcspi_irqstatus = IRQ_RX0_FULL;
+        }
+
+        /* The tail is shorter than a chunk and raises no RX0_FULL; drain it
+         * word by word once everything has been sent */
+        else if (nsent == n) {
+            while (nreceived < n && !(mcspi_chstat & CHSTAT_RXFFE))
+                rx[nreceived++] = mcspi_rx & 0xFFFF;
+        }
+
+        if (nsent + nreceived != progress) {
+            npoll    = 0;
+            deadline = 0;
+        }
+        else if (PollTimedOut(++npoll, deadline, m_timeout_ns)) {
+            m_stats.timeouts++;
+            m_error = ERR_TIMEOUT;
+            break;
+        }
+    }
+
+    /* Wait for the end of the last transfer before stopping the channel */
+    bool done = nreceived == n && WaitForBit(mcspi_chstat, CHSTAT_EOT);
+    if (done)
+        m_stats.words += n;
+
+    DisableChannel();
+    mcspi_xferlevel = 0;
+    setTXfifoEnable(0);
+    setRXfifoEnable(0);
+    CommitChannelConfig();
+
+    return done;
+}
+
 //bool mcspiInterface::txFifoFull ()
 //{
 //    //Read 0x0: FIFO Transmit Buffer is not full
@@ -407,25 +473,25 @@ uint32_t mcspiInterface::WriteReadInterruptMode(uint32_t data)
 //}
 //
 void mcspiInterface::setPhase(int phase) {
-    *mcspi_chconf &= ~(PHASE);
+    m_chconf &= ~(PHASE);
     if (phase) {
-        *mcspi_chconf |=  (PHASE);        //mcspi_chxconf[0]
+        m_chconf |=  (PHASE);        //mcspi_chxconf[0]
     }
 }
 void mcspiInterface::setPolarity(int polarity)
 {
-    *mcspi_chconf &= ~(POLARITY);
+    m_chconf &= ~(POLARITY);
     if (polarity)
     {
-        *mcspi_chconf |=  (POLARITY); //mcspi_chxconf[1]
+        m_chconf |=  (POLARITY); //mcspi_chxconf[1]
     }
 }
 
 void mcspiInterface::setClockDivider(int divider)
 {
     divider &= 0xF;
-    *mcspi_chconf &= ~(CLOCK_DIVIDER);         //mcspi_chxconf[5..2]
-    *mcspi_chconf |= (divider << 2);            //mcspi_chxconf[5..2]
+    m_chconf &= ~(CLOCK_DIVIDER);         //mcspi_chxconf[5..2]
+    m_chconf |= (divider << 2);            //mcspi_chxconf[5..2]
 }
 
 //spim_csx polarity
@@ -433,37 +499,37 @@ void mcspiInterface::setClockDivider(int divider)
 //0x1 => spim_csx low  during active state
 void mcspiInterface::setSPIMPolarity(int polarity)
 {
-    *mcspi_chconf &= ~(CS_POLARITY);
-    *mcspi_chconf |=  (polarity << 6); //mcspi_chxconf[6]
+    m_chconf &= ~(CS_POLARITY);
+    m_chconf |=  (polarity << 6); //mcspi_chxconf[6]
 }
 /*     5. Set the SPI1.MCSPI_CHxCONF[6] EPOL bit to 1 for spi1_cs0 activated low
  *     during active state.  clock.
  */
 void mcspiInterface::setEPOL(int epol) {
-    *mcspi_chconf &= ~EPOL;
-    *mcspi_chconf |= epol;
+    m_chconf &= ~EPOL;
+    m_chconf |= epol;
 }
 //set spi word length
 void mcspiInterface::setWordLength(int length)
 {
     length &= 0xF;
     int spi_word_length = length << 7;  //16 bit word length
-    *mcspi_chconf &= ~(SPI_WORD_LENGTH);
-    *mcspi_chconf |=  (spi_word_length); //mcspi_chxconf[11..7]
+    m_chconf &= ~(SPI_WORD_LENGTH);
+    m_chconf |=  (spi_word_length); //mcspi_chxconf[11..7]
 }
 
 void mcspiInterface::setTransferMode(int mode)
 {
     mode &= 0x3;
     mode = mode << 12;
-    *mcspi_chconf &= ~(SPI_TRANSFER_MODE);
-    *mcspi_chconf |=  (mode); //mcspi_chxconf[13..12]
+    m_chconf &= ~(SPI_TRANSFER_MODE);
+    m_chconf |=  (mode); //mcspi_chxconf[13..12]
 }
 
 void mcspiInterface::setInputSelect (int input_select)
 {
-    *mcspi_chconf &= ~(INPUT_SELECT);
-    *mcspi_chconf |= (input_select << 18);
+    m_chconf &= ~(INPUT_SELECT);
+    m_chconf |= (input_select << 18);
 }
 
 void mcspiInterface::setDPE01 (int dpe0, int dpe1)
@@ -474,44 +540,147 @@ void mcspiInterface::setDPE01 (int dpe0, int dpe1)
     dpe1 &= 0x1;
     dpe1  = dpe1 << 17;
 
-    *mcspi_chconf &= ~(TX_EN1);
-    *mcspi_chconf &= ~(TX_EN0);
-    *mcspi_chconf |=  (dpe0);
-    *mcspi_chconf |=  (dpe1);
+    m_chconf &= ~(TX_EN1);
+    m_chconf &= ~(TX_EN0);
+    m_chconf |=  (dpe0);
+    m_chconf |=  (dpe1);
 }
 
 void mcspiInterface::setChipSelectTimeControl (int time)
 {
     time &= 0x3;
-    *mcspi_chconf &= ~(0x3 << 25);
-    *mcspi_chconf |=  (time << 25);
+    m_chconf &= ~(0x3 << 25);
+    m_chconf |=  (time << 25);
 }
 
 void mcspiInterface::setTXfifoEnable (bool enable)
 {
     int tx_fifo_enable = enable << 27;
-    *mcspi_chconf &= ~(0x1 << 27);
-    *mcspi_chconf |= tx_fifo_enable;
+    m_chconf &= ~(0x1 << 27);
+    m_chconf |= tx_fifo_enable;
 }
 
 void mcspiInterface::setRXfifoEnable (bool enable)
 {
-    int rx_fifo_enable = enable << 27;
-    *mcspi_chconf &= ~(0x1 << 28);
-    *mcspi_chconf |= rx_fifo_enable;
+    int rx_fifo_enable = enable << 28;
+    m_chconf &= ~(0x1 << 28);
+    m_chconf |= rx_fifo_enable;
 }
 
 void mcspiInterface::setClockDividerGranularity (int granularity)
 {
-    int clock_divider_granularity = granularity << 29;
-    *mcspi_chconf &= (~0x1 << 29);
-    *mcspi_chconf |= clock_divider_granularity;
+    int clock_divider_granularity = (granularity & 0x1) << 29;
+    m_chconf &= ~(CLKG);
+    m_chconf |= clock_divider_granularity;
+}
+
+bool mcspiInterface::PollTimedOut(uint32_t npoll, uint64_t& deadline, uint64_t timeout_ns)
+{
+    if (timeout_ns == 0 || npoll % POLLS_PER_CLOCK_CHECK)
+        return false;
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint64_t now = static_cast<uint64_t>(ts.tv_sec)*1000000000ULL + ts.tv_nsec;
+
+    if (deadline == 0) {
+        deadline = now + timeout_ns;
+        return false;
+    }
+    return (now >= deadline);
+}
+
+bool mcspiInterface::PollForBit(Register& reg, uint32_t mask, uint64_t timeout_ns)
+{
+    uint64_t deadline = 0;
+
+    for (uint32_t npoll=1; ; npoll++) {
+        m_stats.polls++;
+        if (reg & mask)
+            return true;
+        if (PollTimedOut(npoll, deadline, timeout_ns))
+            return false;
+    }
+}
+
+bool mcspiInterface::WaitForBit(Register& reg, uint32_t mask)
+{
+    if (PollForBit(reg, mask, m_timeout_ns))
+        return true;
+
+    m_stats.timeouts++;
+    m_error = ERR_TIMEOUT;
+    return false;
+}
+
+uint64_t mcspiInterface::WordNanos()
+{
+    /* the word length, plus up to 3.5 cycles of chip select time on either side */
+    uint32_t bits = ((m_chconf & SPI_WORD_LENGTH) >> 7) + 1 + 8;
+    return (uint64_t(bits) * 1000000000ULL / getClockRate());
+}
+
+uint32_t mcspiInterface::setClockRate(uint32_t hz, int granularity)
+{
+    if (hz == 0)
+        hz = 1;
+
+    /* smallest ratio of the functional clock which does not exceed hz */
+    uint32_t ratio = (MCSPI_FCLK + hz - 1) / hz;
+    if (ratio < 1)
+        ratio = 1;
+
+    m_chctrl &= ~EXTCLK;
+
+    if (granularity) {
+        /* One clock granularity: ratio = EXTCLK.CLKD + 1, a 12-bit value */
+        if (ratio > 4096)
+            ratio = 4096;
+        uint32_t code = ratio - 1;
+        setClockDividerGranularity(1);
+        setClockDivider(code & 0xF);
+        m_chctrl |= (code >> 4) << 8;
+    }
+    else {
+        /* Power of two granularity: ratio = 2^CLKD */
+        int divider = 0;
+        while ((1u << divider) < ratio && divider < 15)
+            divider++;
+        ratio = 1u << divider;
+        setClockDividerGranularity(0);
+        setClockDivider(divider);
+    }
+
+    CommitChannelConfig();
+    mcspi_chctrl = m_chctrl;
+
+    return (MCSPI_FCLK / ratio);
+}
+
+uint32_t mcspiInterface::getClockRate()
+{
+    uint32_t clkd = (m_chconf & CLOCK_DIVIDER) >> 2;
+    uint32_t ratio;
+
+    if (m_chconf & CLKG)
+        ratio = ((((m_chctrl & EXTCLK) >> 8) << 4) | clkd) + 1;
+    else
+        ratio = 1u << clkd;
+
+    return (MCSPI_FCLK / ratio);
+}
+
+void mcspiInterface::setChipSelectTime(int cycles)
+{
+    setChipSelectTimeControl(cycles);
+    CommitChannelConfig();
 }
 
 void mcspiInterface::forceCS(bool state)
 {
     if (state)
-        *mcspi_chconf |=  FORCE;
+        m_chconf |=  FORCE;
     if (!state)
-        *mcspi_chconf &= ~FORCE;
+        m_chconf &= ~FORCE;
+    CommitChannelConfig();
 }
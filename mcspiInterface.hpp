@@ -5,25 +5,76 @@
 #include <stdint.h>
 #include <sys/mman.h>
 #include "Layout.hpp"
+#include "SpiTransport.hpp"
+#include "RegisterBackend.hpp"
 
-class mcspiInterface
+class mcspiInterface : public SpiTransport
 {
     public:
-        mcspiInterface();
+        // Maps MCSPI1 and CM_CORE through the register backend, then resets
+        // and configures the controller. With warm, a controller which is
+        // already clocked, out of reset and in master mode, e.g. by an earlier
+        // process, is taken over as it is instead.
+        mcspiInterface(RegisterBackend& registers, bool warm = false);
+
         ~mcspiInterface();
 
-        uint16_t WriteRead(uint16_t data);
+        // Transfers n words through the TX/RX FIFOs while keeping the
+        // channel enabled, rx[i] receiving the word clocked in with tx[i].
+        // Returns false if the transfer timed out (c.f. getError()).
+        bool WriteReadBurst(const uint16_t* tx, uint16_t* rx, size_t n);
+
+        // Sets the SPI clock to the fastest rate not above hz, derived from
+        // the 48 MHz functional clock. With granularity 0 the divider is a
+        // power of two (1..32768), with granularity 1 any integer (1..4096).
+        // Returns the resulting clock rate in Hz.
+        uint32_t setClockRate(uint32_t hz, int granularity = 0);
+        uint32_t getClockRate();
+
+        // Number of interface clock cycles (0-3, plus a half cycle) between
+        // chip select assertion and the first clock edge, and between the
+        // last edge and deassertion (MCSPI_CHxCONF.TCS)
+        void setChipSelectTime(int cycles);
+    protected:
+        // A single word per channel enable/disable cycle, several words as
+        // one FIFO burst
+        void exchange(const uint16_t* tx, uint16_t* rx, size_t n);
+
     private:
-        uint32_t WriteReadInterruptMode(uint32_t data);
+        // Polls reg until one of the bits in mask is set; returns false if
+        // the transport's timeout expires first, which is counted and
+        // recorded as ERR_TIMEOUT
+        bool WaitForBit(Register& reg, uint32_t mask);
+
+        // As WaitForBit, but bounded by timeout_ns (0 = no limit) and
+        // leaving the accounting of an expiry to the caller
+        bool PollForBit(Register& reg, uint32_t mask, uint64_t timeout_ns);
+
+        // Accounts for the npoll-th unsuccessful poll of a wait of up to
+        // timeout_ns (0 = no limit), starting the clock on the first check;
+        // returns true once expired
+        bool PollTimedOut(uint32_t npoll, uint64_t& deadline, uint64_t timeout_ns);
+
+        // Time to clock one word through at the current divider [ns]
+        uint64_t WordNanos();
+
+        // Returns false if the word failed (c.f. getError())
+        bool WriteReadInterruptMode(uint32_t data, uint32_t& readdata);
         void ConfigureInterruptMode();
 
         void EnableChannel  ();
         void DisableChannel ();
+
+        // Writes the channel configuration image to MCSPI_CHCONF, if it changed
+        void CommitChannelConfig ();
         void EnableClocks   ();
         void DisableClocks  ();
         void SetMasterMode  ();
         void Reset          ();
 
+        // Whether the controller is in the state Reset leaves it in
+        bool IsSetUp        ();
+
         void setPhase(int phase);
 
         void setPolarity(int polarity);
@@ -111,7 +162,7 @@ class mcspiInterface
 
         //const off_t OFF_MCSPI_REVISION      = 0x000;
         //const off_t OFF_MCSPI_SYST          = 0x024;
-        //const off_t OFF_MCSPI_XFERLEVEL     = 0x07C;
+        const off_t OFF_MCSPI_XFERLEVEL     = 0x07C;
 
         // Clock control
         // Bit 18 = EN_MCSPI1
@@ -128,39 +179,40 @@ class mcspiInterface
         //const off_t physMCSPIPadConf    = 0x48004A00;
 
         // --------------------------------------------------------------------------
-        // Pointers to mapped registers
+        // Mapped registers
         // --------------------------------------------------------------------------
 
-        volatile uint32_t* cm_fclken1_core    ;
-        volatile uint32_t* cm_iclken1_core    ;
-
-        volatile uint32_t* mcspi_sysconfig    ;
-        volatile uint32_t* mcspi_sysstatus    ;
-        volatile uint32_t* mcspi_wakeupenable ;
-        volatile uint32_t* mcspi_modulctrl    ;
-        volatile uint32_t* mcspi_chconf       ;
-        volatile uint32_t* mcspi_chstat       ;
-        volatile uint32_t* mcspi_chctrl       ;
-        volatile uint32_t* mcspi_tx           ;
-        volatile uint32_t* mcspi_rx           ;
-        volatile uint32_t* mcspi_irqstatus    ;
-        volatile uint32_t* mcspi_irqenable    ;
-
-        //volatile uint32_t* ptrMCSPIPadConf       ();
+        Register cm_fclken1_core    ;
+        Register cm_iclken1_core    ;
+
+        Register mcspi_sysconfig    ;
+        Register mcspi_sysstatus    ;
+        Register mcspi_wakeupenable ;
+        Register mcspi_modulctrl    ;
+        Register mcspi_chconf       ;
+        Register mcspi_chstat       ;
+        Register mcspi_chctrl       ;
+        Register mcspi_tx           ;
+        Register mcspi_rx           ;
+        Register mcspi_irqstatus    ;
+        Register mcspi_irqenable    ;
+        Register mcspi_xferlevel    ;
 
+        // --------------------------------------------------------------------------
+        // Register images
         // --------------------------------------------------------------------------
 
-        // Create a virtual addressing space for a given physical address
-        void* makeMap(off_t target);
-        volatile uint32_t* mappedAddress(off_t offset, void* mappedBaseAddress);
+        // The set* functions compose the channel configuration here; it is
+        // written to MCSPI_CHCONF in a single store by CommitChannelConfig
+        uint32_t m_chconf;
+        uint32_t m_chconfWritten;
 
-        // Memory mapped file descriptor
-        int             m_mmap_fd;
+        // MCSPI_CHCTRL without the channel enable bit
+        uint32_t m_chctrl;
 
-        // Pointer to base of memory mapped address space
-        void*  m_cm_core_base;
-        //volatile void*  m_padconf;
-        void*  m_mcspi1_base;
+        //volatile uint32_t* ptrMCSPIPadConf       ();
+
+        // --------------------------------------------------------------------------
 
         // utilities
         //bool txFifoFull ();
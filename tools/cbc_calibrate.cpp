@@ -0,0 +1,116 @@
+/*
+ * cbc_calibrate - fit the encoder voltage/temperature correction from logged
+ * readings and print it as CBC::Config assignments.
+ *
+ * Usage: cbc_calibrate [-t temperatureRef] [logfile ...]
+ *
+ * Each line of a log holds one point,
+ *
+ *      <encoder 1-6> <raw voltage> <temperature voltage> <reference voltage>
+ *
+ * separated by whitespace or commas. Blank lines and lines starting with '#'
+ * are skipped. With no log files, points are read from stdin.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <EncoderCalibration.hpp>
+
+static long readLog(FILE* log, EncoderCalibration& calibration)
+{
+    char line[256];
+    long npoints = 0;
+
+    while (fgets(line, sizeof(line), log)) {
+        char* p = line;
+        while (*p==' ' || *p=='\t')
+            p++;
+        if (*p=='#' || *p=='\n' || *p=='\0')
+            continue;
+
+        double field[4];
+        int    nfield = 0;
+        for (; nfield<4; nfield++) {
+            char* end;
+            field[nfield] = strtod(p, &end);
+            if (end == p)
+                break;
+            p = end;
+            while (*p==',' || *p==' ' || *p=='\t')
+                p++;
+        }
+
+        int iencoder = static_cast<int>(field[0]);
+        if (nfield < 4 || iencoder < 1 || iencoder > 6) {
+            fprintf(stderr, "cbc_calibrate: skipping malformed line: %s", line);
+            continue;
+        }
+
+        calibration.addPoint(iencoder, field[1], field[2], field[3]);
+        npoints++;
+    }
+
+    return (npoints);
+}
+
+static void printVector(const char* name, const std::vector<float>& values)
+{
+    printf("config.%-25s = {", name);
+    for (unsigned i=0; i<values.size(); i++)
+        printf("%s%.7g", i ? ", " : "", values[i]);
+    printf("};\n");
+}
+
+int main(int argc, char** argv)
+{
+    CBC::Config config;
+    float temperatureRef = config.encoderTemperatureRef;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:")) != -1) {
+        switch (opt) {
+            case 't':
+                temperatureRef = atof(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-t temperatureRef] [logfile ...]\n", argv[0]);
+                return (EXIT_FAILURE);
+        }
+    }
+
+    EncoderCalibration calibration(temperatureRef);
+
+    if (optind == argc) {
+        readLog(stdin, calibration);
+    }
+    else {
+        for (int i=optind; i<argc; i++) {
+            FILE* log = fopen(argv[i], "r");
+            if (!log) {
+                perror(argv[i]);
+                return (EXIT_FAILURE);
+            }
+            readLog(log, calibration);
+            fclose(log);
+        }
+    }
+
+    if (calibration.writeConfig(config) == 0) {
+        fprintf(stderr, "cbc_calibrate: no points\n");
+        return (EXIT_FAILURE);
+    }
+
+    for (int i=1; i<7; i++)
+        printf("// encoder %i: %llu points, rms residual %.3g V\n", i,
+                static_cast<unsigned long long>(calibration.getPoints(i)), calibration.getResidual(i));
+
+    printf("config.%-25s = %.7g;\n", "encoderTemperatureRef", config.encoderTemperatureRef);
+    printVector("encoderVoltageOffset",     config.encoderVoltageOffset);
+    printVector("encoderVoltageSlope",      config.encoderVoltageSlope);
+    printVector("encoderTemperatureOffset", config.encoderTemperatureOffset);
+    printVector("encoderTemperatureSlope",  config.encoderTemperatureSlope);
+
+    return (EXIT_SUCCESS);
+}
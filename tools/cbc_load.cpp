@@ -0,0 +1,400 @@
+/*
+ * cbc_load - drive cbc_server with a stream of pipelined requests and report
+ * the throughput and the latency distribution.
+ *
+ * Usage: cbc_load [-s socket | -t port] [-n requests] [-d depth] [-o op] [-b batch] [-k nsamples] [-m steps] [-x ms]
+ *
+ *   -s path    Unix socket of the server (default /tmp/cbc.sock)
+ *   -t port    connect to the server on TCP 127.0.0.1:port instead
+ *   -n count   requests to send (default 10000)
+ *   -d depth   requests kept in flight (default 1, i.e. no pipelining)
+ *   -o op      ping, state, read, all, temperature or step (default ping)
+ *   -b count   send each request as a batch of this many commands
+ *   -k count   samples per ADC read (default: the server's default)
+ *   -m steps   steps per step request (default 1)
+ *   -x ms      meanwhile, every ms disable all drives from a second
+ *              connection, then enable drive 1 again, and report the latency
+ *              of the disables
+ *
+ * The step op moves drive 1 back and forth, so it wants the drive enabled on
+ * the server (cbc_server -e 1). Latency is measured from writing a request to
+ * reading its response. E.g. cbc_load -o step -m 1000 -n 20 -x 50 shows how
+ * long a disableAll waits while another client is stepping.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <ServerProtocol.hpp>
+
+using namespace ServerProtocol;
+
+static uint64_t nanos()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return uint64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+static int connectUnix(const char* path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("cbc_load: socket");
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int connectTCP(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("cbc_load: socket");
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0) {
+        perror("cbc_load: connect");
+        close(fd);
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    return fd;
+}
+
+// Appends the op's arguments; the step op alternates direction with the id
+static void putArguments(Writer& request, int op, uint32_t id, int nsamples, int nsteps)
+{
+    switch (op) {
+        case OP_STEP:
+            request.put<int32_t>(1);
+            request.put<int32_t>((id & 1) ? -nsteps : nsteps);
+            request.put<int32_t>(0);
+            break;
+        case OP_READ_ENCODER:
+            request.put<int32_t>(1);
+            request.put<int32_t>(nsamples);
+            break;
+        case OP_READ_ALL:
+        case OP_READ_TEMPERATURE:
+            request.put<int32_t>(nsamples);
+            break;
+        default:
+            break;
+    }
+}
+
+static void putRequest(std::vector<uint8_t>& buffer, int op, uint32_t id, int batch, int nsamples, int nsteps)
+{
+    Writer request(buffer);
+    size_t frameAt = request.reserve<uint32_t>();
+    request.put<uint32_t>(id);
+
+    if (batch > 0) {
+        request.put<uint16_t>(OP_BATCH);
+        request.put<uint16_t>(0);
+        request.put<uint16_t>(batch);
+        for (int i=0; i<batch; i++) {
+            size_t lengthAt = request.reserve<uint16_t>();
+            request.put<uint16_t>(op);
+            putArguments(request, op, id + i, nsamples, nsteps);
+            request.patch<uint16_t>(lengthAt, request.size() - lengthAt - sizeof(uint16_t));
+        }
+    }
+    else {
+        request.put<uint16_t>(op);
+        request.put<uint16_t>(0);
+        putArguments(request, op, id, nsamples, nsteps);
+    }
+
+    request.patch<uint32_t>(frameAt, request.size() - frameAt - sizeof(uint32_t));
+}
+
+static bool writeAll(int fd, const std::vector<uint8_t>& buffer)
+{
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t n = write(fd, &buffer[written], buffer.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            perror("cbc_load: write");
+            return false;
+        }
+        written += n;
+    }
+    return true;
+}
+
+// Reads one whole response; false if the server went away
+static bool readResponse(int fd, std::vector<uint8_t>& response)
+{
+    uint32_t length = 0;
+    response.resize(sizeof(length));
+    for (size_t at = 0; at < response.size(); ) {
+        ssize_t n = read(fd, &response[at], response.size() - at);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        at += n;
+        if (at == sizeof(length)) {
+            memcpy(&length, &response[0], sizeof(length));
+            response.resize(sizeof(length) + length);
+        }
+    }
+    return true;
+}
+
+// Disables all drives every interval ms until done, timing each, then
+// enables drive 1 again for the load to go on stepping
+struct Probe {
+    int                   fd;
+    int                   interval;     // ms
+    std::atomic<bool>     done;
+    std::vector<uint64_t> latency;
+    int                   failures;
+};
+
+static void probe(Probe* probe)
+{
+    std::vector<uint8_t> request;
+    std::vector<uint8_t> response;
+    uint32_t             id = 0;
+
+    while (!probe->done) {
+        usleep(probe->interval * 1000);
+
+        for (int enable=0; enable<2; enable++) {
+            request.clear();
+            Writer writer(request);
+            size_t frameAt = writer.reserve<uint32_t>();
+            writer.put<uint32_t>(id++);
+            writer.put<uint16_t>(OP_DRIVE_ENABLE);
+            writer.put<uint16_t>(0);
+            writer.put<int32_t> (enable);
+            writer.put<int32_t> (enable);
+            writer.patch<uint32_t>(frameAt, request.size() - frameAt - sizeof(uint32_t));
+
+            uint64_t start = nanos();
+            if (!writeAll(probe->fd, request) || !readResponse(probe->fd, response)) {
+                probe->failures++;
+                return;
+            }
+            if (!enable)
+                probe->latency.push_back(nanos() - start);
+
+            Reader reader(&response[sizeof(uint32_t)], response.size() - sizeof(uint32_t));
+            reader.get<uint32_t>();
+            reader.get<uint16_t>();
+            if (reader.get<int16_t>() != STATUS_OK)
+                probe->failures++;
+        }
+    }
+}
+
+static void printLatency(const char* name, std::vector<uint64_t>& latency)
+{
+    if (latency.empty())
+        return;
+
+    std::sort(latency.begin(), latency.end());
+    double sum = 0;
+    for (unsigned i=0; i<latency.size(); i++)
+        sum += latency[i];
+
+    printf("%s [us]  mean %.2f  p50 %.2f  p99 %.2f  p99.9 %.2f  max %.2f\n",
+            name,
+            sum / latency.size() / 1000.0,
+            latency[size_t(0.500 * (latency.size() - 1))] / 1000.0,
+            latency[size_t(0.990 * (latency.size() - 1))] / 1000.0,
+            latency[size_t(0.999 * (latency.size() - 1))] / 1000.0,
+            latency.back() / 1000.0);
+}
+
+static int parseOp(const char* name)
+{
+    if (!strcmp(name, "ping"))        return OP_PING;
+    if (!strcmp(name, "state"))       return OP_GET_STATE;
+    if (!strcmp(name, "read"))        return OP_READ_ENCODER;
+    if (!strcmp(name, "all"))         return OP_READ_ALL;
+    if (!strcmp(name, "temperature")) return OP_READ_TEMPERATURE;
+    if (!strcmp(name, "step"))        return OP_STEP;
+    return -1;
+}
+
+int main(int argc, char** argv)
+{
+    const char* path     = "/tmp/cbc.sock";
+    int         port     = 0;
+    int         nrequest = 10000;
+    int         depth    = 1;
+    int         op       = OP_PING;
+    int         batch    = 0;
+    int         nsamples = -1;
+    int         nsteps   = 1;
+    int         interval = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:n:d:o:b:k:m:x:")) != -1) {
+        switch (opt) {
+            case 's': path     = optarg;          break;
+            case 't': port     = atoi(optarg);    break;
+            case 'n': nrequest = atoi(optarg);    break;
+            case 'd': depth    = atoi(optarg);    break;
+            case 'o': op       = parseOp(optarg); break;
+            case 'b': batch    = atoi(optarg);    break;
+            case 'k': nsamples = atoi(optarg);    break;
+            case 'm': nsteps   = atoi(optarg);    break;
+            case 'x': interval = atoi(optarg);    break;
+            default:  op = -1;                    break;
+        }
+    }
+    if (op < 0 || nrequest < 1 || depth < 1 || batch < 0 || batch > 1000 || nsteps < 1 || interval < 0) {
+        fprintf(stderr, "Usage: %s [-s socket | -t port] [-n requests] [-d depth] "
+                "[-o ping|state|read|all|temperature|step] [-b batch] [-k nsamples] [-m steps] [-x ms]\n", argv[0]);
+        return 1;
+    }
+
+    int fd = port ? connectTCP(port) : connectUnix(path);
+    if (fd < 0)
+        return 1;
+
+    Probe        prober;
+    std::thread* probing = NULL;
+    prober.done     = false;
+    prober.interval = interval;
+    prober.failures = 0;
+    if (interval) {
+        prober.fd = port ? connectTCP(port) : connectUnix(path);
+        if (prober.fd < 0)
+            return 1;
+        probing = new std::thread(probe, &prober);
+    }
+
+    std::vector<uint64_t> sent(nrequest);
+    std::vector<uint64_t> latency;
+    latency.reserve(nrequest);
+
+    std::vector<uint8_t> output;
+    std::vector<uint8_t> input;
+    size_t               inputAt  = 0;
+    int                  nsent    = 0;
+    int                  failures = 0;
+
+    uint64_t start = nanos();
+    while (int(latency.size()) < nrequest) {
+        /* top the pipeline up */
+        output.clear();
+        int inflight = nsent - int(latency.size());
+        while (inflight < depth && nsent < nrequest) {
+            putRequest(output, op, nsent, batch, nsamples, nsteps);
+            nsent++;
+            inflight++;
+        }
+        if (!output.empty()) {
+            uint64_t now = nanos();
+            for (int i=nsent-1; i>=0 && sent[i]==0; i--)
+                sent[i] = now;
+            if (!writeAll(fd, output))
+                return 1;
+        }
+
+        /* take whatever responses have arrived, at least one */
+        uint8_t buffer[65536];
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            fprintf(stderr, "cbc_load: server closed the connection\n");
+            return 1;
+        }
+        input.insert(input.end(), buffer, buffer + n);
+        uint64_t now = nanos();
+
+        while (input.size() - inputAt >= sizeof(uint32_t)) {
+            uint32_t length;
+            memcpy(&length, &input[inputAt], sizeof(length));
+            if (input.size() - inputAt - sizeof(uint32_t) < length)
+                break;
+
+            Reader   response(&input[inputAt + sizeof(uint32_t)], length);
+            uint32_t id     = response.get<uint32_t>();
+            response.get<uint16_t>();
+            int      status = response.get<int16_t>();
+            inputAt += sizeof(uint32_t) + length;
+
+            if (id != latency.size()) {
+                fprintf(stderr, "cbc_load: response %u out of order, expected %u\n", id, unsigned(latency.size()));
+                return 1;
+            }
+            if (status != STATUS_OK)
+                failures++;
+            else if (batch > 0) {
+                /* any failed command fails the request */
+                for (int i=0; i<batch; i++) {
+                    Reader result = response.sub(response.get<uint16_t>());
+                    if (!response.ok() || result.get<int16_t>() != STATUS_OK) {
+                        failures++;
+                        break;
+                    }
+                }
+            }
+            latency.push_back(now - sent[id]);
+        }
+        input.erase(input.begin(), input.begin() + inputAt);
+        inputAt = 0;
+    }
+    uint64_t elapsed = nanos() - start;
+    close(fd);
+
+    if (probing) {
+        prober.done = true;
+        probing->join();
+        delete probing;
+        close(prober.fd);
+        failures += prober.failures;
+    }
+
+    double seconds   = elapsed / 1e9;
+    int    ncommands = nrequest * (batch > 0 ? batch : 1);
+    printf("%d requests, %d commands in %.3f s, depth %d: %.0f requests/s, %.0f commands/s, %d failed\n",
+            nrequest, ncommands, seconds, depth, nrequest / seconds, ncommands / seconds, failures);
+    printLatency("latency", latency);
+    printLatency("disableAll latency", prober.latency);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,1064 @@
+/*
+ * cbc_server - own the board and serve the CBC API to local clients, with the
+ * length-prefixed binary protocol of ServerProtocol.hpp.
+ *
+ * Usage: cbc_server [-s socket] [-t port] [-p statuspage] [-e drives] [-u usbs] [-c maxage] [-w] [-m]
+ *
+ *   -s path    Unix socket to listen on (default /tmp/cbc.sock)
+ *   -t port    also listen on TCP port, on 127.0.0.1 only
+ *   -p name    publish the status page name (c.f. tools/cbc_status)
+ *   -e mask    drives to enable at start up (CBC::Config::driveEnable)
+ *   -u mask    USBs to enable at start up (CBC::Config::usbEnable)
+ *   -c us      answer repeated measurements with a result up to us old
+ *              (CBC::Config::adcCoalescingMaxAge)
+ *   -w         warm start: change only the board settings which differ, for
+ *              a restart on a board already set up (CBC::Config::warmStart)
+ *   -m         run on the simulated board, on a virtual clock
+ *
+ * The main thread serves the sockets of all clients from a poll() loop and
+ * hands their requests to worker threads: one for each priority class of the
+ * library (c.f. OperationScheduler), and NMEASUREMENT for measurements, so a
+ * long step of one client holds up neither the measurements of another,
+ * which the library may then share, nor its disableAll.
+ *
+ * A client's requests are executed in order, consecutive ones of the same
+ * class together as one job, and their responses are sent in order, so a
+ * pipelined client gets many responses per system call. Only a safety
+ * request goes ahead, of the client's requests already executing, so that a
+ * client can stop its own motion. A client whose output backs up, or whose
+ * requests pile up, is not read from until it catches up.
+ */
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cbc.hpp>
+#include <MirrorControlBoard.hpp>
+#include <OperationScheduler.hpp>
+#include <ServerProtocol.hpp>
+
+using namespace ServerProtocol;
+
+// Stop reading from a client with this much output pending, or this many
+// jobs waiting
+static const size_t MAX_PENDING_OUTPUT = 1 << 20;
+static const size_t MAX_PENDING_JOBS   = 64;
+
+// Largest acquisition a client may ask for, some 1.3 s of samples at the
+// TLC3548's 200 kSPS
+static const int MAX_SAMPLES = 1 << 18;
+
+// Measurement workers, so that concurrent measurements of several clients
+// can share acquisitions
+static const int NMEASUREMENT = 4;
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int)
+{
+    stopping = 1;
+}
+
+static uint64_t nanos()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return uint64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+//------------------------------------------------------------------------------
+// Clients
+//------------------------------------------------------------------------------
+
+struct Stream {
+    bool     active;
+    bool     busy;          // a frame is with the workers
+    uint32_t id;
+    int      nsamples;
+    int      remaining;
+    uint64_t interval;      // ns
+    uint64_t next;          // monotonic ns of the next frame
+};
+
+struct Job;
+
+struct Client {
+    int                  fd;        // -1 once closed
+    std::vector<uint8_t> in;
+    std::vector<uint8_t> out;
+    size_t               written;   // bytes of out already sent
+    Stream               stream;
+    std::deque<Job*>     jobs;      // requests taken, in order
+    int                  running;   // jobs with the workers, stream frames included
+};
+
+// Requests of one client for a worker, or a frame of its stream. Only the
+// main thread touches the client; the worker fills in responses.
+struct Job {
+    Client*              client;
+    int                  priority;      // OperationScheduler::Class
+    bool                 startStream;   // OP_STREAM_ENCODERS, which the main thread takes
+    bool                 dispatched;
+    bool                 done;
+    std::vector<uint8_t> requests;      // whole frames, in order
+    std::vector<uint8_t> responses;
+
+    bool                 stream;        // a frame of the stream below
+    Stream               frame;
+};
+
+static void setNonBlocking(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Sends what it can of the client's output; false if the client went away
+static bool flush(Client& client)
+{
+    while (client.written < client.out.size()) {
+        ssize_t n = write(client.fd, &client.out[client.written], client.out.size() - client.written);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return (errno == EAGAIN || errno == EWOULDBLOCK);
+        }
+        client.written += n;
+    }
+    client.out.clear();
+    client.written = 0;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Commands
+//------------------------------------------------------------------------------
+
+static void putADC(Writer& results, const CBC::ADC::adcData& data)
+{
+    results.put<float>  (data.voltage);
+    results.put<float>  (data.stddev);
+    results.put<float>  (data.voltageMin);
+    results.put<float>  (data.voltageMax);
+    results.put<float>  (data.voltageError);
+    results.put<float>  (data.sampleRate);
+    results.put<int32_t>(data.status);
+}
+
+static int samples(CBC& cbc, int nsamples)
+{
+    return (nsamples < 0) ? cbc.adc.getDefaultSamples() : nsamples;
+}
+
+static bool validSamples(int nsamples)
+{
+    return nsamples <= MAX_SAMPLES;
+}
+
+// Executes one command; its results are appended to results
+static int execute(CBC& cbc, int op, Reader& args, Writer& results)
+{
+    switch (op) {
+        case OP_PING:
+            break;
+
+        case OP_POWER_UP:
+            cbc.powerUp();
+            break;
+
+        case OP_POWER_DOWN:
+            cbc.powerDown();
+            break;
+
+        case OP_STEP: {
+            int drive     = args.get<int32_t>();
+            int nsteps    = args.get<int32_t>();
+            int frequency = args.get<int32_t>();
+            if (!args.ok() || drive < 1 || drive > 6 || frequency < 0)
+                return STATUS_BAD_REQUEST;
+            if (frequency)
+                cbc.driver.step(drive, nsteps, frequency);
+            else
+                cbc.driver.step(drive, nsteps);
+            break;
+        }
+
+        case OP_DRIVE_ENABLE: {
+            int drive  = args.get<int32_t>();
+            int enable = args.get<int32_t>();
+            if (!args.ok() || drive < 0 || drive > 6)
+                return STATUS_BAD_REQUEST;
+            if (drive == 0 && enable)
+                cbc.driver.enableAll();
+            else if (drive == 0)
+                cbc.driver.disableAll();
+            else if (enable)
+                cbc.driver.enable(drive);
+            else
+                cbc.driver.disable(drive);
+            break;
+        }
+
+        case OP_DRIVER_AWAKE: {
+            int awake = args.get<int32_t>();
+            if (!args.ok())
+                return STATUS_BAD_REQUEST;
+            if (awake)
+                cbc.driver.wakeup();
+            else
+                cbc.driver.sleep();
+            break;
+        }
+
+        case OP_DRIVER_RESET:
+            cbc.driver.reset();
+            break;
+
+        case OP_HIGH_CURRENT: {
+            int enable = args.get<int32_t>();
+            if (!args.ok())
+                return STATUS_BAD_REQUEST;
+            if (enable)
+                cbc.driver.enableHighCurrent();
+            else
+                cbc.driver.disableHighCurrent();
+            break;
+        }
+
+        case OP_SR: {
+            int enable = args.get<int32_t>();
+            if (!args.ok())
+                return STATUS_BAD_REQUEST;
+            if (enable)
+                cbc.driver.enableSR();
+            else
+                cbc.driver.disableSR();
+            break;
+        }
+
+        case OP_MICROSTEPS: {
+            int microsteps = args.get<int32_t>();
+            if (!args.ok() || (microsteps != 1 && microsteps != 2 && microsteps != 4 && microsteps != 8))
+                return STATUS_BAD_REQUEST;
+            cbc.driver.setMicrosteps(microsteps);
+            break;
+        }
+
+        case OP_USB_ENABLE: {
+            int usb    = args.get<int32_t>();
+            int enable = args.get<int32_t>();
+            if (!args.ok() || usb < 0 || usb > 6)
+                return STATUS_BAD_REQUEST;
+            if (usb == 0 && enable)
+                cbc.usb.enableAll();
+            else if (usb == 0)
+                cbc.usb.disableAll();
+            else if (enable)
+                cbc.usb.enable(usb);
+            else
+                cbc.usb.disable(usb);
+            break;
+        }
+
+        case OP_ENCODER_POWER: {
+            int enable = args.get<int32_t>();
+            if (!args.ok())
+                return STATUS_BAD_REQUEST;
+            if (enable)
+                cbc.encoder.enable();
+            else
+                cbc.encoder.disable();
+            break;
+        }
+
+        case OP_SENSOR_POWER: {
+            int enable = args.get<int32_t>();
+            if (!args.ok())
+                return STATUS_BAD_REQUEST;
+            if (enable)
+                cbc.auxSensor.enable();
+            else
+                cbc.auxSensor.disable();
+            break;
+        }
+
+        case OP_READ_ENCODER: {
+            int encoder  = args.get<int32_t>();
+            int nsamples = samples(cbc, args.get<int32_t>());
+            if (!args.ok() || encoder < 1 || encoder > 6 || !validSamples(nsamples))
+                return STATUS_BAD_REQUEST;
+            putADC(results, cbc.adc.readEncoder(encoder, nsamples));
+            break;
+        }
+
+        case OP_READ_ALL: {
+            int nsamples = samples(cbc, args.get<int32_t>());
+            if (!args.ok() || !validSamples(nsamples))
+                return STATUS_BAD_REQUEST;
+            std::array<CBC::ADC::adcData,6> data = cbc.adc.readAllEncoders(nsamples);
+            for (int i=0; i<6; i++)
+                putADC(results, data[i]);
+            break;
+        }
+
+        case OP_READ_TEMPERATURE: {
+            int nsamples = samples(cbc, args.get<int32_t>());
+            if (!args.ok() || !validSamples(nsamples))
+                return STATUS_BAD_REQUEST;
+
+            /* volts to degrees, as CBC::ADC::readTemperature */
+            CBC::ADC::adcData data = cbc.adc.readTemperatureVolts(nsamples);
+            data.voltage      = (data.voltage    - 0.5) * 100;
+            data.voltageMin   = (data.voltageMin - 0.5) * 100;
+            data.voltageMax   = (data.voltageMax - 0.5) * 100;
+            data.stddev       = data.stddev       * 100;
+            data.voltageError = data.voltageError * 100;
+            putADC(results, data);
+            break;
+        }
+
+        case OP_MEASURE: {
+            int adc      = args.get<int32_t>();
+            int channel  = args.get<int32_t>();
+            int nsamples = samples(cbc, args.get<int32_t>());
+            if (!args.ok() || adc < 0 || adc > 1 || channel < 0 || channel > 10 || !validSamples(nsamples))
+                return STATUS_BAD_REQUEST;
+            putADC(results, cbc.adc.measure(adc, channel, nsamples));
+            break;
+        }
+
+        case OP_GET_STATE: {
+            int usb = 0, drives = 0;
+            for (int i=0; i<7; i++)
+                if (cbc.board().isUSBPoweredUp(i))
+                    usb |= 0x1 << i;
+            for (int i=0; i<6; i++)
+                if (cbc.board().isDriveEnabled(i))
+                    drives |= 0x1 << i;
+
+            results.put<int32_t>(usb);
+            results.put<int32_t>(drives);
+            results.put<int32_t>(cbc.driver.isAwake());
+            results.put<int32_t>(cbc.driver.isHighCurrentEnabled());
+            results.put<int32_t>(cbc.driver.isSREnabled());
+            results.put<int32_t>(cbc.encoder.isEnabled());
+            results.put<int32_t>(cbc.auxSensor.isEnabled());
+            results.put<int32_t>(cbc.driver.getMicrosteps());
+            results.put<int32_t>(cbc.driver.getSteppingFrequency());
+            break;
+        }
+
+        default:
+            return STATUS_UNKNOWN_OP;
+    }
+    return STATUS_OK;
+}
+
+// Each command of the batch, with its result, in order
+static int executeBatch(CBC& cbc, Reader& args, Writer& results)
+{
+    int count = args.get<uint16_t>();
+    if (!args.ok())
+        return STATUS_BAD_REQUEST;
+
+    for (int i=0; i<count; i++) {
+        int    length  = args.get<uint16_t>();
+        Reader command = args.sub(length);
+        int    op      = command.get<uint16_t>();
+        if (!args.ok() || !command.ok())
+            return STATUS_BAD_REQUEST;
+
+        size_t lengthAt = results.reserve<uint16_t>();
+        size_t statusAt = results.reserve<int16_t>();
+
+        int status = STATUS_BAD_REQUEST;
+        if (op != OP_BATCH && op != OP_STREAM_ENCODERS)
+            status = execute(cbc, op, command, results);
+
+        results.patch<int16_t> (statusAt, status);
+        results.patch<uint16_t>(lengthAt, results.size() - lengthAt - sizeof(uint16_t));
+    }
+    return STATUS_OK;
+}
+
+//------------------------------------------------------------------------------
+// Requests and responses
+//------------------------------------------------------------------------------
+
+static void respond(std::vector<uint8_t>& out, int status, size_t frameAt, size_t statusAt)
+{
+    Writer response(out);
+
+    /* a failed request carries no results */
+    if (status != STATUS_OK && status != STATUS_MORE)
+        out.resize(statusAt + sizeof(int16_t));
+    if (out.size() - frameAt - sizeof(uint32_t) > MAX_FRAME) {
+        out.resize(statusAt + sizeof(int16_t));
+        status = STATUS_TOO_LARGE;
+    }
+
+    response.patch<int16_t> (statusAt, status);
+    response.patch<uint32_t>(frameAt, out.size() - frameAt - sizeof(uint32_t));
+}
+
+// Opens a response frame; returns the offset of the status field
+static size_t beginResponse(std::vector<uint8_t>& out, uint32_t id, int op, size_t& frameAt)
+{
+    Writer response(out);
+    frameAt = response.reserve<uint32_t>();
+    response.put<uint32_t>(id);
+    response.put<uint16_t>(op);
+    return response.reserve<int16_t>();
+}
+
+static void handleRequest(CBC& cbc, std::vector<uint8_t>& out, Reader request)
+{
+    uint32_t id = request.get<uint32_t>();
+    int      op = request.get<uint16_t>();
+    request.get<uint16_t>();
+
+    size_t frameAt;
+    size_t statusAt = beginResponse(out, id, op, frameAt);
+    Writer results(out);
+
+    int status;
+    if (!request.ok())
+        status = STATUS_BAD_REQUEST;
+    else if (op == OP_BATCH)
+        status = executeBatch(cbc, request, results);
+    else
+        status = execute(cbc, op, request, results);
+
+    respond(out, status, frameAt, statusAt);
+}
+
+// Starts the client's stream, once the requests before are answered
+static void handleStreamRequest(CBC& cbc, Client& client, Reader request)
+{
+    uint32_t id = request.get<uint32_t>();
+    int      op = request.get<uint16_t>();
+    request.get<uint16_t>();
+
+    int nsamples = samples(cbc, request.get<int32_t>());
+    int nframes  = request.get<int32_t>();
+    int interval = request.get<int32_t>();
+    if (request.ok() && !client.stream.active && validSamples(nsamples) && nframes > 0 && interval >= 0) {
+        client.stream.active    = true;
+        client.stream.id        = id;
+        client.stream.nsamples  = nsamples;
+        client.stream.remaining = nframes;
+        client.stream.interval  = uint64_t(interval) * 1000;
+        client.stream.next      = nanos();
+        return;
+    }
+    size_t frameAt;
+    size_t statusAt = beginResponse(client.out, id, op, frameAt);
+    respond(client.out, STATUS_BAD_REQUEST, frameAt, statusAt);
+}
+
+// The next frame of a stream
+static void handleStream(CBC& cbc, const Stream& stream, std::vector<uint8_t>& out)
+{
+    size_t frameAt;
+    size_t statusAt = beginResponse(out, stream.id, OP_STREAM_ENCODERS, frameAt);
+    Writer results(out);
+
+    std::array<CBC::ADC::adcData,6> data = cbc.adc.readAllEncoders(stream.nsamples);
+    for (int i=0; i<6; i++)
+        putADC(results, data[i]);
+
+    respond(out, stream.remaining ? STATUS_MORE : STATUS_OK, frameAt, statusAt);
+}
+
+//------------------------------------------------------------------------------
+// Workers
+//------------------------------------------------------------------------------
+
+struct Queue {
+    std::mutex              lock;
+    std::condition_variable ready;
+    std::deque<Job*>        jobs;
+};
+
+static Queue              queues[OperationScheduler::NCLASS];
+
+// Jobs done, for the main thread, which the workers wake through a pipe
+static std::mutex         finishedLock;
+static std::vector<Job*>  finished;
+static int                wakeup[2];
+
+// The class a command runs in within the library
+static int priority(int op, Reader& args)
+{
+    switch (op) {
+        case OP_POWER_DOWN:
+            return OperationScheduler::SAFETY;
+
+        case OP_DRIVE_ENABLE:
+            args.get<int32_t>();
+            return args.get<int32_t>() ? OperationScheduler::MOTION : OperationScheduler::SAFETY;
+
+        case OP_DRIVER_AWAKE:
+            return args.get<int32_t>() ? OperationScheduler::MOTION : OperationScheduler::SAFETY;
+
+        case OP_STEP:
+        case OP_DRIVER_RESET:
+        case OP_HIGH_CURRENT:
+        case OP_SR:
+        case OP_MICROSTEPS:
+            return OperationScheduler::MOTION;
+
+        case OP_READ_ENCODER:
+        case OP_READ_ALL:
+        case OP_READ_TEMPERATURE:
+        case OP_MEASURE:
+        case OP_STREAM_ENCODERS:
+            return OperationScheduler::MEASUREMENT;
+
+        default:
+            return OperationScheduler::HOUSEKEEPING;
+    }
+}
+
+// A batch runs in the least urgent class of its commands, so that a safety
+// worker is never held up by the rest of a batch
+static int priority(Reader request)
+{
+    request.get<uint32_t>();
+    int op = request.get<uint16_t>();
+    request.get<uint16_t>();
+    if (op != OP_BATCH)
+        return priority(op, request);
+
+    int least = OperationScheduler::SAFETY;
+    int count = request.get<uint16_t>();
+    for (int i=0; i<count && request.ok(); i++) {
+        Reader command = request.sub(request.get<uint16_t>());
+        int    op      = command.get<uint16_t>();
+        least = std::max(least, priority(op, command));
+    }
+    return least;
+}
+
+static void run(CBC& cbc, Job& job)
+{
+    if (job.stream) {
+        handleStream(cbc, job.frame, job.responses);
+        return;
+    }
+
+    size_t at = 0;
+    while (at < job.requests.size()) {
+        uint32_t length;
+        memcpy(&length, &job.requests[at], sizeof(length));
+        handleRequest(cbc, job.responses, Reader(&job.requests[at + sizeof(uint32_t)], length));
+        at += sizeof(uint32_t) + length;
+    }
+}
+
+// Runs the calling thread at the real-time priority which the library gives
+// its stepping and acquisitions, to have the CPU at their next sched_yield()
+// rather than once they are done
+static void raisePriority()
+{
+    struct sched_param params;
+    params.sched_priority = sched_get_priority_max(SCHED_FIFO);
+    pthread_setschedparam(pthread_self(), SCHED_FIFO, &params);
+}
+
+static void work(CBC* cbc, Queue* queue)
+{
+    if (queue == &queues[OperationScheduler::SAFETY])
+        raisePriority();
+
+    for (;;) {
+        Job* job;
+        {
+            std::unique_lock<std::mutex> lock(queue->lock);
+            while (queue->jobs.empty() && !stopping)
+                queue->ready.wait(lock);
+            if (stopping)
+                return;
+            job = queue->jobs.front();
+            queue->jobs.pop_front();
+        }
+
+        run(*cbc, *job);
+
+        {
+            std::lock_guard<std::mutex> lock(finishedLock);
+            finished.push_back(job);
+        }
+        /* a full pipe wakes the main thread just as well */
+        char c = 0;
+        if (write(wakeup[1], &c, 1) < 0 && errno != EAGAIN)
+            perror("cbc_server: wakeup");
+    }
+}
+
+static void submit(Job* job)
+{
+    job->dispatched = true;
+    job->client->running++;
+
+    Queue& queue = queues[job->priority];
+    {
+        std::lock_guard<std::mutex> lock(queue.lock);
+        queue.jobs.push_back(job);
+    }
+    queue.ready.notify_one();
+}
+
+//------------------------------------------------------------------------------
+// Requests and responses
+//------------------------------------------------------------------------------
+
+// Takes every complete request in the client's input, joining it to the last
+// job if that is of the same class and still waiting; false if the client
+// sent a frame too large to accept
+static bool takeRequests(Client& client)
+{
+    size_t at = 0;
+    while (client.in.size() - at >= sizeof(uint32_t)) {
+        uint32_t length;
+        memcpy(&length, &client.in[at], sizeof(length));
+        if (length > MAX_FRAME || length < REQUEST_HEADER)
+            return false;
+        if (client.in.size() - at - sizeof(uint32_t) < length)
+            break;
+
+        Reader   request(&client.in[at + sizeof(uint32_t)], length);
+        uint16_t op;
+        memcpy(&op, &client.in[at + sizeof(uint32_t) + sizeof(uint32_t)], sizeof(op));
+
+        Job* last = client.jobs.empty() ? NULL : client.jobs.back();
+        int  cls  = priority(request);
+        if (op == OP_STREAM_ENCODERS || !last || last->dispatched || last->startStream ||
+                last->priority != cls || last->requests.size() >= MAX_FRAME) {
+            last = new Job();
+            last->client      = &client;
+            last->priority    = cls;
+            last->startStream = (op == OP_STREAM_ENCODERS);
+            last->dispatched  = false;
+            last->done        = false;
+            last->stream      = false;
+            client.jobs.push_back(last);
+        }
+        last->requests.insert(last->requests.end(), client.in.begin() + at, client.in.begin() + at + sizeof(uint32_t) + length);
+        at += sizeof(uint32_t) + length;
+    }
+    client.in.erase(client.in.begin(), client.in.begin() + at);
+    return true;
+}
+
+// Sends the responses of the jobs done at the front of the client's queue,
+// and hands out the jobs which may go next: a job once the jobs before are
+// done, a safety job once they are all under way
+static void advance(CBC& cbc, Client& client)
+{
+    while (!client.jobs.empty()) {
+        Job* job = client.jobs.front();
+        if (job->startStream && !job->done) {
+            handleStreamRequest(cbc, client, Reader(&job->requests[sizeof(uint32_t)], job->requests.size() - sizeof(uint32_t)));
+            job->done = true;
+        }
+        if (!job->done)
+            break;
+        client.out.insert(client.out.end(), job->responses.begin(), job->responses.end());
+        client.jobs.pop_front();
+        delete job;
+    }
+
+    bool running = false;
+    for (unsigned i=0; i<client.jobs.size(); i++) {
+        Job* job = client.jobs[i];
+        if (job->dispatched)
+            running = true;
+        else if (job->startStream || (running && job->priority != OperationScheduler::SAFETY))
+            break;
+        else {
+            submit(job);
+            running = true;
+        }
+    }
+}
+
+// Hands the next frame of the client's stream to a worker
+static void submitStream(Client& client)
+{
+    Stream& stream = client.stream;
+
+    stream.remaining--;
+    stream.next += stream.interval;
+    if (stream.remaining == 0)
+        stream.active = false;
+    stream.busy = true;
+
+    Job* job = new Job();
+    job->client      = &client;
+    job->priority    = OperationScheduler::MEASUREMENT;
+    job->startStream = false;
+    job->done        = false;
+    job->stream      = true;
+    job->frame       = stream;
+    submit(job);
+}
+
+// Takes the jobs the workers are done with
+static void finish(CBC& cbc)
+{
+    char buffer[256];
+    while (read(wakeup[0], buffer, sizeof(buffer)) > 0)
+        ;
+
+    std::vector<Job*> jobs;
+    {
+        std::lock_guard<std::mutex> lock(finishedLock);
+        jobs.swap(finished);
+    }
+
+    for (unsigned i=0; i<jobs.size(); i++) {
+        Client& client = *jobs[i]->client;
+        client.running--;
+
+        if (jobs[i]->stream) {
+            if (client.fd >= 0)
+                client.out.insert(client.out.end(), jobs[i]->responses.begin(), jobs[i]->responses.end());
+            client.stream.busy = false;
+            delete jobs[i];
+        }
+        else
+            jobs[i]->done = true;
+
+        if (client.fd >= 0)
+            advance(cbc, client);
+    }
+}
+
+// Closes the client; it is deleted once the workers are done with its jobs
+static void drop(Client& client)
+{
+    close(client.fd);
+    client.fd = -1;
+    client.in.clear();
+    client.out.clear();
+    client.stream.active = false;
+
+    while (!client.jobs.empty() && !client.jobs.back()->dispatched) {
+        delete client.jobs.back();
+        client.jobs.pop_back();
+    }
+}
+
+static void destroy(Client* client)
+{
+    for (unsigned i=0; i<client->jobs.size(); i++)
+        delete client->jobs[i];
+    delete client;
+}
+
+//------------------------------------------------------------------------------
+// Listeners
+//------------------------------------------------------------------------------
+
+static int listenUnix(const char* path)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("cbc_server: socket");
+        return -1;
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    setNonBlocking(fd);
+    return fd;
+}
+
+static int listenTCP(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("cbc_server: socket");
+        return -1;
+    }
+
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(fd, 64) < 0) {
+        perror("cbc_server: tcp");
+        close(fd);
+        return -1;
+    }
+    setNonBlocking(fd);
+    return fd;
+}
+
+static void acceptClients(int listener, bool tcp, std::vector<Client*>& clients)
+{
+    for (;;) {
+        int fd = accept(listener, NULL, NULL);
+        if (fd < 0)
+            return;
+
+        setNonBlocking(fd);
+        if (tcp) {
+            int on = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+
+        Client* client = new Client();
+        client->fd      = fd;
+        client->written = 0;
+        client->running = 0;
+        client->stream.active = false;
+        client->stream.busy   = false;
+        clients.push_back(client);
+    }
+}
+
+//------------------------------------------------------------------------------
+// Main loop
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+    const char* path = "/tmp/cbc.sock";
+    int         port = 0;
+
+    CBC::Config config;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:t:p:e:u:c:wm")) != -1) {
+        switch (opt) {
+            case 's':
+                path = optarg;
+                break;
+            case 't':
+                port = atoi(optarg);
+                break;
+            case 'p':
+                config.statusPage = optarg;
+                break;
+            case 'e':
+                config.driveEnable = strtol(optarg, NULL, 0);
+                break;
+            case 'u':
+                config.usbEnable = strtol(optarg, NULL, 0);
+                break;
+            case 'c':
+                config.adcCoalescing       = true;
+                config.adcCoalescingMaxAge = atoi(optarg);
+                break;
+            case 'w':
+                config.warmStart = true;
+                break;
+            case 'm':
+                config.hardwareBackend = CBC::HW_SIMULATED;
+                config.virtualTime     = true;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s socket] [-t port] [-p statuspage] [-e drives] [-u usbs] [-c maxage] [-w] [-m]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT,  stop);
+    signal(SIGTERM, stop);
+
+    int unixListener = listenUnix(path);
+    int tcpListener  = port ? listenTCP(port) : -1;
+    if (unixListener < 0 || (port && tcpListener < 0))
+        return 1;
+
+    CBC cbc(config);
+
+    /* the workers leave the signals to the main thread, which polls */
+    if (pipe(wakeup) < 0) {
+        perror("cbc_server: pipe");
+        return 1;
+    }
+    setNonBlocking(wakeup[0]);
+    setNonBlocking(wakeup[1]);
+
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    std::vector<std::thread*> workers;
+    for (int cls=0; cls<OperationScheduler::NCLASS; cls++) {
+        int nworker = (cls == OperationScheduler::MEASUREMENT) ? NMEASUREMENT : 1;
+        for (int i=0; i<nworker; i++)
+            workers.push_back(new std::thread(work, &cbc, &queues[cls]));
+    }
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+    /* safety requests reach their worker while a step is under way */
+    raisePriority();
+
+    std::vector<Client*>       clients;
+    std::vector<struct pollfd> fds;
+
+    while (!stopping) {
+        /* wake for the earliest stream frame due */
+        uint64_t now     = nanos();
+        int      timeout = -1;
+        for (unsigned i=0; i<clients.size(); i++) {
+            if (!clients[i]->stream.active || clients[i]->stream.busy)
+                continue;
+            int wait = (clients[i]->stream.next > now) ? (clients[i]->stream.next - now + 999999) / 1000000 : 0;
+            if (timeout < 0 || wait < timeout)
+                timeout = wait;
+        }
+
+        fds.clear();
+        struct pollfd pfd;
+        pfd.fd = unixListener; pfd.events = POLLIN; pfd.revents = 0;
+        fds.push_back(pfd);
+        pfd.fd = tcpListener;
+        fds.push_back(pfd);
+        pfd.fd = wakeup[0];
+        fds.push_back(pfd);
+        for (unsigned i=0; i<clients.size(); i++) {
+            pfd.fd     = clients[i]->fd;
+            pfd.events = 0;
+            if (clients[i]->out.size() < MAX_PENDING_OUTPUT && clients[i]->jobs.size() < MAX_PENDING_JOBS)
+                pfd.events |= POLLIN;
+            if (!clients[i]->out.empty())
+                pfd.events |= POLLOUT;
+            fds.push_back(pfd);
+        }
+
+        if (poll(&fds[0], fds.size(), timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("cbc_server: poll");
+            break;
+        }
+
+        if (fds[2].revents & POLLIN)
+            finish(cbc);
+
+        /* existing clients first, as fds[] lines up with them */
+        now = nanos();
+        std::vector<Client*> alive;
+        for (unsigned i=0; i<clients.size(); i++) {
+            Client* client  = clients[i];
+            short   revents = fds[i+3].revents;
+            bool    ok      = true;
+
+            if (client->fd < 0) {
+                if (client->running)
+                    alive.push_back(client);
+                else
+                    destroy(client);
+                continue;
+            }
+
+            if (revents & POLLIN) {
+                uint8_t buffer[65536];
+                ssize_t n = read(client->fd, buffer, sizeof(buffer));
+                if (n > 0) {
+                    client->in.insert(client->in.end(), buffer, buffer + n);
+                    ok = takeRequests(*client);
+                    if (ok)
+                        advance(cbc, *client);
+                }
+                else if (n == 0 || (errno != EAGAIN && errno != EINTR))
+                    ok = false;
+            }
+            else if (revents & (POLLHUP | POLLERR))
+                ok = false;
+
+            if (ok && client->stream.active && !client->stream.busy && client->stream.next <= now)
+                submitStream(*client);
+
+            if (ok)
+                ok = flush(*client);
+
+            if (!ok)
+                drop(*client);
+            if (client->fd >= 0 || client->running)
+                alive.push_back(client);
+            else
+                destroy(client);
+        }
+        clients.swap(alive);
+
+        if (fds[0].revents & POLLIN)
+            acceptClients(unixListener, false, clients);
+        if (tcpListener >= 0 && (fds[1].revents & POLLIN))
+            acceptClients(tcpListener, true, clients);
+    }
+
+    /* the workers stop after the jobs under way */
+    for (int cls=0; cls<OperationScheduler::NCLASS; cls++) {
+        std::lock_guard<std::mutex> lock(queues[cls].lock);
+        queues[cls].ready.notify_all();
+    }
+    for (unsigned i=0; i<workers.size(); i++) {
+        workers[i]->join();
+        delete workers[i];
+    }
+
+    /* stream frames are owned by no client's queue */
+    for (int cls=0; cls<OperationScheduler::NCLASS; cls++)
+        for (unsigned i=0; i<queues[cls].jobs.size(); i++)
+            if (queues[cls].jobs[i]->stream)
+                delete queues[cls].jobs[i];
+    for (unsigned i=0; i<finished.size(); i++)
+        if (finished[i]->stream)
+            delete finished[i];
+
+    for (unsigned i=0; i<clients.size(); i++) {
+        if (clients[i]->fd >= 0)
+            close(clients[i]->fd);
+        destroy(clients[i]);
+    }
+    close(wakeup[0]);
+    close(wakeup[1]);
+    close(unixListener);
+    if (tcpListener >= 0)
+        close(tcpListener);
+    unlink(path);
+
+    return 0;
+}
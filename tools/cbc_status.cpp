@@ -0,0 +1,130 @@
+/*
+ * cbc_status - print the board state published by the process owning a CBC
+ * (c.f. CBC::Config::statusPage), without touching the hardware.
+ *
+ * Usage: cbc_status [-n name] [-w milliseconds]
+ *
+ * Reads the status page name (default /cbc_status) once, or every given
+ * number of milliseconds with -w until interrupted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <StatusPage.hpp>
+#include <Metrics.hpp>
+
+static const char* onOff(int flag)
+{
+    return flag ? "on" : "off";
+}
+
+static double ageSeconds(uint64_t now, uint64_t time)
+{
+    return time ? (double(now) - double(time)) / 1e9 : -1;
+}
+
+static void printLatency(const char* name, const Metrics::HistogramData& histogram)
+{
+    double mean = histogram.count ? histogram.sum / 1000.0 / histogram.count : 0;
+    printf("  %-11s %11llu  mean %10.2f us  p50 < %10.2f us  p99 < %10.2f us\n", name,
+            (unsigned long long) histogram.count, mean,
+            Metrics::percentile(histogram, 0.50) / 1000.0,
+            Metrics::percentile(histogram, 0.99) / 1000.0);
+}
+
+static void printStatus(const StatusPage::Status& status)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    uint64_t now = uint64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+
+    if (status.pid)
+        printf("publisher        pid %d, %llu updates, last %.3f s ago\n", status.pid,
+                (unsigned long long) status.updates, ageSeconds(now, status.updated));
+    else
+        printf("publisher        closed, last update %.3f s ago\n", ageSeconds(now, status.updated));
+
+    printf("drivers          %s, high current %s, SR %s, %d microsteps, %d Hz\n",
+            status.driversAwake ? "awake" : "asleep", onOff(status.highCurrent),
+            onOff(status.syncRectification), status.microsteps, status.steppingFrequency);
+    printf("encoders         %s\n", onOff(status.encodersEnabled));
+    printf("sensors          %s\n", onOff(status.sensorsEnabled));
+    printf("ethernet         %s\n", onOff(status.usbEnabled & 0x1));
+
+    printf("usb              ");
+    for (int i=1; i<7; i++)
+        printf(" %d:%-3s", i, onOff((status.usbEnabled >> i) & 0x1));
+    printf("\n");
+
+    printf("drive  enabled  position  encoder [V]  age [s]\n");
+    for (int i=0; i<6; i++)
+        printf("  %d    %-3s    %9lld  %11.4f  %7.3f\n", i+1, onOff((status.drivesEnabled >> i) & 0x1),
+                (long long) status.position[i], status.encoderVoltage[i], ageSeconds(now, status.encoderTime[i]));
+
+    printf("temperature      %.2f C, %.3f s ago\n", status.temperature, ageSeconds(now, status.temperatureTime));
+
+    const Metrics::Snapshot& metrics = status.metrics;
+    printf("metrics          %llu steps, %llu measurements (%llu samples, %llu coalesced), %llu SPI words, %llu sleeps, %llu power sequences\n",
+            (unsigned long long) metrics.counter[Metrics::STEPS],
+            (unsigned long long) metrics.counter[Metrics::ADC_MEASUREMENTS],
+            (unsigned long long) metrics.counter[Metrics::ADC_SAMPLES],
+            (unsigned long long) metrics.counter[Metrics::ADC_COALESCED],
+            (unsigned long long) metrics.counter[Metrics::SPI_WORDS],
+            (unsigned long long) metrics.counter[Metrics::SLEEPS],
+            (unsigned long long) metrics.counter[Metrics::POWER_SEQUENCES]);
+    printf("scheduling       %llu yields to safety commands, %llu safety commands past the wait limit\n",
+            (unsigned long long) metrics.counter[Metrics::YIELDS],
+            (unsigned long long) metrics.counter[Metrics::SAFETY_OVERRIDES]);
+    printLatency("step",    metrics.histogram[Metrics::LATENCY_STEP]);
+    printLatency("measure", metrics.histogram[Metrics::LATENCY_MEASURE]);
+    printLatency("spi word", metrics.histogram[Metrics::LATENCY_SPI_WORD]);
+    printLatency("sleep",   metrics.histogram[Metrics::LATENCY_SLEEP]);
+    printLatency("power",   metrics.histogram[Metrics::LATENCY_POWER]);
+    printLatency("safety wait", metrics.histogram[Metrics::LATENCY_SAFETY_WAIT]);
+    printLatency("safety", metrics.histogram[Metrics::LATENCY_SAFETY]);
+}
+
+int main(int argc, char** argv)
+{
+    const char* name     = "/cbc_status";
+    int         interval = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "n:w:")) != -1) {
+        switch (opt) {
+            case 'n':
+                name = optarg;
+                break;
+            case 'w':
+                interval = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n name] [-w milliseconds]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    StatusPage page(name, StatusPage::OBSERVE);
+    if (!page.isOpen())
+        return 1;
+
+    do {
+        StatusPage::Status status;
+        if (!page.read(status)) {
+            fprintf(stderr, "%s: no consistent status\n", name);
+            return 1;
+        }
+        printStatus(status);
+
+        if (interval > 0) {
+            printf("\n");
+            fflush(stdout);
+            usleep(interval * 1000);
+        }
+    } while (interval > 0);
+
+    return 0;
+}